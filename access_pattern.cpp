@@ -0,0 +1,238 @@
+#include "access_pattern.h"
+
+#include <fstream>
+#include <cstdlib>
+#include <algorithm>
+
+static const long lineBytes = 64;
+static const long pageBytes = 4096;
+
+PatternDetector::PatternDetector() {
+    for (int p=0; p<PatternCount; ++p)
+        counts[p] = 0;
+    for (int s=0; s<strideCounters; ++s) {
+        strides[s] = 0;
+        strideCounts[s] = 0;
+    }
+    lastAddr = 0;
+    started = false;
+    ringPos = 0;
+    ringFill = 0;
+}
+
+void PatternDetector::access(unsigned long addr, unsigned int size) {
+    if (!started) {
+        started = true;
+        lastAddr = addr;
+        return;
+    }
+
+    long delta = (long)(addr - lastAddr);
+    lastAddr = addr;
+
+    bool repeated = false;
+    for (int i=0; i<ringFill; ++i)
+        repeated |= ring[i] == delta;
+
+    if (delta >= 0 && delta <= lineBytes)
+        ++counts[Sequential];
+    else if (repeated) {
+        ++counts[Strided];
+        countStride(delta);
+    }
+    else if (std::labs(delta) <= pageBytes)
+        ++counts[Gather];
+    else
+        ++counts[Random];
+
+    ring[ringPos] = delta;
+    ringPos = (ringPos + 1) % ringSize;
+    ringFill = std::min(ringFill + 1, (int)ringSize);
+}
+
+void PatternDetector::countStride(long delta, unsigned long weight) {
+    for (int s=0; s<strideCounters; ++s)
+        if (strideCounts[s] > 0 && strides[s] == delta) {
+            strideCounts[s] += weight;
+            return;
+        }
+
+    // no counter free, take the weight off every counter until one is
+    unsigned long least = weight;
+    for (int s=0; s<strideCounters; ++s)
+        least = std::min(least, strideCounts[s]);
+    for (int s=0; s<strideCounters; ++s)
+        strideCounts[s] -= least;
+    weight -= least;
+
+    for (int s=0; s<strideCounters && weight > 0; ++s)
+        if (strideCounts[s] == 0) {
+            strides[s] = delta;
+            strideCounts[s] = weight;
+            return;
+        }
+}
+
+void PatternDetector::merge(const PatternDetector &other) {
+    for (int p=0; p<PatternCount; ++p)
+        counts[p] += other.counts[p];
+    for (int s=0; s<strideCounters; ++s)
+        if (other.strideCounts[s] > 0)
+            countStride(other.strides[s], other.strideCounts[s]);
+}
+
+unsigned long PatternDetector::accesses() const {
+    unsigned long total = 0;
+    for (int p=0; p<PatternCount; ++p)
+        total += counts[p];
+    return total;
+}
+
+PatternDetector::Pattern PatternDetector::pattern() const {
+    int best = Sequential;
+    for (int p=1; p<PatternCount; ++p)
+        if (counts[p] > counts[best])
+            best = p;
+    return (Pattern)best;
+}
+
+float PatternDetector::confidence() const {
+    unsigned long total = accesses();
+    return total > 0 ? (float)counts[pattern()] / total : 0.0f;
+}
+
+long PatternDetector::stride() const {
+    int best = 0;
+    for (int s=1; s<strideCounters; ++s)
+        if (strideCounts[s] > strideCounts[best])
+            best = s;
+    return strideCounts[best] > 0 ? strides[best] : 0;
+}
+
+std::string PatternDetector::name(Pattern pattern) {
+    switch (pattern) {
+        case Sequential: return "sequential";
+        case Strided: return "strided";
+        case Gather: return "gather";
+        default: return "random";
+    }
+}
+
+void AccessPatterns::access(size_t region, long activity, size_t occurrence, unsigned long addr, unsigned int size) {
+    streams[std::make_tuple(region, activity, occurrence)].access(addr, size);
+}
+
+std::map<std::pair<size_t, size_t>, PatternDetector> AccessPatterns::byOccurrence() const {
+    std::map<std::pair<size_t, size_t>, PatternDetector> combined;
+    for (auto &stream : streams)
+        if (std::get<1>(stream.first) != wholeRegion)
+            combined[std::make_pair((size_t)std::get<1>(stream.first), std::get<2>(stream.first))].merge(stream.second);
+    return combined;
+}
+
+static std::string nameOf(const std::vector<std::string> &names, long index) {
+    if (index == AccessPatterns::wholeRegion)
+        return "*";
+    return index < (long)names.size() ? names[index] : std::to_string(index);
+}
+
+bool AccessPatterns::saveCsv(const std::string &filename,
+                             const std::vector<std::string> &regionNames,
+                             const std::vector<std::string> &activityNames) const {
+
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Could not open \"" << filename << "\" to save access patterns" << std::endl;
+        return false;
+    }
+
+    out << "region,activity,occurrence,accesses,pattern,confidence,stride,sequential,strided,gather,random\n";
+    for (auto &stream : streams) {
+        const PatternDetector &detector = stream.second;
+        out << nameOf(regionNames, std::get<0>(stream.first)) << ","
+            << nameOf(activityNames, std::get<1>(stream.first)) << ",";
+        if (std::get<1>(stream.first) != wholeRegion)
+            out << std::get<2>(stream.first);
+        out << "," << detector.accesses() << "," << PatternDetector::name(detector.pattern())
+            << "," << detector.confidence() << "," << detector.stride();
+        for (int p=0; p<PatternDetector::PatternCount; ++p)
+            out << "," << detector.counts[p];
+        out << "\n";
+    }
+    return true;
+}
+
+void AccessPatterns::printSummary(std::ostream &out,
+                                  const std::vector<std::string> &regionNames,
+                                  const std::vector<std::string> &activityNames) const {
+
+    std::map<std::pair<size_t, long>, PatternDetector> combined;
+    for (auto &stream : streams)
+        combined[std::make_pair(std::get<0>(stream.first), std::get<1>(stream.first))].merge(stream.second);
+
+    int flagged = 0;
+    float mostNonSequential = 0;
+    const std::pair<size_t, long> *mostNonSequentialStream = nullptr;
+    for (auto &entry : combined) {
+        const PatternDetector &detector = entry.second;
+        if (detector.accesses() == 0)
+            continue;
+        if (detector.pattern() == PatternDetector::Sequential) {
+            float nonSequential = 1.0f - detector.confidence();
+            if (nonSequential > mostNonSequential) {
+                mostNonSequential = nonSequential;
+                mostNonSequentialStream = &entry.first;
+            }
+            continue;
+        }
+        out << "[\033[92mVMT\033[0m] [" << nameOf(regionNames, entry.first.first) << "] "
+            << (entry.first.second == wholeRegion ? std::string("all accesses") : nameOf(activityNames, entry.first.second))
+            << " : " << PatternDetector::name(detector.pattern())
+            << " (" << (int)(detector.confidence() * 100 + 0.5) << "% of " << detector.accesses() << " accesses";
+        if (detector.pattern() == PatternDetector::Strided)
+            out << ", stride " << detector.stride();
+        out << ")\n";
+        ++flagged;
+    }
+    // mostly sequential streams can still make many other accesses
+    if (flagged == 0 && mostNonSequentialStream == nullptr)
+        out << "[\033[92mVMT\033[0m] All region accesses are sequential.\n";
+    else if (flagged == 0)
+        out << "[\033[92mVMT\033[0m] No region is accessed mostly non-sequentially, the most non-sequential being ["
+            << nameOf(regionNames, mostNonSequentialStream->first) << "] "
+            << (mostNonSequentialStream->second == wholeRegion ? std::string("all accesses") : nameOf(activityNames, mostNonSequentialStream->second))
+            << " at " << (int)(mostNonSequential * 100 + 0.5) << "% of its accesses.\n";
+}
+
+void AccessPatterns::toStream(std::ostream &out) const {
+    unsigned long size = streams.size();
+    out.write((char*)&size, sizeof (size));
+    for (auto &stream : streams) {
+        unsigned long region = std::get<0>(stream.first), occurrence = std::get<2>(stream.first);
+        long activity = std::get<1>(stream.first);
+        out.write((char*)&region, sizeof (region));
+        out.write((char*)&activity, sizeof (activity));
+        out.write((char*)&occurrence, sizeof (occurrence));
+        out.write((char*)stream.second.counts, sizeof (stream.second.counts));
+        out.write((char*)stream.second.strides, sizeof (stream.second.strides));
+        out.write((char*)stream.second.strideCounts, sizeof (stream.second.strideCounts));
+    }
+}
+
+void AccessPatterns::fromStream(std::istream &in) {
+    unsigned long size = 0;
+    in.read((char*)&size, sizeof (size));
+    streams.clear();
+    for (unsigned long s=0; s<size && in; ++s) {
+        unsigned long region, occurrence;
+        long activity;
+        in.read((char*)&region, sizeof (region));
+        in.read((char*)&activity, sizeof (activity));
+        in.read((char*)&occurrence, sizeof (occurrence));
+        PatternDetector &detector = streams[std::make_tuple((size_t)region, activity, (size_t)occurrence)];
+        in.read((char*)detector.counts, sizeof (detector.counts));
+        in.read((char*)detector.strides, sizeof (detector.strides));
+        in.read((char*)detector.strideCounts, sizeof (detector.strideCounts));
+    }
+    enabled = true;
+}
@@ -0,0 +1,92 @@
+#ifndef __ACCESS_PATTERN_H__
+#define __ACCESS_PATTERN_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <iostream>
+
+/*
+    Streaming classifier of the address pattern of an access stream.
+
+    Each access is classified from its delta to the previous access of the
+    same stream. Small forward steps within a cache line are sequential, a
+    delta matching one of the last few deltas is a constant stride, other
+    deltas within a page are gather-like and anything further is random.
+    The stream is given the class most of its accesses fell in, with the
+    fraction of accesses in that class as the confidence. Repeating deltas
+    are counted with a few Misra-Gries counters to find the main stride.
+*/
+class PatternDetector
+{
+public:
+    enum Pattern : char { Sequential, Strided, Gather, Random, PatternCount };
+
+    static const int ringSize = 8;
+    static const int strideCounters = 4;
+
+    PatternDetector();
+
+    void access(unsigned long addr, unsigned int size);
+
+    // adds the counts of another stream, used to summarise many streams
+    void merge(const PatternDetector &other);
+
+    unsigned long accesses() const;
+    Pattern pattern() const;
+    float confidence() const;
+    long stride() const;
+
+    static std::string name(Pattern pattern);
+
+    unsigned long counts[PatternCount];
+
+    long strides[strideCounters];
+    unsigned long strideCounts[strideCounters];
+
+private:
+    void countStride(long delta, unsigned long weight = 1);
+
+    unsigned long lastAddr;
+    bool started;
+    long ring[ringSize];
+    int ringPos, ringFill;
+};
+
+/*
+    Pattern detectors of every region, per activity occurrence running when
+    the accesses were made and for the region as a whole.
+*/
+class AccessPatterns
+{
+public:
+    AccessPatterns() : enabled(false) {}
+
+    static const long wholeRegion = -1;
+
+    void access(size_t region, long activity, size_t occurrence, unsigned long addr, unsigned int size);
+
+    // every region's accesses during each activity occurrence combined
+    std::map<std::pair<size_t, size_t>, PatternDetector> byOccurrence() const;
+
+    bool saveCsv(const std::string &filename,
+                 const std::vector<std::string> &regionNames,
+                 const std::vector<std::string> &activityNames) const;
+
+    // lists the activities with non-sequential access to each region,
+    // combined over their occurrences.
+    void printSummary(std::ostream &out,
+                      const std::vector<std::string> &regionNames,
+                      const std::vector<std::string> &activityNames) const;
+
+    void toStream(std::ostream &out) const;
+    void fromStream(std::istream &in);
+
+    bool enabled;
+
+    // keyed by region, activity and occurrence
+    std::map<std::tuple<size_t, long, size_t>, PatternDetector> streams;
+};
+
+#endif  // __ACCESS_PATTERN_H__
@@ -35,5 +35,9 @@ void Activity::stopEvent(unsigned long instructionCount) {
     // assert that the activithy is currently active
     //assert(occurrences.size() > 0 && occurrences.back().stop == 0 && "Error. Cannot stop and event that isn't active.");
 
+    // a stop marker is a plain load of the flag, ignore any before the first start
+    if (occurrences.empty())
+        return;
+
     occurrences.back().stop = instructionCount;
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include <string>
 #include <fstream>
 
+#include "byte_traffic.h"
+
 class Activity {
 public:
     Activity(std::string name, unsigned long addr);
@@ -15,6 +17,9 @@ public:
     public:
         Occurrence(unsigned long start);
         unsigned long start, stop;
+
+        // bytes accessed in the memory regions while the occurrence ran
+        ByteTraffic traffic;
     };
 
     void startEvent(unsigned long instructionCount);
@@ -35,6 +40,8 @@ public:
             stream.write((char*)&occ.start, sizeof (unsigned long));
             stream.write((char*)&occ.stop, sizeof (unsigned long));
         }
+
+        return stream;
     }
 
     std::string name;
@@ -0,0 +1,299 @@
+/*
+    Pipeline benchmark.
+    -------------------------
+
+    Times each stage of the analysis pipeline on a synthetic Lackey stream,
+    so changes can be measured without running Valgrind on a real program.
+    The stream is generated up front then parsed, looked up in the region
+    index, accumulated into the regions row by row as the analyser does,
+    saved and loaded again as a trace file and finally plotted. Throughput
+    and peak resident set size after each stage are printed and saved as
+    JSON.
+
+    Usage: vis_mem_bench [--out=bench.json] [--regions=4] [--region_size=1048576]
+                         [--resolution=1000] [--instructions=1000000]
+                         [--accesses=0.5] [--loads=0.6] [--stores=0.3]
+                         [--stride=8] [--random=0.1] [--outside=0.2]
+                         [--activities=4] [--event_every=10000] [--seed=1]
+                         [--ins_per_row=1000] [--emit=<prefix>]
+
+    --emit writes the stream to <prefix>.lackey and its regions and
+    activities as text protocol messages to <prefix>.ctl instead of
+    benchmarking, to feed vis_mem_analyzer.
+*/
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <sys/resource.h>
+#include "trace_image.h"
+#include "trace_session.h"
+#include "synthetic_workload.h"
+#include "lackey_line.h"
+
+class Stage {
+public:
+    std::string name, unit;
+    unsigned long items;
+    double seconds;
+    long peakRssKb;
+};
+
+class Access {
+public:
+    char type;
+    unsigned long addr;
+    unsigned int size;
+};
+
+static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// times f, which returns the number of items it processed
+template <class F>
+static Stage runStage(const std::string &name, const std::string &unit, F f) {
+    auto start = std::chrono::steady_clock::now();
+    Stage stage;
+    stage.name = name;
+    stage.unit = unit;
+    stage.items = f();
+    stage.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stage.peakRssKb = peakRssKb();
+    std::cerr << "[\033[92mVMT\033[0m] " << name << " : " << stage.items << " " << unit << " in "
+              << stage.seconds << " s, " << (stage.seconds > 0 ? stage.items / stage.seconds : 0) << " "
+              << unit << "/s, peak RSS " << stage.peakRssKb << " KB\n";
+    return stage;
+}
+
+// the trace session reports progress on std::cout, which would swamp the timings
+class QuietCout {
+public:
+    QuietCout() : buffer(std::cout.rdbuf(nullptr)) {}
+    ~QuietCout() {
+        std::cout.rdbuf(buffer);
+        std::cout.clear();
+    }
+private:
+    std::streambuf *buffer;
+};
+
+static void resetSession() {
+    TraceSession::memoryRegions.clear();
+    TraceSession::regionIndex.build(TraceSession::memoryRegions);
+    TraceSession::activities.clear();
+    TraceSession::activityIndex.clear();
+    TraceSession::timeMemoryAreas.clear();
+    TraceSession::rowsStored = 0;
+    TraceSession::traceStartInstruction = 0;
+}
+
+int main(int argc, char **argv)
+{
+    SyntheticWorkload::Config config;
+    std::string outFilename = "bench.json";
+    std::string emitPrefix = "";
+
+    for (int a=1; a<argc; ++a)
+    {
+        std::string arg(argv[a]);
+        std::string value = arg.substr(arg.find('=') + 1, std::string::npos);
+        if (arg.substr(0,6) == "--out=")
+            outFilename = value;
+        else if (arg.substr(0,10) == "--regions=")
+            config.regions = std::atoi(value.c_str());
+        else if (arg.substr(0,14) == "--region_size=")
+            config.regionSize = std::strtoul(value.c_str(), nullptr, 0);
+        else if (arg.substr(0,13) == "--resolution=")
+            config.resolution = std::atoi(value.c_str());
+        else if (arg.substr(0,15) == "--instructions=")
+            config.instructions = std::strtoul(value.c_str(), nullptr, 0);
+        else if (arg.substr(0,11) == "--accesses=")
+            config.accessesPerInstruction = std::atof(value.c_str());
+        else if (arg.substr(0,8) == "--loads=")
+            config.loadFraction = std::atof(value.c_str());
+        else if (arg.substr(0,9) == "--stores=")
+            config.storeFraction = std::atof(value.c_str());
+        else if (arg.substr(0,9) == "--stride=")
+            config.stride = std::strtoul(value.c_str(), nullptr, 0);
+        else if (arg.substr(0,9) == "--random=")
+            config.randomFraction = std::atof(value.c_str());
+        else if (arg.substr(0,10) == "--outside=")
+            config.outsideFraction = std::atof(value.c_str());
+        else if (arg.substr(0,13) == "--activities=")
+            config.activities = std::atoi(value.c_str());
+        else if (arg.substr(0,14) == "--event_every=")
+            config.eventEvery = std::strtoul(value.c_str(), nullptr, 0);
+        else if (arg.substr(0,7) == "--seed=")
+            config.seed = std::strtoul(value.c_str(), nullptr, 0);
+        else if (arg.substr(0,14) == "--ins_per_row=")
+            TraceSession::instructionsPerRow = std::max(1ul, std::strtoul(value.c_str(), nullptr, 0));
+        else if (arg.substr(0,7) == "--emit=")
+            emitPrefix = value;
+        else {
+            std::cerr << "Unknown option \"" << arg << "\"\n";
+            return 1;
+        }
+    }
+
+    SyntheticWorkload workload(config);
+
+    if (emitPrefix != "") {
+        std::ofstream control(emitPrefix + ".ctl"), stream(emitPrefix + ".lackey");
+        if (!control.is_open() || !stream.is_open()) {
+            std::cerr << "Could not open \"" << emitPrefix << ".ctl\" and \"" << emitPrefix << ".lackey\"\n";
+            return 1;
+        }
+        workload.controlToStream(control);
+        std::string line;
+        while (workload.next(line))
+            stream << line << "\n";
+        std::cout << "[\033[92mVMT\033[0m] Wrote " << emitPrefix << ".lackey and " << emitPrefix << ".ctl\n";
+        return 0;
+    }
+
+    TraceSession::maxTraceRows = ~0ul;
+    std::vector<Stage> stages;
+    std::vector<std::string> lines;
+    std::vector<Access> accesses;
+
+    stages.push_back(runStage("generate", "lines", [&]() {
+        std::string line;
+        while (workload.next(line))
+            lines.push_back(line);
+        return lines.size();
+    }));
+
+    // instruction lines are kept as type 'I' so the stream can be replayed
+    stages.push_back(runStage("parse", "lines", [&]() {
+        Access access;
+        for (auto &line : lines) {
+            if (parseLackeyAccess(line, access.type, access.addr, access.size))
+                accesses.push_back(access);
+            else if (line[0] == 'I') {
+                access.type = 'I';
+                accesses.push_back(access);
+            }
+        }
+        return lines.size();
+    }));
+    lines.clear();
+    lines.shrink_to_fit();
+
+    resetSession();
+    for (auto &activity : workload.activities())
+        TraceSession::addActivity(activity);
+    TraceSession::addMemoryRegions(workload.regions());
+
+    stages.push_back(runStage("region_lookup", "accesses", [&]() {
+        unsigned long count = 0, hits = 0;
+        for (auto &access : accesses)
+            if (access.type != 'I') {
+                TraceSession::regionIndex.find(access.addr, [&](size_t r) { ++hits; });
+                ++count;
+            }
+        std::cerr << "[\033[92mVMT\033[0m] " << hits << " region hits\n";
+        return count;
+    }));
+
+    stages.push_back(runStage("accumulate", "accesses", [&]() {
+        QuietCout quiet;
+        unsigned long count = 0, instructionCount = 0;
+        for (auto &access : accesses) {
+            if (access.type == 'I') {
+                if ((++instructionCount % TraceSession::instructionsPerRow) == 0)
+                    TraceSession::storeRow();
+                continue;
+            }
+            ++count;
+            TraceSession::regionIndex.find(access.addr, [&](size_t r) {
+                MemoryRegion &region = TraceSession::memoryRegions[r];
+                if (access.type == 'L') {
+                    ++region.loadCount;
+                    region.addLoad(access.addr, access.size);
+                } else if (access.type == 'S') {
+                    ++region.storeCount;
+                    region.addStore(access.addr, access.size);
+                } else
+                    region.addMod(access.addr, access.size);
+            });
+            const std::vector<size_t> *activityIdxs = TraceSession::findActivities(access.addr);
+            if (activityIdxs != nullptr)
+                for (size_t activityIdx : *activityIdxs) {
+                    if (activityIdx == 0)
+                        continue;
+                    Activity &activity = TraceSession::activities[activityIdx];
+                    if (access.type == 'S')
+                        activity.startEvent(instructionCount);
+                    else if (access.type == 'L')
+                        activity.stopEvent(instructionCount);
+                }
+        }
+        return count;
+    }));
+    accesses.clear();
+    accesses.shrink_to_fit();
+
+    std::string traceFilename = outFilename + ".trace";
+    stages.push_back(runStage("to_stream", "bytes", [&]() {
+        QuietCout quiet;
+        std::ofstream out(traceFilename);
+        TraceSession::toStream(out);
+        return (unsigned long)out.tellp();
+    }));
+
+    resetSession();
+    stages.push_back(runStage("from_stream", "bytes", [&]() {
+        QuietCout quiet;
+        std::ifstream in(traceFilename);
+        TraceSession::fromStream(in);
+        return (unsigned long)in.tellg();
+    }));
+
+    std::string imageFilename = outFilename + ".png";
+    stages.push_back(runStage("save_trace_image", "rows", [&]() {
+        QuietCout quiet;
+        TraceImage traceSaver;
+        traceSaver.saveTraceImage(TraceSession::memoryRegions, imageFilename, "Synthetic workload", true, true);
+        return (unsigned long)TraceSession::traceRows();
+    }));
+
+    std::remove(traceFilename.c_str());
+    std::remove(imageFilename.c_str());
+
+    std::ofstream out(outFilename);
+    if (!out.is_open()) {
+        std::cerr << "Could not open \"" << outFilename << "\" to save benchmark results" << std::endl;
+        return 1;
+    }
+    out << "{\n  \"config\": {\"regions\": " << config.regions
+        << ", \"region_size\": " << config.regionSize
+        << ", \"resolution\": " << config.resolution
+        << ", \"instructions\": " << config.instructions
+        << ", \"accesses_per_instruction\": " << config.accessesPerInstruction
+        << ", \"loads\": " << config.loadFraction
+        << ", \"stores\": " << config.storeFraction
+        << ", \"stride\": " << config.stride
+        << ", \"random\": " << config.randomFraction
+        << ", \"outside\": " << config.outsideFraction
+        << ", \"activities\": " << config.activities
+        << ", \"event_every\": " << config.eventEvery
+        << ", \"seed\": " << config.seed
+        << ", \"instructions_per_row\": " << TraceSession::instructionsPerRow << "},\n"
+        << "  \"stages\": [\n";
+    for (size_t s=0; s<stages.size(); ++s) {
+        const Stage &stage = stages[s];
+        out << "    {\"stage\": \"" << stage.name << "\", \"unit\": \"" << stage.unit
+            << "\", \"items\": " << stage.items << ", \"seconds\": " << stage.seconds
+            << ", \"items_per_second\": " << (stage.seconds > 0 ? stage.items / stage.seconds : 0)
+            << ", \"peak_rss_kb\": " << stage.peakRssKb << "}" << (s + 1 < stages.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    std::cerr << "[\033[92mVMT\033[0m] Saved benchmark results to " << outFilename << "\n";
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef __BYTE_TRAFFIC_H__
+#define __BYTE_TRAFFIC_H__
+
+#include <iostream>
+
+// Bytes loaded, stored and modified over a row or an activity occurrence.
+class ByteTraffic
+{
+public:
+    ByteTraffic() : loadBytes(0), storeBytes(0), modBytes(0) {}
+
+    unsigned long total() const { return loadBytes + storeBytes + modBytes; }
+
+    void add(const ByteTraffic &b) {
+        loadBytes += b.loadBytes;
+        storeBytes += b.storeBytes;
+        modBytes += b.modBytes;
+    }
+
+    // written as three LEB128 varints, most rows of most regions are
+    // empty or small so this is far more compact than fixed width fields.
+    void toStream(std::ostream &out) const {
+        writeVarint(out, loadBytes);
+        writeVarint(out, storeBytes);
+        writeVarint(out, modBytes);
+    }
+
+    void fromStream(std::istream &in) {
+        loadBytes = readVarint(in);
+        storeBytes = readVarint(in);
+        modBytes = readVarint(in);
+    }
+
+    static void writeVarint(std::ostream &out, unsigned long value) {
+        do {
+            char byte = value & 0x7f;
+            value >>= 7;
+            if (value != 0)
+                byte |= 0x80;
+            out.put(byte);
+        } while (value != 0);
+    }
+
+    static unsigned long readVarint(std::istream &in) {
+        unsigned long value = 0;
+        int shift = 0;
+        char byte;
+        while (shift < 64 && in.get(byte)) {
+            value |= (unsigned long)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+            shift += 7;
+        }
+        return value;
+    }
+
+    unsigned long loadBytes, storeBytes, modBytes;
+};
+
+#endif  // __BYTE_TRAFFIC_H__
@@ -0,0 +1,213 @@
+#include "cache_simulator.h"
+
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+
+const char *CacheSimulator::defaultSpec = "32K/8/64/plru,1M/16/64/lru,8M/16/64/lru";
+
+static const unsigned long emptyTag = ~0ul;
+
+static unsigned int floorLog2(unsigned long v) {
+    unsigned int bits = 0;
+    while (v >>= 1)
+        ++bits;
+    return bits;
+}
+
+CacheSimulator::Level::Level(unsigned long size, unsigned int ways, unsigned int lineSize, Policy policy) {
+
+    // line size, ways and set count are rounded down to powers of two so
+    // sets are found with a mask and the PLRU tree is complete.
+    this->lineSize = 1u << floorLog2(std::max(lineSize, 1u));
+    this->ways = std::min(1u << floorLog2(std::max(ways, 1u)), 64u);
+    this->policy = policy;
+    lineBits = floorLog2(this->lineSize);
+
+    unsigned long sets = std::max(size / ((unsigned long)this->ways * this->lineSize), 1ul);
+    sets = 1ul << floorLog2(sets);
+    setMask = sets - 1;
+    this->size = sets * this->ways * this->lineSize;
+
+    tags.assign(sets * this->ways, emptyTag);
+    if (policy == PLRU)
+        plruBits.assign(sets, 0);
+    hits = 0;
+    misses = 0;
+}
+
+bool CacheSimulator::Level::access(unsigned long addr) {
+    unsigned long line = addr >> lineBits;
+    unsigned long set = line & setMask;
+    unsigned long *setTags = &tags[set * ways];
+
+    if (policy == LRU) {
+        unsigned int w = 0;
+        while (w < ways && setTags[w] != line)
+            ++w;
+        bool hit = w < ways;
+        if (!hit)
+            w = ways - 1;  // evict the least recently used
+        std::memmove(setTags + 1, setTags, w * sizeof (unsigned long));
+        setTags[0] = line;
+        hit ? ++hits : ++misses;
+        return hit;
+    }
+
+    unsigned int w = 0;
+    while (w < ways && setTags[w] != line)
+        ++w;
+    bool hit = w < ways;
+    unsigned long &bits = plruBits[set];
+    if (!hit) {
+        // follow the tree bits to the victim
+        unsigned int node = 1;
+        while (node < ways)
+            node = 2*node + ((bits >> node) & 1);
+        w = node - ways;
+        setTags[w] = line;
+    }
+
+    // point every node on the path away from this way
+    for (unsigned int node = w + ways; node > 1; node >>= 1) {
+        unsigned int parent = node >> 1;
+        if (node & 1)
+            bits &= ~(1ul << parent);
+        else
+            bits |= 1ul << parent;
+    }
+
+    hit ? ++hits : ++misses;
+    return hit;
+}
+
+std::string CacheSimulator::Level::describe() const {
+    std::ostringstream text;
+    if (size >= (1ul << 20) && size % (1ul << 20) == 0)
+        text << (size >> 20) << "M";
+    else if (size >= 1024 && size % 1024 == 0)
+        text << (size >> 10) << "K";
+    else
+        text << size;
+    text << "/" << ways << "/" << lineSize << "/" << (policy == PLRU ? "plru" : "lru");
+    return text.str();
+}
+
+static bool parseSize(const std::string &text, unsigned long &size) {
+    char *end;
+    size = std::strtoul(text.c_str(), &end, 10);
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k")
+        size <<= 10;
+    else if (suffix == "M" || suffix == "m")
+        size <<= 20;
+    else if (suffix == "G" || suffix == "g")
+        size <<= 30;
+    else if (!suffix.empty())
+        return false;
+    return end != text.c_str() && size > 0;
+}
+
+bool CacheSimulator::configure(const std::string &spec) {
+
+    std::vector<Level> parsed;
+    std::stringstream specStream(spec);
+    std::string levelSpec;
+    while (std::getline(specStream, levelSpec, ',')) {
+        std::vector<std::string> fields;
+        std::stringstream levelStream(levelSpec);
+        std::string field;
+        while (std::getline(levelStream, field, '/'))
+            fields.push_back(field);
+
+        unsigned long size, ways, lineSize;
+        Policy policy = LRU;
+        if (fields.size() < 3 || fields.size() > 4 ||
+            !parseSize(fields[0], size) || !parseSize(fields[1], ways) || !parseSize(fields[2], lineSize))
+            return false;
+        if (fields.size() == 4) {
+            if (fields[3] == "plru")
+                policy = PLRU;
+            else if (fields[3] != "lru")
+                return false;
+        }
+        parsed.push_back(Level(size, ways, lineSize, policy));
+    }
+
+    if (parsed.empty() || parsed.size() > maxLevels)
+        return false;
+
+    // accesses are split into lines of the first level, so a level with
+    // smaller lines would only ever see the first of them.
+    for (size_t l=1; l<parsed.size(); ++l)
+        if (parsed[l].lineSize < parsed[l-1].lineSize)
+            return false;
+    levels = parsed;
+    return true;
+}
+
+int CacheSimulator::access(unsigned long addr, unsigned int size) {
+
+    unsigned int lineSize = levels[0].lineSize;
+    unsigned long first = addr & ~(unsigned long)(lineSize - 1);
+    unsigned long last = (addr + std::max(size, 1u) - 1) & ~(unsigned long)(lineSize - 1);
+
+    int worst = 0;
+    for (unsigned long line=first; line<=last; line+=lineSize) {
+        int missed = 0;
+        while (missed < (int)levels.size() && !levels[missed].access(line))
+            ++missed;
+        worst = std::max(worst, missed);
+    }
+    return worst;
+}
+
+void CacheSimulator::report(std::ostream &out) const {
+    for (size_t l=0; l<levels.size(); ++l) {
+        const Level &level = levels[l];
+        unsigned long total = level.hits + level.misses;
+        out << "[\033[92mVMT\033[0m] L" << (l+1) << " " << level.describe()
+            << " : " << level.misses << " misses of " << total << " accesses";
+        if (total > 0)
+            out << " (" << (100.0 * level.misses / total) << "%)";
+        out << "\n";
+    }
+}
+
+void CacheSimulator::toStream(std::ostream &out) const {
+    unsigned int count = levels.size();
+    out.write((char*)&count, sizeof (count));
+    for (auto &level : levels) {
+        out.write((char*)&level.size, sizeof (level.size));
+        out.write((char*)&level.ways, sizeof (level.ways));
+        out.write((char*)&level.lineSize, sizeof (level.lineSize));
+        out.write((char*)&level.policy, sizeof (level.policy));
+        out.write((char*)&level.hits, sizeof (level.hits));
+        out.write((char*)&level.misses, sizeof (level.misses));
+    }
+}
+
+void CacheSimulator::fromStream(std::istream &in) {
+    unsigned int count = 0;
+    in.read((char*)&count, sizeof (count));
+    levels.clear();
+    for (unsigned int l=0; l<count && in; ++l) {
+        unsigned long size;
+        unsigned int ways, lineSize;
+        Policy policy;
+        in.read((char*)&size, sizeof (size));
+        in.read((char*)&ways, sizeof (ways));
+        in.read((char*)&lineSize, sizeof (lineSize));
+        in.read((char*)&policy, sizeof (policy));
+
+        // only the configuration and totals are kept, not the cache contents
+        Level level(0, 1, lineSize, LRU);
+        level.size = size;
+        level.ways = ways;
+        level.policy = policy;
+        in.read((char*)&level.hits, sizeof (level.hits));
+        in.read((char*)&level.misses, sizeof (level.misses));
+        if (l < maxLevels)
+            levels.push_back(level);
+    }
+}
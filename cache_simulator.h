@@ -0,0 +1,73 @@
+#ifndef __CACHE_SIMULATOR_H__
+#define __CACHE_SIMULATOR_H__
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "memory_region.h"
+
+/*
+    Set-associative cache model fed by the recorded access stream.
+
+    Each level holds the line addresses of a set packed next to each other in
+    a single array, so a lookup touches one contiguous run of memory. Sets
+    using true LRU keep their ways in most to least recently used order and
+    move a line to the front on a hit, sets using tree pseudo LRU leave the
+    ways in place and keep one word of tree bits per set, which point away
+    from the most recently used half at every level of the tree.
+
+    Levels are non-inclusive, a line missing in one level is looked up in the
+    next and filled into every level it missed in.
+*/
+class CacheSimulator
+{
+public:
+    static const int maxLevels = MemoryRegion::maxCacheLevels;
+
+    enum Policy : char { LRU, PLRU };
+
+    class Level {
+    public:
+        Level(unsigned long size, unsigned int ways, unsigned int lineSize, Policy policy);
+
+        // looks up the line containing addr, filling it on a miss
+        bool access(unsigned long addr);
+
+        std::string describe() const;
+
+        unsigned long size;
+        unsigned int ways, lineSize;
+        Policy policy;
+
+        unsigned long hits, misses;
+
+    private:
+        unsigned int lineBits;
+        unsigned long setMask;
+        std::vector<unsigned long> tags;
+        std::vector<unsigned long> plruBits;
+    };
+
+    // Reads a comma separated list of levels, each size/ways/line size/policy
+    // e.g. "32K/8/64/plru,1M/16/64/lru". Sizes take a K, M or G suffix, and
+    // line sizes may not shrink down the hierarchy.
+    bool configure(const std::string &spec);
+
+    bool enabled() const { return !levels.empty(); }
+
+    // returns the number of levels missed in, 0 for an L1 hit, by the line
+    // of the access going furthest down the hierarchy.
+    int access(unsigned long addr, unsigned int size);
+
+    void report(std::ostream &out) const;
+
+    void toStream(std::ostream &out) const;
+    void fromStream(std::istream &in);
+
+    std::vector<Level> levels;
+
+    static const char *defaultSpec;
+};
+
+#endif  // __CACHE_SIMULATOR_H__
@@ -0,0 +1,76 @@
+#include "chrome_trace.h"
+
+#include <iostream>
+#include <cstdio>
+
+static const unsigned int processId = 1;
+
+bool ChromeTraceWriter::open(const std::string &filename, const std::string &processName) {
+    out.open(filename);
+    if (!out.is_open()) {
+        std::cerr << "Could not open \"" << filename << "\" to save the chrome trace" << std::endl;
+        return false;
+    }
+    events = 0;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    beginEvent();
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << processId
+        << ",\"args\":{\"name\":\"" << escape(processName) << "\"}}";
+    return true;
+}
+
+void ChromeTraceWriter::close() {
+    if (!out.is_open())
+        return;
+    out << "\n]}\n";
+    out.close();
+}
+
+void ChromeTraceWriter::beginEvent() {
+    if (events++ > 0)
+        out << ",\n";
+}
+
+void ChromeTraceWriter::threadName(unsigned int tid, const std::string &name) {
+    beginEvent();
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << processId << ",\"tid\":" << tid
+        << ",\"args\":{\"name\":\"" << escape(name) << "\"}}";
+}
+
+void ChromeTraceWriter::slice(unsigned int tid, const std::string &name, unsigned long start, unsigned long duration,
+                              size_t occurrence, const ByteTraffic &traffic) {
+    beginEvent();
+    out << "{\"name\":\"" << escape(name) << "\",\"ph\":\"X\",\"pid\":" << processId << ",\"tid\":" << tid
+        << ",\"ts\":" << start << ",\"dur\":" << duration
+        << ",\"args\":{\"occurrence\":" << occurrence
+        << ",\"load_bytes\":" << traffic.loadBytes
+        << ",\"store_bytes\":" << traffic.storeBytes
+        << ",\"modify_bytes\":" << traffic.modBytes << "}}";
+}
+
+void ChromeTraceWriter::counter(const std::string &name, unsigned long time, const ByteTraffic &traffic) {
+    beginEvent();
+    out << "{\"name\":\"" << escape(name) << "\",\"ph\":\"C\",\"pid\":" << processId
+        << ",\"ts\":" << time
+        << ",\"args\":{\"load\":" << traffic.loadBytes
+        << ",\"store\":" << traffic.storeBytes
+        << ",\"modify\":" << traffic.modBytes << "}}";
+}
+
+std::string ChromeTraceWriter::escape(const std::string &text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof (code), "\\u%04x", (unsigned char)c);
+            escaped += code;
+        }
+        else
+            escaped += c;
+    }
+    return escaped;
+}
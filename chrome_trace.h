@@ -0,0 +1,45 @@
+#ifndef __CHROME_TRACE_H__
+#define __CHROME_TRACE_H__
+
+#include <string>
+#include <fstream>
+
+#include "byte_traffic.h"
+
+/*
+    Streaming writer of the Chrome Trace Event JSON format, as loaded by
+    Perfetto and chrome://tracing.
+
+    Each event is written out as soon as it is added and nothing is kept,
+    so traces with millions of occurrences are written in constant memory.
+    Timestamps are instruction counts, shown by the viewers as microseconds.
+*/
+class ChromeTraceWriter
+{
+public:
+    ChromeTraceWriter() : events(0) {}
+    ~ChromeTraceWriter() { close(); }
+
+    bool open(const std::string &filename, const std::string &processName);
+    void close();
+
+    // names the track of thread tid
+    void threadName(unsigned int tid, const std::string &name);
+
+    // complete event from start for duration instructions on track tid
+    void slice(unsigned int tid, const std::string &name, unsigned long start, unsigned long duration,
+               size_t occurrence, const ByteTraffic &traffic);
+
+    // load, store and modify bytes of the counter track name from time on
+    void counter(const std::string &name, unsigned long time, const ByteTraffic &traffic);
+
+    unsigned long events;
+
+private:
+    void beginEvent();
+    static std::string escape(const std::string &text);
+
+    std::ofstream out;
+};
+
+#endif  // __CHROME_TRACE_H__
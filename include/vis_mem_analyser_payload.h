@@ -3,10 +3,72 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "vis_mem_protocol.h"
+
+/*
+    Define VMT_DISABLE_TRACING when building a model for production to
+    replace the Tracer and its Events with empty inline versions, removing
+    all instrumentation without changing the model source.
+*/
 
 namespace VisMemoryTrace {
 
+    // description of a memory region for batch registration
+    class Region {
+    public:
+        Region(std::string name,
+               void *addr,
+               unsigned long sizeBytes,
+               unsigned long resolution = 1500) {
+            this->name = name;
+            this->addr = addr;
+            this->sizeBytes = sizeBytes;
+            this->resolution = resolution;
+        }
+
+        std::string name;
+        void *addr;
+        unsigned long sizeBytes;
+        unsigned long resolution;
+    };
+
+    // description of a time-memory area for batch registration
+    class Area {
+    public:
+        Area(unsigned long startAddr, unsigned long endAddr,
+             unsigned long startEventAddr, unsigned long endEventAddr,
+             unsigned int startOccurrence = 0, unsigned int endOccurrence = 0) {
+            this->startAddr = startAddr;
+            this->endAddr = endAddr;
+            this->startEventAddr = startEventAddr;
+            this->endEventAddr = endEventAddr;
+            this->startOccurrence = startOccurrence;
+            this->endOccurrence = endOccurrence;
+        }
+
+        unsigned long startAddr, endAddr;
+        unsigned long startEventAddr, endEventAddr;
+        unsigned int startOccurrence, endOccurrence;
+    };
+
+#ifndef VMT_DISABLE_TRACING
+
+    /*
+        Event markers are a single volatile store to the event flag to start
+        and a single volatile load of it to stop, the analyser recognises
+        these by address so they add no other instructions or memory accesses
+        to the trace.
+    */
     class Event {
     public:
         Event() {
@@ -15,27 +77,26 @@ namespace VisMemoryTrace {
         }
 
         Event(std::string name,
-              int *addr,
-              std::ofstream *nullFile) {
+              int *addr) {
             this->name = name;
             this->address = addr;
-            this->nullFile = nullFile;
         }
 
         void start()  {
             if (address != nullptr)
-                *(address) = rand();
+                *address = 1;
         }
 
         void stop() {
-            if (address != nullptr)
-                *(nullFile) << *(address) << std::endl;
+            if (address != nullptr) {
+                int flag = *address;
+                (void)flag;
+            }
         }
 
     private:
         std::string name;
         volatile int *address;
-        std::ofstream *nullFile;
     };
 
 
@@ -59,15 +120,12 @@ namespace VisMemoryTrace {
                 std::cerr << "] (" << writeErr.what() << ")" << std::endl;
             }
 
-            try{
-                nullFile.open("/dev/null");
-            }
-            catch (std::ofstream::failure &writeErr) {
-                std::cerr << "[\033[93mVMT Payload:\033[0m] Failed to open /dev/null. Not on linux?" << std::endl;
-            }
-
             std::cout << "[\033[93mVMT Payload:\033[0m] Opened region fifo [" << fifoName << "]\n";
 
+            binary = fifo.is_open() && handshake(fifoName);
+            if (binary)
+                std::cout << "[\033[93mVMT Payload:\033[0m] Using binary protocol version " << Protocol::version << "\n";
+
             this->eventLimit = eventLimit;
             eventSpace = new int[eventLimit];
             eventsUsed = 0;
@@ -91,8 +149,13 @@ namespace VisMemoryTrace {
                 std::cerr << "[\033[93mVMT Payload:\033[0m] Error: Cannot ";
                 std::cerr << "set title \"" << title << "\", fifo not open.";
                 std::cerr << std::endl;
+            } else if (binary) {
+                Protocol::FrameWriter frame(Protocol::Title);
+                frame.putString(title);
+                writeFrame(frame);
             } else {
                 fifo << "\"" << title << "\"\n";
+                fifo.flush();
             }
         }
 
@@ -100,91 +163,288 @@ namespace VisMemoryTrace {
                        void *addr,
                        unsigned long sizeBytes,
                        unsigned long resolution = 1500) {
+            addRegions(std::vector<Region>(1, Region(name, addr, sizeBytes, resolution)));
+        }
+
+        // registers all the given regions with a single message
+        void addRegions(const std::vector<Region> &regions) {
             if (!fifo.is_open()) {
                 std::cerr << "[\033[93mVMT Payload:\033[0m] Error: Cannot add ";
-                std::cerr << "memory region \"" << name << "\", fifo not open.";
+                std::cerr << regions.size() << " memory regions, fifo not open.";
                 std::cerr << std::endl;
+            } else if (binary) {
+                Protocol::FrameWriter frame(Protocol::Regions);
+                frame.put((uint32_t)regions.size());
+                for (auto &region : regions) {
+                    uint64_t start = (unsigned long)region.addr;
+                    frame.put(start);
+                    frame.put((uint64_t)(start + region.sizeBytes));
+                    frame.put((uint32_t)region.resolution);
+                    frame.putString(region.name);
+                }
+                writeFrame(frame, true);
             } else {
-                unsigned long start = (unsigned long)addr;
-                unsigned long end = start + sizeBytes;
-                fifo << ":" << name << "(" << start << "," << end;
-                fifo << "," << resolution << "\n";
+                for (auto &region : regions) {
+                    unsigned long start = (unsigned long)region.addr;
+                    unsigned long end = start + region.sizeBytes;
+                    fifo << ":" << region.name << "(" << start << "," << end;
+                    fifo << "," << region.resolution << "\n";
+                }
+                fifo.flush();
+            }
+        }
+
+        // Retires the regions starting at addr, call this when the buffer is
+        // freed. The region keeps the rows captured so far but is no longer
+        // recorded, so the address range can be registered again.
+        void removeRegion(void *addr) {
+            removeRegions(std::vector<void*>(1, addr));
+        }
+
+        void removeRegions(const std::vector<void*> &addrs) {
+            if (!fifo.is_open()) {
+                std::cerr << "[\033[93mVMT Payload:\033[0m] Error: Cannot remove ";
+                std::cerr << addrs.size() << " memory regions, fifo not open.";
+                std::cerr << std::endl;
+            } else if (binary) {
+                Protocol::FrameWriter frame(Protocol::RetireRegions);
+                frame.put((uint32_t)addrs.size());
+                for (auto addr : addrs)
+                    frame.put((uint64_t)(unsigned long)addr);
+                writeFrame(frame, true);
+            } else {
+                for (auto addr : addrs)
+                    fifo << "-" << (unsigned long)addr << "\n";
                 fifo.flush();
             }
         }
 
         Event addEvent(std::string name,
                         volatile int **eventAddr = nullptr) {
+            std::vector<volatile int*> addrs;
+            std::vector<Event> events = addEvents(std::vector<std::string>(1, name), &addrs);
+            if (eventAddr && addrs[0] != nullptr)
+                *eventAddr = addrs[0];
+            return events[0];
+        }
+
+        // registers an event flag for each name with a single message, the
+        // flag addresses are returned in eventAddrs if given.
+        std::vector<Event> addEvents(const std::vector<std::string> &names,
+                                     std::vector<volatile int*> *eventAddrs = nullptr) {
+            std::vector<Event> events;
+            if (eventAddrs)
+                eventAddrs->assign(names.size(), nullptr);
+
             if (!fifo.is_open()) {
-                std::cerr << "[\033[93mVMT Payload:\033[0m] Error: Cannot add event flag \"" << name << "\", fifo not open.";
+                std::cerr << "[\033[93mVMT Payload:\033[0m] Error: Cannot add " << names.size() << " event flags, fifo not open.";
                 std::cerr << std::endl;
-            } else {
+                events.assign(names.size(), Event("Error, not Created!", eventSpace));
+                return events;
+            }
+
+            Protocol::FrameWriter frame(Protocol::Events);
+            frame.put((uint32_t)std::min(names.size(), (size_t)(eventLimit - eventsUsed)));
+            for (size_t e=0; e<names.size(); ++e) {
                 if (eventsUsed == eventLimit) {
-                    std::cerr << "[\033[93mVMT Payload:\033[0m] Error: Cannot add event flag \"" << name << "\", event Space full.";
+                    std::cerr << "[\033[93mVMT Payload:\033[0m] Error: Cannot add event flag \"" << names[e] << "\", event Space full.";
                     std::cerr << std::endl;
-                } else {
-                    int *addr = &eventSpace[eventsUsed++];
-                    if (eventAddr)
-                        *eventAddr = addr;
+                    events.push_back(Event("Error, not Created!", eventSpace));
+                    continue;
+                }
 
-                    fifo << "#" << name << "(" << (unsigned long)(addr) << "\n";
-                    fifo.flush();
+                int *addr = &eventSpace[eventsUsed++];
+                if (eventAddrs)
+                    (*eventAddrs)[e] = addr;
 
-                    return Event(name, addr, &nullFile);
-                }
+                if (binary) {
+                    frame.put((uint64_t)(unsigned long)addr);
+                    frame.putString(names[e]);
+                } else
+                    fifo << "#" << names[e] << "(" << (unsigned long)(addr) << "\n";
+
+                events.push_back(Event(names[e], addr));
             }
-            return Event("Error, not Created!", eventSpace, &nullFile);
+
+            if (binary)
+                writeFrame(frame, true);
+            else
+                fifo.flush();
+            return events;
         }
 
+        // the area spans from the start of the given occurrence of the start
+        // event to the end of the given occurrence of the end event.
         void addArea(unsigned long startAddr, unsigned long endAddr,
-                     unsigned long startEventAddr, unsigned long endEventAddr) {
+                     unsigned long startEventAddr, unsigned long endEventAddr,
+                     unsigned int startOccurrence = 0, unsigned int endOccurrence = 0) {
+            addAreas(std::vector<Area>(1, Area(startAddr, endAddr,
+                                               startEventAddr, endEventAddr,
+                                               startOccurrence, endOccurrence)));
+        }
+
+        // registers all the given areas with a single message
+        void addAreas(const std::vector<Area> &areas) {
             if (!fifo.is_open()) {
                 std::cerr << "[\033[93mVMT Payload:\033[0m] Error:";
-                std::cerr << " Cannot add Area, fifo not open.";
+                std::cerr << " Cannot add " << areas.size() << " Areas, fifo not open.";
                 std::cerr << std::endl;
+            } else if (binary) {
+                Protocol::FrameWriter frame(Protocol::Areas);
+                frame.put((uint32_t)areas.size());
+                for (auto &area : areas) {
+                    frame.put((uint64_t)area.startAddr);
+                    frame.put((uint64_t)area.endAddr);
+                    frame.put((uint64_t)area.startEventAddr);
+                    frame.put((uint64_t)area.endEventAddr);
+                    frame.put((uint32_t)area.startOccurrence);
+                    frame.put((uint32_t)area.endOccurrence);
+                }
+                writeFrame(frame, true);
             } else {
-                fifo << "&" << startAddr << "," << endAddr;
-                fifo << "," << startEventAddr << "," << endEventAddr << "\n";
+                for (auto &area : areas) {
+                    fifo << "&" << area.startAddr << "," << area.endAddr;
+                    fifo << "," << area.startEventAddr << "," << area.endEventAddr;
+                    fifo << "," << area.startOccurrence << "," << area.endOccurrence << "\n";
+                }
                 fifo.flush();
             }
         }
 
-        //void waitReady();
+        // Blocks the analyser's view of the instrumented code until it has
+        // handled every message sent before this call. The batch calls do
+        // this themselves, it is a single store in the trace.
+        void sync() {
+            if (!binary)
+                return;
+            Protocol::FrameWriter frame(Protocol::Sync);
+            writeFrame(frame);
+            syncFlag = 1;
+        }
 
         std::fstream fifo;
     private:
-        std::ofstream nullFile;
+        // Offers the binary protocol to the analyser, returns true if it was
+        // accepted. Analysers which don't reply within the timeout, or don't
+        // understand the offer, are spoken to with the text protocol, the
+        // analyser only switching once the acceptance is confirmed.
+        bool handshake(const std::string &fifoName, int timeoutMs = 2000) {
+            std::string replyName = fifoName + Protocol::replySuffix;
+            mkfifo(replyName.c_str(), 0666);
+            int reply = ::open(replyName.c_str(), O_RDONLY | O_NONBLOCK);
+            if (reply < 0)
+                return false;
+
+            fifo << "@hello " << Protocol::version << " " << (unsigned long)&syncFlag << "\n";
+            fifo.flush();
+
+            std::string line;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+            while (line.find('\n') == std::string::npos) {
+                int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                    deadline - std::chrono::steady_clock::now()).count();
+                pollfd pfd = { reply, POLLIN, 0 };
+                if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0)
+                    break;
+                char buffer[64];
+                ssize_t n = ::read(reply, buffer, sizeof (buffer));
+                if (n <= 0)
+                    break;
+                line.append(buffer, n);
+            }
+            ::close(reply);
+
+            std::stringstream replyStream(line);
+            std::string word;
+            unsigned int version = 0;
+            replyStream >> word >> version;
+            if (word != "@binary" || version != Protocol::version)
+                return false;
+
+            // the last text line, frames follow
+            fifo << "@binary " << Protocol::version << "\n";
+            fifo.flush();
+            return true;
+        }
+
+        void writeFrame(Protocol::FrameWriter &frame, bool synchronise = false) {
+            const std::string &data = frame.finish();
+            fifo.write(data.data(), data.size());
+            fifo.flush();
+            if (synchronise)
+                sync();
+        }
+
+        bool binary;
+        volatile int syncFlag;
         int *eventSpace;
         int eventLimit;
         int eventsUsed;
         Event recordingEvent;
     };
-};
 
-/*void VisMemoryTrace::Tracer::waitReady() {
-    fifo.clear();
-    std::cout << "fifo EOF is " << (fifo.eof() ? "true" : "false") << std::endl;
-    fifo << "@ready?\n";
-    bool ready = false;
-    while (!ready) {
-        std::string line;
+#else
 
-        std::cout << "Pre getline.\n";
+    class Event {
+    public:
+        Event() {}
+        void start() {}
+        void stop() {}
+    };
 
-        std::cout << "fifo EOF is " << (fifo.eof() ? "true" : "false") << std::endl;
+    // names are taken by template so no strings are built at the call site
+    class Tracer {
+    public:
+        Tracer(int argc,
+               char **argv,
+               int eventLimit = 100) {}
+
+        Event getRecordingEvent() { return Event(); }
 
-        std::getline(fifo, line);
+        template <class String>
+        void setTitle(const String &title) {}
 
-        std::cout << "wait loop.\n";
+        template <class String>
+        void addRegion(const String &name,
+                       void *addr,
+                       unsigned long sizeBytes,
+                       unsigned long resolution = 1500) {}
+
+        template <class String>
+        Event addEvent(const String &name,
+                       volatile int **eventAddr = nullptr) {
+            if (eventAddr)
+                *eventAddr = &unusedFlag;
+            return Event();
+        }
+
+        void addArea(unsigned long startAddr, unsigned long endAddr,
+                     unsigned long startEventAddr, unsigned long endEventAddr,
+                     unsigned int startOccurrence = 0, unsigned int endOccurrence = 0) {}
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        void addRegions(const std::vector<Region> &regions) {}
 
-        if (line.length() > 0) {
-            std::cout << "Waiting recieved [" << line << "]\n";
+        void removeRegion(void *addr) {}
+
+        void removeRegions(const std::vector<void*> &addrs) {}
+
+        std::vector<Event> addEvents(const std::vector<std::string> &names,
+                                     std::vector<volatile int*> *eventAddrs = nullptr) {
+            if (eventAddrs)
+                eventAddrs->assign(names.size(), &unusedFlag);
+            return std::vector<Event>(names.size());
         }
 
-        ready = (line.substr(0,11) == "@yes_ready.");
-    }
-}*/
+        void addAreas(const std::vector<Area> &areas) {}
+
+        void sync() {}
+
+    private:
+        int unusedFlag;
+    };
+
+#endif  // VMT_DISABLE_TRACING
+
+};
 
-#endif  // __VIS_MEM_ANALYSER_PAYLOAD_H__
\ No newline at end of file
+#endif  // __VIS_MEM_ANALYSER_PAYLOAD_H__
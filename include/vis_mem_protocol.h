@@ -0,0 +1,121 @@
+#ifndef __VIS_MEM_PROTOCOL_H__
+#define __VIS_MEM_PROTOCOL_H__
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+/*
+    Binary control protocol shared by the payload Tracer and the analyser.
+
+    The payload starts every session in the original text protocol and sends
+    "@hello <version> <sync flag address>" on the region fifo. An analyser
+    supporting the binary protocol answers "@binary <version>" on the reply
+    fifo (the region fifo name with "_reply" appended). A payload which sees
+    the answer before its timeout confirms it with its own "@binary <version>"
+    line on the region fifo, after which everything it writes to the region
+    fifo is a sequence of frames:
+
+        [uint8 type][uint32 payload length][payload]
+
+    Multi-byte fields are native endian since both ends run on the same
+    machine. Strings are a uint16 length followed by the characters. The
+    batch messages hold a uint32 count followed by that many records so
+    thousands of regions can be registered with a single write.
+
+    The analyser only switches to frames at the payload's confirmation, so a
+    reply arriving after the payload gave up waiting leaves both ends on the
+    text protocol. The sync flag is registered before the analyser replies
+    to the hello, so it is known before the payload can ever store to it.
+    After each Sync message the payload stores to the flag, and the analyser
+    holds back the access stream at that store until the message has been
+    handled. Version 1 payloads sent frames straight after the reply, so
+    they are answered with "@text".
+*/
+namespace VisMemoryTrace {
+namespace Protocol {
+
+    static const uint32_t version = 2;
+
+    static const char *replySuffix = "_reply";
+
+    enum MessageType : uint8_t {
+        Title = 1,          // string title
+        Regions = 2,        // count x { u64 start, u64 end, u32 resolution, string name }
+        Events = 3,         // count x { u64 flag address, string name }
+        Areas = 4,          // count x { u64 start, u64 end, u64 start event, u64 end event,
+                            //           u32 start occurrence, u32 end occurrence }
+        Sync = 5,           // empty, followed by a store to the sync flag
+        RetireRegions = 6   // count x { u64 start address of the regions to retire }
+    };
+
+    static const size_t frameHeaderSize = sizeof (uint8_t) + sizeof (uint32_t);
+
+    // Builds a single frame in memory so it can be written in one go.
+    class FrameWriter {
+    public:
+        FrameWriter(MessageType type) {
+            frame.push_back((char)type);
+            frame.append(sizeof (uint32_t), '\0');
+        }
+
+        template <class T>
+        void put(T value) {
+            frame.append((const char*)&value, sizeof (T));
+        }
+
+        void putString(const std::string &text) {
+            uint16_t length = text.size() > 0xffff ? 0xffff : (uint16_t)text.size();
+            put(length);
+            frame.append(text.data(), length);
+        }
+
+        // fills in the payload length and returns the complete frame
+        const std::string &finish() {
+            uint32_t length = frame.size() - frameHeaderSize;
+            std::memcpy(&frame[1], &length, sizeof (uint32_t));
+            return frame;
+        }
+
+    private:
+        std::string frame;
+    };
+
+    // Reads the fields of a received frame payload, once a read runs past
+    // the end of the payload all further reads fail.
+    class FrameReader {
+    public:
+        FrameReader(const char *data, size_t length) : data(data), length(length), pos(0) {}
+
+        template <class T>
+        bool get(T &value) {
+            if (pos + sizeof (T) > length)
+                return fail();
+            std::memcpy(&value, data + pos, sizeof (T));
+            pos += sizeof (T);
+            return true;
+        }
+
+        bool getString(std::string &text) {
+            uint16_t size;
+            if (!get(size) || pos + size > length)
+                return fail();
+            text.assign(data + pos, size);
+            pos += size;
+            return true;
+        }
+
+    private:
+        bool fail() {
+            pos = length;
+            return false;
+        }
+
+        const char *data;
+        size_t length;
+        size_t pos;
+    };
+};
+};
+
+#endif  // __VIS_MEM_PROTOCOL_H__
@@ -0,0 +1,40 @@
+#ifndef __LACKEY_LINE_H__
+#define __LACKEY_LINE_H__
+
+#include <string>
+#include <sstream>
+
+/*
+    Parses a data access line of Valgrind Lackey output, " L 0400d7d4,8",
+    into its type ('L', 'S' or 'M'), address and size. Returns false for
+    instruction lines and anything else.
+*/
+inline bool parseLackeyAccess(const std::string &line, char &type, unsigned long &addr, unsigned int &size) {
+    if (line.length() < 4)
+        return false;
+    type = line[1];
+    if (type != 'L' && type != 'S' && type != 'M')
+        return false;
+
+    std::stringstream lineStream(line.substr(3, std::string::npos));
+
+    std::string hexStr;
+    std::getline(lineStream, hexStr, ',');
+    addr = std::stol(hexStr, nullptr, 16);
+
+    lineStream >> size;
+    return true;
+}
+
+/*
+    True for lines which could be an event or sync marker of the payload, a
+    load or store of a 4 byte int, checked without parsing the address so
+    skipped stretches of the trace can be scanned quickly.
+*/
+inline bool lackeyMarkerCandidate(const std::string &line) {
+    size_t length = line.length();
+    return length > 4 && (line[1] == 'S' || line[1] == 'L') &&
+           line[length-2] == ',' && line[length-1] == '4';
+}
+
+#endif  // __LACKEY_LINE_H__
@@ -0,0 +1,164 @@
+#include "live_preview.h"
+
+#include <iostream>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+LivePreview::LivePreview(std::string filePrefix, int intervalMs, int maxRowsPerUpdate, int maxPendingRows) {
+    this->filePrefix = filePrefix;
+    this->intervalMs = intervalMs;
+    this->maxRowsPerUpdate = maxRowsPerUpdate;
+    this->maxPendingRows = maxPendingRows;
+    stopRequested = false;
+}
+
+LivePreview::~LivePreview() {
+    stop();
+    for (auto preview : previews)
+        delete preview;
+}
+
+void LivePreview::start() {
+    stopRequested = false;
+    TraceSession::publishRows = true;
+    thread = std::thread(&LivePreview::run, this);
+    std::cout << "[\033[92mVMT\033[0m] Writing live previews every " << intervalMs << " ms.\n";
+}
+
+void LivePreview::stop() {
+    if (!thread.joinable())
+        return;
+
+    stopMutex.lock();
+    stopRequested = true;
+    stopMutex.unlock();
+    stopSignal.notify_all();
+    thread.join();
+    TraceSession::publishRows = false;
+}
+
+void LivePreview::run() {
+    bool finished = false;
+    while (!finished) {
+        {
+            std::unique_lock<std::mutex> lock(stopMutex);
+            stopSignal.wait_for(lock, std::chrono::milliseconds(intervalMs),
+                                [this]{ return stopRequested; });
+            finished = stopRequested;
+        }
+        update(finished);
+    }
+}
+
+void LivePreview::writeHeader(RegionPreview &preview) {
+    // the height is right aligned in a fixed width field so the header
+    // never changes length as rows are appended.
+    char header[64];
+    int length = std::snprintf(header, sizeof (header), "P6\n%u %12lu\n255\n",
+                               preview.width, (unsigned long)preview.rowsWritten);
+    preview.file.seekp(0);
+    preview.file.write(header, length);
+    preview.file.seekp(0, std::ios::end);
+}
+
+void LivePreview::openPreview(RegionPreview &preview, unsigned int rowCoarsenings) {
+    preview.rowsWritten = 0;
+    preview.rowCoarsenings = rowCoarsenings;
+    if (preview.file.is_open())
+        preview.file.close();
+    preview.file.open(preview.filename, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!preview.file.is_open())
+        std::cerr << "[\033[92mVMT\033[0m] Error: Could not open preview \"" << preview.filename << "\"\n";
+    else
+        writeHeader(preview);
+}
+
+bool LivePreview::update(bool drain) {
+
+    // Rows are only queued for regions which already exist, so taking the
+    // rows before counting the regions leaves a preview for every row.
+    TraceSession::takeSealedRows(sealedRows);
+
+    // name the previews of any new regions, the only time the region mutex is taken
+    size_t opened = previews.size();
+    TraceSession::memRegionsMutex.lock();
+    size_t regionCount = TraceSession::memoryRegions.size();
+    unsigned int rowCoarsenings = TraceSession::rowCoarsenings;
+    while (previews.size() < regionCount) {
+        const MemoryRegion &region = TraceSession::memoryRegions[previews.size()];
+        std::string name = region.name;
+        for (auto &c : name)
+            if (!isalnum(c) && c != '-' && c != '_')
+                c = '_';
+        previews.push_back(new RegionPreview());
+        previews.back()->filename = filePrefix + name + ".ppm";
+        previews.back()->width = region.resolution;
+        previews.back()->rowCoarsenings = rowCoarsenings;
+        previews.back()->rowsDropped = 0;
+    }
+    TraceSession::memRegionsMutex.unlock();
+
+    for (size_t r=opened; r<regionCount; ++r)
+        openPreview(*previews[r], previews[r]->rowCoarsenings);
+
+    // rows queued before a coarsening are dropped, the coarsened rows follow them
+    for (auto &row : sealedRows) {
+        RegionPreview &preview = *previews[row.region];
+        if (row.rowCoarsenings < preview.rowCoarsenings)
+            continue;
+        if (row.rowCoarsenings > preview.rowCoarsenings) {
+            preview.pending.clear();
+            openPreview(preview, row.rowCoarsenings);
+        }
+        preview.pending.push_back(std::move(row.readings));
+        if (preview.pending.size() > (size_t)std::max(maxPendingRows, 1)) {
+            preview.pending.pop_front();
+            if (preview.rowsDropped++ == 0)
+                std::cerr << "[\033[92mVMT\033[0m] Warning: Preview \"" << preview.filename
+                          << "\" is falling behind, dropping its oldest rows.\n";
+        }
+    }
+    sealedRows.clear();
+
+    bool wrote = false;
+    for (size_t r=0; r<regionCount; ++r) {
+        RegionPreview &preview = *previews[r];
+        if (!preview.file.is_open()) {
+            preview.pending.clear();
+            continue;
+        }
+
+        size_t count = preview.pending.size();
+        if (!drain && count > (size_t)maxRowsPerUpdate)
+            count = maxRowsPerUpdate;
+        if (count == 0)
+            continue;
+
+        pixels.resize(preview.width * 3);
+        for (size_t i=0; i<count; ++i) {
+            const std::vector<MemoryRegion::MemoryReading> &row = preview.pending.front();
+            for (unsigned int a=0; a<preview.width; ++a) {
+                const MemoryRegion::MemoryReading &reading = row[a];
+                unsigned char *p = &pixels[a*3];
+                if (reading.loadCount > 0 && reading.storeCount > 0) {
+                    p[0] = 0; p[1] = 255; p[2] = 0;
+                } else if (reading.loadCount > 0) {
+                    p[0] = 0; p[1] = 0; p[2] = 255;
+                } else if (reading.storeCount > 0) {
+                    p[0] = 255; p[1] = 0; p[2] = 0;
+                } else {
+                    p[0] = 255; p[1] = 255; p[2] = 255;
+                }
+            }
+            preview.file.write((char*)pixels.data(), pixels.size());
+            preview.pending.pop_front();
+        }
+        preview.rowsWritten += count;
+        writeHeader(preview);
+        preview.file.flush();
+        wrote = true;
+    }
+
+    return wrote;
+}
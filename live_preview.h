@@ -0,0 +1,76 @@
+#ifndef __LIVE_PREVIEW_H__
+#define __LIVE_PREVIEW_H__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <deque>
+
+#include "memory_region.h"
+#include "trace_session.h"
+
+/*
+    Background renderer producing preview images while a capture is running.
+
+    While the preview runs the capture queues a copy of every row it seals,
+    see TraceSession::sealedRows. Every interval the preview swaps the queue
+    out and appends the rows to a binary PPM image per region, a bounded
+    number per region per update with the rest kept for the next, so the
+    region mutex is only taken to name new regions. The height field of the
+    PPM header is padded so it can be rewritten in place, previously written
+    rows are never rendered again. When the capture coarsens its rows the
+    images are started again from the coarsened rows it queues. If the
+    images can't be written as fast as rows are sealed, at most
+    maxPendingRows rows are held per region, the oldest being dropped.
+*/
+class LivePreview
+{
+public:
+    LivePreview(std::string filePrefix = "model_preview_",
+                int intervalMs = 2000,
+                int maxRowsPerUpdate = 4096,
+                int maxPendingRows = 65536);
+
+    ~LivePreview();
+
+    void start();
+
+    // stops the preview thread after writing any remaining sealed rows
+    void stop();
+
+    std::string filePrefix;
+    int intervalMs;
+    int maxRowsPerUpdate;
+    int maxPendingRows;
+
+private:
+    class RegionPreview {
+    public:
+        std::string filename;
+        std::fstream file;
+        unsigned int width;
+        size_t rowsWritten;
+        unsigned int rowCoarsenings;
+        size_t rowsDropped;
+        std::deque<std::vector<MemoryRegion::MemoryReading> > pending;
+    };
+
+    void run();
+    bool update(bool drain);
+    void openPreview(RegionPreview &preview, unsigned int rowCoarsenings);
+    void writeHeader(RegionPreview &preview);
+
+    std::vector<RegionPreview*> previews;
+    std::vector<TraceSession::SealedRow> sealedRows;
+    std::vector<unsigned char> pixels;
+
+    std::thread thread;
+    std::mutex stopMutex;
+    std::condition_variable stopSignal;
+    bool stopRequested;
+};
+
+#endif  // __LIVE_PREVIEW_H__
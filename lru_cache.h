@@ -0,0 +1,52 @@
+#ifndef __LRU_CACHE_H__
+#define __LRU_CACHE_H__
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/*
+    Thread safe, fixed capacity least recently used cache.
+*/
+template <class Key, class Value>
+class LruCache
+{
+public:
+    LruCache(size_t capacity) : capacity(capacity) {}
+
+    bool get(const Key &key, Value &value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end())
+            return false;
+        entries.splice(entries.begin(), entries, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void put(const Key &key, const Value &value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = value;
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+        entries.push_front(std::make_pair(key, value));
+        index[key] = entries.begin();
+        if (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    size_t capacity;
+
+private:
+    std::list<std::pair<Key, Value> > entries;
+    std::unordered_map<Key, typename std::list<std::pair<Key, Value> >::iterator> index;
+    std::mutex mutex;
+};
+
+#endif  // __LRU_CACHE_H__
@@ -18,148 +18,312 @@
 #include <chrono>
 #include <mutex>
 #include <cassert>
-#include <opencv2/opencv.hpp>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <algorithm>
+#include <unistd.h>
+#ifndef VMT_NO_RENDER
 #include "trace_image.h"
+#endif
 #include "activity.h"
 #include "tensor_block.h"
 #include "memory_region.h"
 #include "trace_session.h"
+#include "live_preview.h"
+#include "lackey_line.h"
+#include "stage_profile.h"
+#include "include/vis_mem_protocol.h"
+
+void addMemoryRegions(const std::vector<MemoryRegion> &regions, bool queued) {
+
+    // large batches are summarised rather than listed
+    if (regions.size() > 16) {
+        std::cout << "[\033[92mVMT\033[0m] Added " << regions.size() << " regions\n";
+    } else {
+        for (auto &region : regions) {
+            std::cout << "[\033[92mVMT\033[0m] Added region [" << region.name;
+            std::cout << "] from [" << region.startAddr << "] to [";
+            std::cout << region.endAddr << "] with resolution [";
+            std::cout << region.resolution << "]\n";
+        }
+    }
 
-bool getline_async(std::istream& is, std::string& str, char delim = '\n') {
-
-    static std::string lineSoFar;
-    char inChar;
-    int charsRead = 0;
-    bool lineRead = false;
-    str = "";
+    if (queued)
+        TraceSession::queueMemoryRegions(regions);
+    else
+        TraceSession::addMemoryRegions(regions);
+}
 
-    do {
-        charsRead = is.readsome(&inChar, 1);
-        if (charsRead == 1) {
-            // if the delimiter is read then return the string so far
-            if (inChar == delim) {
-                str = lineSoFar;
-                lineSoFar = "";
-                lineRead = true;
-            } else {  // otherwise add it to the string so far
-                lineSoFar.append(1, inChar);
-            }
-        }
-    } while (charsRead != 0 && !lineRead);
+void retireMemoryRegions(const std::vector<unsigned long> &startAddrs, bool queued) {
 
-    return lineRead;
+    std::cout << "[\033[92mVMT\033[0m] Retiring regions at " << startAddrs.size() << " addresses\n";
+    if (queued)
+        TraceSession::queueRetireMemoryRegions(startAddrs);
+    else
+        TraceSession::retireMemoryRegions(startAddrs);
 }
 
-void readMemoryRegions(int argc, char **argv)
-{
-    std::string fifoName = "/tmp/vis_memory_tracer_fifo";
+// handles one message of the binary protocol, see include/vis_mem_protocol.h
+void processFrame(uint8_t type, const char *data, size_t length) {
 
-    for (int a=0; a<argc; ++a)
-        if (std::string(argv[a]).substr(0,14) == "--region_file=")
-            fifoName = std::string(argv[a]).substr(14, std::string::npos);
+    namespace Protocol = VisMemoryTrace::Protocol;
+    Protocol::FrameReader frame(data, length);
+    uint32_t count = 0;
 
-    std::fstream fifo;
-    try {
-        fifo.open(fifoName.c_str(), std::ios::out | std::ios::in);
+    if (type == Protocol::Title) {
+        std::string analysisTitle;
+        if (frame.getString(analysisTitle)) {
+            std::cout << "[\033[92mVMT\033[0m] Set title [" << analysisTitle << "]\n";
+            TraceSession::title = analysisTitle;
+        }
     }
-    catch (const std::exception& ex) {
-        std::cerr << "[\033[92mVMT\033[0m] Exception opening fifo : " << ex.what();
-        exit(1);
+    else if (type == Protocol::Regions && frame.get(count)) {
+        std::vector<MemoryRegion> regions;
+        for (uint32_t r=0; r<count; ++r) {
+            uint64_t start, end;
+            uint32_t resolution;
+            std::string name;
+            if (!frame.get(start) || !frame.get(end) || !frame.get(resolution) || !frame.getString(name))
+                break;
+            regions.push_back(MemoryRegion(name, start, end, resolution == 0 ? 1000 : resolution));
+        }
+        addMemoryRegions(regions, true);
     }
+    else if (type == Protocol::Events && frame.get(count)) {
+        for (uint32_t e=0; e<count; ++e) {
+            uint64_t addr;
+            std::string name;
+            if (!frame.get(addr) || !frame.getString(name))
+                break;
+            std::cout << "[\033[92mVMT\033[0m] Added activity [" << name;
+            std::cout << "] at address " << addr << std::endl;
+            TraceSession::addActivity(Activity(name, addr));
+        }
+    }
+    else if (type == Protocol::RetireRegions && frame.get(count)) {
+        std::vector<unsigned long> startAddrs;
+        for (uint32_t r=0; r<count; ++r) {
+            uint64_t start;
+            if (!frame.get(start))
+                break;
+            startAddrs.push_back(start);
+        }
+        retireMemoryRegions(startAddrs, true);
+    }
+    else if (type == Protocol::Sync) {
+        TraceSession::syncReceived();
+    }
+    else if (type == Protocol::Areas && frame.get(count)) {
+        for (uint32_t a=0; a<count; ++a) {
+            uint64_t startAddr, endAddr, startEventAddr, endEventAddr;
+            uint32_t startOccurrence, endOccurrence;
+            if (!frame.get(startAddr) || !frame.get(endAddr) ||
+                !frame.get(startEventAddr) || !frame.get(endEventAddr) ||
+                !frame.get(startOccurrence) || !frame.get(endOccurrence))
+                break;
+            TraceSession::timeMemoryAreas.push_back(TimeMemoryArea(startAddr, endAddr,
+                                                                   startEventAddr, endEventAddr,
+                                                                   startOccurrence, endOccurrence));
+        }
+    }
+    else
+        std::cerr << "[\033[92mVMT\033[0m] Warning: Ignoring unknown control message type " << (int)type << "\n";
+}
 
-    std::cout << "[\033[92mVMT\033[0m] Opened region file [" << fifoName << "]\n";
+// set once the binary protocol has been offered to the payload, it is
+// only used once the payload confirms it saw the reply in time.
+static bool binaryOffered = false;
+
+// handles one line of the text protocol, returns true if the payload
+// has switched to the binary protocol.
+bool processLine(const std::string &line, const std::string &fifoName) {
+
+    std::stringstream lineStream(line);
+    char dump;
+
+    // if this line sets the title of the analysis
+    if (line[0] == '"') {
+        lineStream >> dump;
+        std::string analysisTitle;
+        std::getline(lineStream, analysisTitle, '"');
+        std::cout << "[\033[92mVMT\033[0m] Set title [" << analysisTitle;
+        std::cout << "]\n";
+        TraceSession::title = analysisTitle;
+    }
+    // if this line defined a memory region,
+    else if (line[0] == ':') {
+        std::string name;
+        unsigned long start, end, resolution = 0;
 
-    while (!fifo.eof())
-    {
-        std::string line;
-        getline_async(fifo, line);
+        lineStream >> dump;
+        std::getline(lineStream, name, '(');
 
-        if (line.length() == 0)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
+        lineStream >> start;
+        lineStream >> dump >> end;
+        lineStream >> dump >> resolution;
 
-        std::stringstream lineStream(line);
-        char dump;
+        // use default resolution of 1000 if none specified
+        if (resolution == 0)
+            resolution = 1000;
 
-        // if this line sets the title of the analysis
-        if (line[0] == '"') {
-            lineStream >> dump;
-            std::string analysisTitle;
-            std::getline(lineStream, analysisTitle, '"');
-            std::cout << "[\033[92mVMT\033[0m] Set title [" << analysisTitle;
-            std::cout << "]\n";
-            TraceSession::title = analysisTitle;
+        if (name != "")
+            addMemoryRegions(std::vector<MemoryRegion>(1, MemoryRegion(name, start, end, resolution)), false);
+    }
+    // if this line retires the regions starting at an address
+    else if (line[0] == '-') {
+        unsigned long start;
+        lineStream >> dump >> start;
+        retireMemoryRegions(std::vector<unsigned long>(1, start), false);
+    }
+    // if this line defines an event
+    else if (line[0] == '#') {
+        std::string name;
+        unsigned long addr;
+
+        lineStream >> dump;
+        std::getline(lineStream, name, '(');
+        lineStream >> addr;
+
+        std::cout << "[\033[92mVMT\033[0m] Added activity [" << name;
+        std::cout << "] at address " << addr << std::endl;
+        TraceSession::addActivity(Activity(name, addr));
+    }
+    // if this line defines an area of time-memory space
+    else if (line[0] == '&') {
+        unsigned long startAddr, endAddr;
+        unsigned long startEventAddr, endEventAddr;
+
+        lineStream >> dump >> startAddr;
+        lineStream >> dump >> endAddr;
+        lineStream >> dump >> startEventAddr;
+        lineStream >> dump >> endEventAddr;
+
+        // optional occurrence indices of the start and end events
+        unsigned int startOccurrence = 0, endOccurrence = 0;
+        if (lineStream >> dump >> startOccurrence)
+            lineStream >> dump >> endOccurrence;
+
+        TimeMemoryArea area(startAddr, endAddr,
+                            startEventAddr,
+                            endEventAddr,
+                            startOccurrence,
+                            endOccurrence);
+        TraceSession::timeMemoryAreas.push_back(area);
+    }
+    // if the payload is offering the binary protocol
+    else if (line.substr(0,7) == "@hello ") {
+        std::string hello;
+        unsigned int version = 0;
+        unsigned long syncFlagAddr = 0;
+        lineStream >> hello >> version >> syncFlagAddr;
+        binaryOffered = false;
+        std::string replyName = fifoName + VisMemoryTrace::Protocol::replySuffix;
+        int reply = open(replyName.c_str(), O_WRONLY | O_NONBLOCK);
+        if (reply < 0) {
+            std::cerr << "[\033[92mVMT\033[0m] Error: Could not open reply fifo [" << replyName << "], using text protocol.\n";
+            return false;
         }
-        // if this line defined a memory region,
-        else if (line[0] == ':') {
-            std::string name;
-            unsigned long start, end, resolution = 0;
-
-            lineStream >> dump;
-            std::getline(lineStream, name, '(');
+        // the sync flag must be known before the payload sees the reply
+        bool accepted = version == VisMemoryTrace::Protocol::version;
+        if (accepted)
+            TraceSession::syncFlagAddr = syncFlagAddr;
+        std::string response = accepted ? "@binary " + std::to_string(version) + "\n" : "@text\n";
+        ssize_t written = write(reply, response.data(), response.size());
+        close(reply);
+        binaryOffered = accepted && written == (ssize_t)response.size();
+    }
+    // if the payload has confirmed the binary protocol, frames follow this line
+    else if (line.substr(0,8) == "@binary ") {
+        std::string confirm;
+        unsigned int version = 0;
+        lineStream >> confirm >> version;
+        if (binaryOffered && version == VisMemoryTrace::Protocol::version) {
+            std::cout << "[\033[92mVMT\033[0m] Using binary protocol version " << version << "\n";
+            return true;
+        }
+        std::cerr << "[\033[92mVMT\033[0m] Warning: Ignoring binary protocol confirmation that was never offered.\n";
+    }
 
-            lineStream >> start;
-            lineStream >> dump >> end;
-            lineStream >> dump >> resolution;
+    return false;
+}
 
-            // use default resolution of 1000 if none specified
-            if (resolution == 0)
-                resolution = 1000;
+// written to by main to wake the control thread when shutting down
+static int controlWakePipe[2];
 
-            if (name == "")
-                break;
+void readMemoryRegions(int argc, char **argv)
+{
+    std::string fifoName = "/tmp/vis_memory_tracer_fifo";
 
-            MemoryRegion region(name, start, end, resolution);
+    for (int a=0; a<argc; ++a)
+        if (std::string(argv[a]).substr(0,14) == "--region_file=")
+            fifoName = std::string(argv[a]).substr(14, std::string::npos);
 
-            std::cout << "[\033[92mVMT\033[0m] Added region [" << region.name;
-            std::cout << "] from [" << region.startAddr << "] to [";
-            std::cout << region.endAddr << "] with resolution [";
-            std::cout << resolution << "]\n";
+    // opened for writing as well so the fifo never reports end of file
+    // when a payload closes it.
+    int fifo = open(fifoName.c_str(), O_RDWR);
+    if (fifo < 0 && TraceSession::pageMap.enabled) {
+        std::cout << "[\033[92mVMT\033[0m] No region file [" << fifoName << "], capturing without a payload.\n";
+        return;
+    }
+    if (fifo < 0) {
+        std::cerr << "[\033[92mVMT\033[0m] Error opening fifo [" << fifoName << "] : " << std::strerror(errno) << "\n";
+        exit(1);
+    }
 
-            TraceSession::memRegionsMutex.lock();
-            TraceSession::memoryRegions.push_back(region);
-            TraceSession::memRegionsMutex.unlock();
-        }
-        // if this line defines an event
-        else if (line[0] == '#') {
-            std::string name;
-            unsigned long addr;
+    std::cout << "[\033[92mVMT\033[0m] Opened region file [" << fifoName << "]\n";
 
-            lineStream >> dump;
-            std:getline(lineStream, name, '(');
-            lineStream >> addr;
+    bool binary = false;
+    std::string received;
+    char buffer[65536];
 
-            std::cout << "[\033[92mVMT\033[0m] Added activity [" << name;
-            std::cout << "] at address " << addr << std::endl;
+    VMT_PROFILE_CLOCK(profileClock);
 
-            TraceSession::activitiesMutex.lock();
-            TraceSession::activities.push_back(Activity(name, addr));
-            TraceSession::activitiesMutex.unlock();
+    while (true)
+    {
+        // block until there is control data or a shutdown request
+        pollfd fds[2] = { { fifo, POLLIN, 0 }, { controlWakePipe[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
         }
-        // if this line defines an area of time-memory space
-        else if (line[0] == '&') {
-            unsigned long startAddr, endAddr;
-            unsigned long startEventAddr, endEventAddr;
-
-            lineStream >> dump >> startAddr;
-            lineStream >> dump >> endAddr;
-            lineStream >> dump >> startEventAddr;
-            lineStream >> dump >> endEventAddr;
-
-            std::cout << "[\033[92mVMT\033[0m] Added time-memory area.\n";
-
-            TimeMemoryArea area(startAddr, endAddr,
-                                startEventAddr,
-                                endEventAddr);
-            TraceSession::timeMemoryAreas.push_back(area);
+        VMT_PROFILE_LAP(profileClock, ControlWait);
+
+        if (fds[0].revents & POLLIN) {
+            ssize_t bytesRead = read(fifo, buffer, sizeof (buffer));
+            if (bytesRead > 0)
+                received.append(buffer, bytesRead);
         }
-        // if this line is a read query request
-        else if (line.substr(0,7) == "@ready?") {
-            std::cout << "Responding with [@yes_ready.]\n";
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            fifo << "@yes_ready.\n";
+        VMT_PROFILE_LAP(profileClock, ControlRead);
+
+        // handle every complete line or frame received, the payload may
+        // switch to frames part way through the data.
+        size_t pos = 0;
+        while (pos < received.size()) {
+            if (!binary) {
+                size_t lineEnd = received.find('\n', pos);
+                if (lineEnd == std::string::npos)
+                    break;
+                std::string line = received.substr(pos, lineEnd - pos);
+                pos = lineEnd + 1;
+                if (line.length() > 0)
+                    binary = processLine(line, fifoName);
+            } else {
+                namespace Protocol = VisMemoryTrace::Protocol;
+                if (received.size() - pos < Protocol::frameHeaderSize)
+                    break;
+                uint32_t length;
+                std::memcpy(&length, &received[pos + 1], sizeof (uint32_t));
+                if (received.size() - pos - Protocol::frameHeaderSize < length)
+                    break;
+                processFrame(received[pos], &received[pos + Protocol::frameHeaderSize], length);
+                pos += Protocol::frameHeaderSize + length;
+            }
         }
+        received.erase(0, pos);
+        VMT_PROFILE_LAP(profileClock, ControlHandle);
 
         // break out of this loop if shutdown requested.
         TraceSession::shutdownMutex.lock();
@@ -171,84 +335,298 @@ void readMemoryRegions(int argc, char **argv)
         TraceSession::shutdownMutex.unlock();
     }
 
-    fifo.close();
+    close(fifo);
 }
 
+// removes any running occurrence of the activity from the list
+void endOccurrence(std::vector<std::pair<size_t, size_t> > &occurrences, size_t activity) {
+    occurrences.erase(std::remove_if(occurrences.begin(), occurrences.end(),
+                                     [activity](const std::pair<size_t, size_t> &occ) { return occ.first == activity; }),
+                      occurrences.end());
+}
+
+#ifndef VMT_NO_RENDER
+// renders the trace, its time-memory areas and the miss overlay
+void saveTraceImages(int missLevel) {
+    TraceImage traceSaver;
+    bool showOperations = TraceSession::activities.size() != 0;
+    TraceSession::boxAlpha = 0.0;
+    TraceSession::boxOutlineAlpha = 0.0;
+    traceSaver.saveTraceImage(TraceSession::memoryRegions,
+                              "model_trace.png",
+                              TraceSession::title,
+                              true,
+                              showOperations);
+
+    TraceSession::boxAlpha = 1.0;
+    TraceSession::boxOutlineAlpha = 0.0;
+    traceSaver.saveTraceImage(TraceSession::memoryRegions,
+                              "model_blocks.png",
+                              TraceSession::title,
+                              true,
+                              showOperations);
+
+    TraceSession::boxAlpha = 0.0;
+    TraceSession::boxOutlineAlpha = 1.0;
+    TraceSession::showTrace = false;
+    traceSaver.saveTraceImage(TraceSession::memoryRegions,
+                              "model_block_outlines.png",
+                              TraceSession::title,
+                              true,
+                              showOperations);
+
+    if (TraceSession::cacheSimulator.enabled() && missLevel > 0) {
+        missLevel = std::min(missLevel, (int)TraceSession::cacheSimulator.levels.size());
+        TraceSession::boxOutlineAlpha = 0.0;
+        TraceSession::showTrace = true;
+        TraceSession::missOverlayLevel = missLevel;
+        traceSaver.saveTraceImage(TraceSession::memoryRegions,
+                                  "model_misses.png",
+                                  TraceSession::title + " (L" + std::to_string(missLevel) + " misses)",
+                                  true,
+                                  showOperations);
+    }
+}
+#endif
+
 int main(int argc, char **argv)
 {
     std::cout << "[\033[92mVisual Memory Tracer\033[0m] Starting up.\n";
 
+    LivePreview preview;
+    bool previewEnabled = false;
+#ifndef VMT_NO_RENDER
+    int missLevel = 1;
+    bool render = true;
+#endif
+    bool planMemory = false;
+    bool chromeTrace = false;
+    bool adaptiveRows = false;
+    std::string profileStatsFilename = "";
+#ifdef VMT_PROFILE
+    unsigned long profileInterval = 100;
+#endif
+    unsigned long planAlignment = 64;
+
     for (int a=0; a<argc; ++a)
     {
         if (std::string(argv[a]).substr(0,14) == "--ins_per_row=") {
             TraceSession::instructionsPerRow = std::atoi(std::string(argv[a]).substr(14, std::string::npos).c_str());
             std::cout << "[\033[92mVMT\033[0m] Setting instruction per row to : " << TraceSession::instructionsPerRow << std::endl;
         }
+        else if (std::string(argv[a]).substr(0,11) == "--max_rows=") {
+            TraceSession::maxTraceRows = std::max(2, std::atoi(std::string(argv[a]).substr(11, std::string::npos).c_str()));
+            std::cout << "[\033[92mVMT\033[0m] Setting row limit to : " << TraceSession::maxTraceRows << std::endl;
+        }
+        else if (std::string(argv[a]) == "--adaptive_rows")
+            adaptiveRows = true;
         else if (std::string(argv[a]).substr(0,12) == "--box_alpha=") {
             TraceSession::boxAlpha = std::atof(std::string(argv[a]).substr(12, std::string::npos).c_str());
             std::cout << "[\033[92mVMT\033[0m] Setting time-memory area alpha to : " << (TraceSession::boxAlpha*100) << "%" << std::endl;
         }
+        else if (std::string(argv[a]) == "--preview")
+            previewEnabled = true;
+        else if (std::string(argv[a]).substr(0,19) == "--preview_interval=") {
+            preview.intervalMs = std::atoi(std::string(argv[a]).substr(19, std::string::npos).c_str());
+            previewEnabled = true;
+        }
+        else if (std::string(argv[a]).substr(0,15) == "--preview_rows=")
+            preview.maxRowsPerUpdate = std::atoi(std::string(argv[a]).substr(15, std::string::npos).c_str());
+        else if (std::string(argv[a]) == "--reuse")
+            TraceSession::reuseAnalysis.enabled = true;
+        else if (std::string(argv[a]).substr(0,12) == "--line_size=") {
+            TraceSession::reuseAnalysis.lineSize = std::max(1, std::atoi(std::string(argv[a]).substr(12, std::string::npos).c_str()));
+            std::cout << "[\033[92mVMT\033[0m] Setting reuse analysis line size to : " << TraceSession::reuseAnalysis.lineSize << " bytes" << std::endl;
+        }
+        else if (std::string(argv[a]) == "--cache" || std::string(argv[a]).substr(0,8) == "--cache=") {
+            std::string spec = std::string(argv[a]).size() > 8 ? std::string(argv[a]).substr(8, std::string::npos) : CacheSimulator::defaultSpec;
+            if (!TraceSession::cacheSimulator.configure(spec)) {
+                std::cerr << "[\033[92mVMT\033[0m] Error: Invalid cache configuration \"" << spec << "\", expected up to "
+                          << CacheSimulator::maxLevels << " levels of size/ways/line size/[lru|plru] separated by commas,"
+                          << " with line sizes not shrinking down the hierarchy.\n";
+                return 1;
+            }
+            std::cout << "[\033[92mVMT\033[0m] Simulating cache :";
+            for (auto &level : TraceSession::cacheSimulator.levels)
+                std::cout << " " << level.describe();
+            std::cout << std::endl;
+        }
+#ifndef VMT_NO_RENDER
+        else if (std::string(argv[a]).substr(0,13) == "--miss_level=")
+            missLevel = std::atoi(std::string(argv[a]).substr(13, std::string::npos).c_str());
+#endif
+        else if (std::string(argv[a]) == "--patterns")
+            TraceSession::accessPatterns.enabled = true;
+        else if (std::string(argv[a]) == "--plan")
+            planMemory = true;
+#ifndef VMT_NO_RENDER
+        else if (std::string(argv[a]) == "--no-render")
+            render = false;
+#endif
+        else if (std::string(argv[a]) == "--chrome_trace")
+            chromeTrace = true;
+        else if (std::string(argv[a]).substr(0,16) == "--profile_stats=")
+            profileStatsFilename = std::string(argv[a]).substr(16, std::string::npos);
+#ifdef VMT_PROFILE
+        else if (std::string(argv[a]).substr(0,19) == "--profile_interval=")
+            profileInterval = std::max(1, std::atoi(std::string(argv[a]).substr(19, std::string::npos).c_str()));
+#endif
+        else if (std::string(argv[a]) == "--index")
+            TraceSession::windowIndexRows = WindowIndex::defaultBlockRows;
+        else if (std::string(argv[a]).substr(0,8) == "--index=")
+            TraceSession::windowIndexRows = std::atoi(std::string(argv[a]).substr(8, std::string::npos).c_str());
+        else if (std::string(argv[a]).substr(0,9) == "--sample=") {
+            std::string spec = std::string(argv[a]).substr(9, std::string::npos);
+            if (!TraceSession::rowSampler.configure(spec)) {
+                std::cerr << "[\033[92mVMT\033[0m] Error: Invalid sampling \"" << spec << "\", expected N/M or N/M,random to record N of every M rows.\n";
+                return 1;
+            }
+            std::cout << "[\033[92mVMT\033[0m] Recording " << TraceSession::rowSampler.sampleRows << " of every "
+                      << TraceSession::rowSampler.periodRows << " rows" << (TraceSession::rowSampler.randomBursts ? " in random bursts" : "") << std::endl;
+        }
+        else if (std::string(argv[a]).substr(0,14) == "--sample_seed=")
+            TraceSession::rowSampler.seed = std::strtoul(std::string(argv[a]).substr(14, std::string::npos).c_str(), nullptr, 0);
+        else if (std::string(argv[a]) == "--whole_process")
+            TraceSession::pageMap.enabled = true;
+        else if (std::string(argv[a]).substr(0,15) == "--discover_gap=")
+            TraceSession::pageMap.maxGapPages = std::strtoul(std::string(argv[a]).substr(15, std::string::npos).c_str(), nullptr, 0);
+        else if (std::string(argv[a]).substr(0,19) == "--discover_regions=")
+            TraceSession::pageMap.maxRegions = std::max(1, std::atoi(std::string(argv[a]).substr(19, std::string::npos).c_str()));
+        else if (std::string(argv[a]) == "--refine")
+            TraceSession::regionRefiner.enabled = true;
+        else if (std::string(argv[a]).substr(0,9) == "--refine=") {
+            TraceSession::regionRefiner.threshold = std::strtoul(std::string(argv[a]).substr(9, std::string::npos).c_str(), nullptr, 0);
+            TraceSession::regionRefiner.enabled = true;
+        }
+        else if (std::string(argv[a]).substr(0,14) == "--refine_zoom=")
+            TraceSession::regionRefiner.zoom = std::max(2, std::atoi(std::string(argv[a]).substr(14, std::string::npos).c_str()));
+        else if (std::string(argv[a]).substr(0,16) == "--refine_budget=")
+            TraceSession::regionRefiner.pixelBudget = std::max(0, std::atoi(std::string(argv[a]).substr(16, std::string::npos).c_str()));
+        else if (std::string(argv[a]).substr(0,13) == "--plan_align=") {
+            planAlignment = std::atoi(std::string(argv[a]).substr(13, std::string::npos).c_str());
+            planMemory = true;
+        }
     }
 
     std::cout << "Finishing loading mem map or not." << std::endl;
 
+#ifndef VMT_PROFILE
+    if (profileStatsFilename != "")
+        std::cerr << "[\033[92mVMT\033[0m] Warning: Built without profiling, build with 'make PROFILE=1' to save profile stats.\n";
+#endif
+
+    if (pipe(controlWakePipe) != 0) {
+        std::cerr << "[\033[92mVMT\033[0m] Error creating control thread pipe.\n";
+        return 1;
+    }
     std::thread region_fifo_thread(readMemoryRegions, argc, argv);
 
+    if (previewEnabled)
+        preview.start();
+
     // Now we look reading lines from stdin and process them as output from valgrind --tool=lackey
     // we terminate when a line contains "Exit code" indicating the end of the valgrind process.
     unsigned long instructionCount = 0;
     bool end = false;
     bool anythingRecorded = false;
-    bool recording = false;
+    // unmodified programs have no recording event to wait for
+    bool recording = TraceSession::pageMap.enabled;
+    unsigned long syncsSeen = 0;
+    std::vector<std::pair<size_t, size_t> > activeOccurrences;  // activity, occurrence
+
+    // true while the row being recorded is not sampled, decided as each row
+    // starts, the first row as recording starts
+    bool skipping = false;
+    unsigned long sampledInstructions = 0;
+    auto startRow = [&skipping]() {
+        if (TraceSession::rowSampler.enabled) {
+            skipping = !TraceSession::rowSampler.sampled(TraceSession::rowsStored);
+            TraceSession::markSkippedRow(TraceSession::rowsStored, skipping);
+        }
+    };
+    if (recording)
+        startRow();
 
     int loopCount=0;
+    VMT_PROFILE_CLOCK(profileClock);
 
     do {
         std::string line;
         std::getline(std::cin, line);
+        VMT_PROFILE_LAP(profileClock, ReadInput);
+
+        // skipped rows only count instructions and look for event markers
+        if (skipping && line[0] != 'I' && !lackeyMarkerCandidate(line)) {
+            end = line[0] == '=' && line.find("Exit code") != std::string::npos;
+            VMT_PROFILE_LAP(profileClock, Parse);
+            continue;
+        }
 
         if (line.length() >= 1) {
             if (recording && line[0] == 'I')
             {
                 ++instructionCount;
+                sampledInstructions += !skipping;
 
-                if (anythingRecorded && (instructionCount % TraceSession::instructionsPerRow) == 0)
+                // rows are counted from the start of the trace, which stays
+                // on a row boundary when the rows are coarsened.
+                if (anythingRecorded && ((instructionCount - TraceSession::traceStartInstruction) % TraceSession::instructionsPerRow) == 0)
                 {
-                    if (TraceSession::memoryRegions.size() > 0 && TraceSession::memoryRegions[0].trace.size() == 1)
+                    if (TraceSession::rowsStored == 0)
                     {
                         TraceSession::traceStartInstruction = instructionCount - TraceSession::instructionsPerRow;
                     }
 
-                    for (int r=0; r<TraceSession::memoryRegions.size(); ++r)
-                        TraceSession::memoryRegions[r].storeRow();
+                    TraceSession::storeRow();
+                    VMT_PROFILE_LAP(profileClock, RowSeal);
+#ifdef VMT_PROFILE
+                    if (profileStatsFilename != "" && TraceSession::rowsStored % profileInterval == 0)
+                        StageProfile::saveStats(profileStatsFilename);
+#endif
 
-                    // if the recording limit has been reached then stop.
-                    if (TraceSession::memoryRegions.size() > 0 && TraceSession::memoryRegions[0].trace.size() > TraceSession::maxTraceRows)
+                    // if the recording limit has been reached then either
+                    // merge pairs of rows and carry on or stop.
+                    if (TraceSession::rowsStored >= TraceSession::maxTraceRows)
                     {
-                        break;
-                        std::cout << "[\033[92mVMT\033[0m] Read limit of " << TraceSession::maxTraceRows << " rows reached." << std::endl;
+                        if (adaptiveRows) {
+                            TraceSession::coarsenRows();
+                            std::cout << "[\033[92mVMT\033[0m] Row limit of " << TraceSession::maxTraceRows
+                                      << " reached, now " << TraceSession::instructionsPerRow << " instructions per row." << std::endl;
+                        } else {
+                            std::cout << "[\033[92mVMT\033[0m] Read limit of " << TraceSession::maxTraceRows << " rows reached." << std::endl;
+                            break;
+                        }
                     }
+
+                    startRow();
                 }
             }
 
-            char type = line[1];
-            if (type == 'L' || type == 'S' || type == 'M')
+            char type;
+            unsigned long addr;
+            unsigned int size;
+            bool isAccess = parseLackeyAccess(line, type, addr, size);
+            VMT_PROFILE_LAP(profileClock, Parse);
+            if (isAccess)
             {
                 anythingRecorded = true;
-                std::stringstream lineStream(line.substr(3, std::string::npos));
-
-                std::string hexStr;
-                std::getline(lineStream, hexStr, ',');
-                unsigned long addr = std::stol(hexStr, nullptr, 16);
 
-                unsigned int size;
-                lineStream >> size;
+                // hold back the access stream until the control thread has
+                // caught up with the payload at each sync marker.
+                if (type == 'S' && addr == TraceSession::syncFlagAddr) {
+                    if (!TraceSession::waitForSync(++syncsSeen))
+                        std::cerr << "[\033[92mVMT\033[0m] Warning: Timed out waiting for sync " << syncsSeen << " from the payload.\n";
+                    TraceSession::applyRegionChanges(syncsSeen);
+                    VMT_PROFILE_LAP(profileClock, SyncWait);
+                }
 
                 // check for recording start stop events
                 if (TraceSession::activities.size() > 0 &&
                     TraceSession::activities[0].addr == addr) {
                   if (type == 'S') {
                     recording = true;
+                    if (TraceSession::rowsStored == 0)
+                        startRow();
                     std::cout << "[\033[92mVMT\033[0m] Started Recording.\n";
                   } else if (type == 'L') {
                     recording = false;
@@ -259,9 +637,19 @@ int main(int argc, char **argv)
                 // check for memeory access in inspected regions
                 bool update = false;
                 if (recording) {
+                  int levelsMissed = 0;
+                  if (TraceSession::cacheSimulator.enabled() && !skipping) {
+                    levelsMissed = TraceSession::cacheSimulator.access(addr, size);
+                    VMT_PROFILE_LAP(profileClock, CacheSim);
+                  }
+
+                  if (TraceSession::pageMap.enabled && !skipping)
+                    TraceSession::pageMap.access(type, addr, size, TraceSession::rowsStored);
+
                   TraceSession::memRegionsMutex.lock();
-                  for (int r=0; r<TraceSession::memoryRegions.size(); ++r)
-                    if (addr >= TraceSession::memoryRegions[r].startAddr && addr < TraceSession::memoryRegions[r].endAddr) {
+                  TraceSession::regionIndex.find(addr, [&](size_t r) {
+                      if (skipping)
+                        return;
                       if (type == 'L') {
                         ++TraceSession::memoryRegions[r].loadCount;
                         TraceSession::memoryRegions[r].addLoad(addr, size);
@@ -271,30 +659,72 @@ int main(int argc, char **argv)
                       } else if (type == 'M') {
                         TraceSession::memoryRegions[r].addMod(addr, size);
                       }
+                      if (levelsMissed > 0)
+                        TraceSession::memoryRegions[r].addMisses(addr, levelsMissed);
+                      if (TraceSession::reuseAnalysis.enabled)
+                        TraceSession::reuseAnalysis.access(r, addr, size);
+                      if (TraceSession::accessPatterns.enabled) {
+                        TraceSession::accessPatterns.access(r, AccessPatterns::wholeRegion, 0, addr, size);
+                        for (auto &occ : activeOccurrences)
+                          TraceSession::accessPatterns.access(r, occ.first, occ.second, addr, size);
+                      }
                       update = true;
+                  });
+                  if (update && TraceSession::reuseAnalysis.enabled)
+                    TraceSession::reuseAnalysis.accessCombined(addr, size);
+
+                  // bytes accessed in regions during each running occurrence
+                  if (update && !activeOccurrences.empty()) {
+                    TraceSession::activitiesMutex.lock();
+                    for (auto &occ : activeOccurrences) {
+                      ByteTraffic &traffic = TraceSession::activities[occ.first].occurrences[occ.second].traffic;
+                      if (type == 'L')
+                        traffic.loadBytes += size;
+                      else if (type == 'S')
+                        traffic.storeBytes += size;
+                      else
+                        traffic.modBytes += size;
                     }
+                    TraceSession::activitiesMutex.unlock();
+                  }
                   TraceSession::memRegionsMutex.unlock();
+                  VMT_PROFILE_LAP(profileClock, RegionMatch);
 
                   // check for activity start stop events
                   TraceSession::activitiesMutex.lock();
-                  for (int a=1; a<TraceSession::activities.size(); ++a) {
-                    if (TraceSession::activities[a].addr == addr) {
-                      if (type == 'S')
-                        TraceSession::activities[a].startEvent(instructionCount);
-                      else if (type == 'L')
-                        TraceSession::activities[a].stopEvent(instructionCount);
+                  const std::vector<size_t> *activityIdxs = TraceSession::findActivities(addr);
+                  if (activityIdxs != nullptr)
+                    for (size_t activityIdx : *activityIdxs) {
+                      if (activityIdx == 0)
+                        continue;
+                      Activity *activity = &TraceSession::activities[activityIdx];
+                      if (type == 'S') {
+                        activity->startEvent(instructionCount);
+                        endOccurrence(activeOccurrences, activityIdx);
+                        activeOccurrences.push_back(std::make_pair(activityIdx, activity->occurrences.size() - 1));
+                        if (TraceSession::reuseAnalysis.enabled)
+                          TraceSession::reuseAnalysis.startOccurrence(activityIdx, activity->occurrences.size() - 1);
+                      }
+                      else if (type == 'L') {
+                        activity->stopEvent(instructionCount);
+                        endOccurrence(activeOccurrences, activityIdx);
+                        if (TraceSession::reuseAnalysis.enabled)
+                          TraceSession::reuseAnalysis.stopOccurrence(activityIdx);
+                      }
                       update = true;
                     }
-                  }
                   TraceSession::activitiesMutex.unlock();
+                  VMT_PROFILE_LAP(profileClock, ActivityMatch);
                 }
 
                 if (update)
                     {
                     std::cout << "\r";
                     for (int r=0; r<TraceSession::memoryRegions.size(); ++r)
+                      if (!TraceSession::memoryRegions[r].retired)
                         std::cout << "[" << TraceSession::memoryRegions[r].name << "] l:" << TraceSession::memoryRegions[r].loadCount << " s:" << TraceSession::memoryRegions[r].storeCount << "  ";
                     std::cout << "Instruction " << instructionCount;
+                    VMT_PROFILE_LAP(profileClock, Progress);
                     }
             }
         }
@@ -307,8 +737,19 @@ int main(int argc, char **argv)
     TraceSession::shutdownMutex.lock();
     TraceSession::readShutdown = true;
     TraceSession::shutdownMutex.unlock();
+    char wake = 0;
+    if (write(controlWakePipe[1], &wake, 1) != 1)
+        std::cerr << "[\033[92mVMT\033[0m] Error waking control thread.\n";
     region_fifo_thread.join();
 
+#ifdef VMT_PROFILE
+    StageProfile::report(std::cout);
+    if (profileStatsFilename != "" && StageProfile::saveStats(profileStatsFilename))
+        std::cout << "[\033[92mVMT\033[0m] Saved profile stats to " << profileStatsFilename << "\n";
+#endif
+
+    preview.stop();
+
     // debug activity monitoring
     /*std::cout << "\nEvents\n";
     for (int a=0; a<TraceSession::activities.size(); ++a)
@@ -322,6 +763,19 @@ int main(int argc, char **argv)
         }
     }*/
 
+    if (TraceSession::pageMap.enabled)
+        TraceSession::addDiscoveredRegions();
+
+    if (TraceSession::rowSampler.enabled) {
+        double scale = TraceSession::scaleSampledCounts(instructionCount, sampledInstructions);
+        std::cout << "[\033[92mVMT\033[0m] Recorded " << 100.0 / scale << "% of instructions, region and activity totals scaled by " << scale << ".\n";
+    }
+
+    TraceSession::resolveMemoryAreas();
+
+    if (TraceSession::cacheSimulator.enabled())
+        TraceSession::cacheSimulator.report(std::cout);
+
     // save trace data
     std::ofstream traceDataFile("model.trace");
     if (traceDataFile.is_open()) {
@@ -330,33 +784,42 @@ int main(int argc, char **argv)
     } else
         std::cerr << "Could not open \"model.trace\" to save trace data" << std::endl;
 
-    // save trace image files
-    TraceImage traceSaver;
-    bool showOperations = TraceSession::activities.size() != 0;
-    TraceSession::boxAlpha = 0.0;
-    TraceSession::boxOutlineAlpha = 0.0;
-    traceSaver.saveTraceImage(TraceSession::memoryRegions,
-                              "model_trace.png",
-                              TraceSession::title,
-                              true,
-                              showOperations);
+    std::vector<std::string> regionNames, activityNames;
+    for (auto &region : TraceSession::memoryRegions)
+        regionNames.push_back(region.name);
+    for (auto &activity : TraceSession::activities)
+        activityNames.push_back(activity.name);
+
+    // save access pattern report
+    if (TraceSession::accessPatterns.enabled) {
+        TraceSession::accessPatterns.printSummary(std::cout, regionNames, activityNames);
+        if (TraceSession::accessPatterns.saveCsv("model_access_patterns.csv", regionNames, activityNames))
+            std::cout << "[\033[92mVMT\033[0m] Saved access patterns to model_access_patterns.csv\n";
+    }
 
-    TraceSession::boxAlpha = 1.0;
-    TraceSession::boxOutlineAlpha = 0.0;
-    traceSaver.saveTraceImage(TraceSession::memoryRegions,
-                              "model_blocks.png",
-                              TraceSession::title,
-                              true,
-                              showOperations);
+    // save reuse distance reports
+    if (TraceSession::reuseAnalysis.enabled) {
+        TraceSession::reuseAnalysis.saveCsv("model_reuse.csv", regionNames, activityNames);
+        TraceSession::reuseAnalysis.saveJson("model_reuse.json", regionNames, activityNames);
+        std::cout << "[\033[92mVMT\033[0m] Saved reuse distances to model_reuse.csv and model_reuse.json\n";
+    }
 
-    TraceSession::boxAlpha = 0.0;
-    TraceSession::boxOutlineAlpha = 1.0;
-    TraceSession::showTrace = false;
-    traceSaver.saveTraceImage(TraceSession::memoryRegions,
-                              "model_block_outlines.png",
-                              TraceSession::title,
-                              true,
-                              showOperations);
+    if (TraceSession::saveTraffic("model_traffic.csv"))
+        std::cout << "[\033[92mVMT\033[0m] Saved memory traffic to model_traffic.csv\n";
+
+    if (chromeTrace)
+        TraceSession::saveChromeTrace("model_chrome_trace.json");
+
+    // plan the tensors of each region into the smallest arena
+    if (planMemory && TraceSession::planMemory("model_memory_plan.csv", planAlignment))
+        std::cout << "[\033[92mVMT\033[0m] Saved memory plan to model_memory_plan.csv\n";
+
+#ifndef VMT_NO_RENDER
+    if (render)
+        saveTraceImages(missLevel);
+    else
+#endif
+        std::cout << "[\033[92mVMT\033[0m] Plots not rendered, render them from model.trace with vis_mem_plot.\n";
 
     std::cout << "[\033[92mVisual Memory Tracer\033[0m] Shutdown successfully.\n";
 
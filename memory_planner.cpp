@@ -0,0 +1,147 @@
+#include "memory_planner.h"
+
+#include <algorithm>
+
+MemoryPlanner::MemoryPlanner(const std::vector<TensorBlock> &blocks, unsigned long alignment) :
+    blocks(blocks), alignment(std::max(alignment, 1ul)) {}
+
+bool MemoryPlanner::overlap(size_t a, size_t b) const {
+    return blocks[a].firstUse < blocks[b].lastUse && blocks[b].firstUse < blocks[a].lastUse;
+}
+
+unsigned long MemoryPlanner::alignedSize(size_t b) const {
+    return ((blocks[b].size + alignment - 1) / alignment) * alignment;
+}
+
+unsigned long MemoryPlanner::peakLiveBytes() const {
+
+    // sweep the lifetime end points, ends before starts at the same time
+    std::vector<std::pair<unsigned long, long> > points;
+    for (auto &block : blocks) {
+        points.push_back(std::make_pair(block.firstUse, (long)block.size));
+        points.push_back(std::make_pair(block.lastUse, -(long)block.size));
+    }
+    std::sort(points.begin(), points.end());
+
+    long live = 0, peak = 0;
+    for (auto &point : points) {
+        live += point.second;
+        peak = std::max(peak, live);
+    }
+    return peak;
+}
+
+unsigned long MemoryPlanner::observedArenaSize() const {
+    if (blocks.empty())
+        return 0;
+    unsigned long low = blocks[0].offset, high = 0;
+    for (auto &block : blocks) {
+        low = std::min(low, block.offset);
+        high = std::max(high, block.offset + block.size);
+    }
+    return high - low;
+}
+
+MemoryPlanner::Plan MemoryPlanner::greedyBySize() const {
+
+    std::vector<size_t> order(blocks.size());
+    for (size_t b=0; b<order.size(); ++b)
+        order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return blocks[a].size > blocks[b].size;
+    });
+
+    Plan plan;
+    plan.name = "greedy by size";
+    plan.offsets.assign(blocks.size(), 0);
+    plan.arenaSize = 0;
+
+    std::vector<size_t> placed;
+    for (size_t b : order) {
+        // blocks already placed which are live at the same time, by offset
+        std::vector<size_t> conflicts;
+        for (size_t p : placed)
+            if (overlap(b, p))
+                conflicts.push_back(p);
+        std::sort(conflicts.begin(), conflicts.end(), [&plan](size_t x, size_t y) {
+            return plan.offsets[x] < plan.offsets[y];
+        });
+
+        // smallest gap the block fits in, otherwise after the last conflict
+        unsigned long size = alignedSize(b);
+        unsigned long gapStart = 0, best = 0, bestGap = ~0ul;
+        for (size_t c : conflicts) {
+            if (plan.offsets[c] >= gapStart + size && plan.offsets[c] - gapStart < bestGap) {
+                best = gapStart;
+                bestGap = plan.offsets[c] - gapStart;
+            }
+            gapStart = std::max(gapStart, plan.offsets[c] + alignedSize(c));
+        }
+        if (bestGap == ~0ul)
+            best = gapStart;
+
+        plan.offsets[b] = best;
+        plan.arenaSize = std::max(plan.arenaSize, best + size);
+        placed.push_back(b);
+    }
+    return plan;
+}
+
+MemoryPlanner::Plan MemoryPlanner::intervalColouring() const {
+
+    std::vector<size_t> order(blocks.size());
+    for (size_t b=0; b<order.size(); ++b)
+        order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return blocks[a].firstUse < blocks[b].firstUse;
+    });
+
+    class Slot {
+    public:
+        unsigned long size;
+        unsigned long freeFrom;
+        std::vector<size_t> blocks;
+    };
+    std::vector<Slot> slots;
+
+    for (size_t b : order) {
+        unsigned long size = alignedSize(b);
+
+        // free slot closest in size, preferring those already big enough
+        int best = -1;
+        for (size_t s=0; s<slots.size(); ++s) {
+            if (slots[s].freeFrom > blocks[b].firstUse)
+                continue;
+            if (best == -1) {
+                best = s;
+                continue;
+            }
+            const Slot &current = slots[best];
+            bool fits = slots[s].size >= size, currentFits = current.size >= size;
+            if ((fits && !currentFits) ||
+                (fits && currentFits && slots[s].size < current.size) ||
+                (!fits && !currentFits && slots[s].size > current.size))
+                best = s;
+        }
+
+        if (best == -1) {
+            slots.push_back(Slot());
+            best = slots.size() - 1;
+            slots[best].size = 0;
+        }
+        slots[best].size = std::max(slots[best].size, size);
+        slots[best].freeFrom = blocks[b].lastUse;
+        slots[best].blocks.push_back(b);
+    }
+
+    Plan plan;
+    plan.name = "interval colouring";
+    plan.offsets.assign(blocks.size(), 0);
+    plan.arenaSize = 0;
+    for (auto &slot : slots) {
+        for (size_t b : slot.blocks)
+            plan.offsets[b] = plan.arenaSize;
+        plan.arenaSize += slot.size;
+    }
+    return plan;
+}
@@ -0,0 +1,53 @@
+#ifndef __MEMORY_PLANNER_H__
+#define __MEMORY_PLANNER_H__
+
+#include <string>
+#include <vector>
+
+#include "tensor_block.h"
+
+/*
+    Offline arena planner for a set of tensor blocks with known lifetimes.
+
+    Two blocks can share memory if their lifetimes don't overlap. The peak
+    number of bytes live at once is a lower bound on any arena, and two
+    heuristics give layouts to compare against it and the observed one:
+
+    Greedy by size places the largest blocks first, each at the smallest
+    gap left between the blocks already placed whose lifetimes overlap it.
+
+    Interval colouring sweeps the blocks in order of first use assigning
+    each to a slot whose previous occupant is dead, preferring the smallest
+    slot it fits, so the slots are colours of the interval graph. The slots
+    are sized by their largest block and laid out one after another.
+*/
+class MemoryPlanner
+{
+public:
+    class Plan {
+    public:
+        std::string name;
+        std::vector<unsigned long> offsets;
+        unsigned long arenaSize;
+    };
+
+    MemoryPlanner(const std::vector<TensorBlock> &blocks, unsigned long alignment = 64);
+
+    // most bytes live at any one time
+    unsigned long peakLiveBytes() const;
+
+    // span from the lowest to the highest address used by the blocks
+    unsigned long observedArenaSize() const;
+
+    Plan greedyBySize() const;
+    Plan intervalColouring() const;
+
+private:
+    bool overlap(size_t a, size_t b) const;
+    unsigned long alignedSize(size_t b) const;
+
+    const std::vector<TensorBlock> &blocks;
+    unsigned long alignment;
+};
+
+#endif  // __MEMORY_PLANNER_H__
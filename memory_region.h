@@ -2,6 +2,12 @@
 #define __MEMORY_REGION_H__
 
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "byte_traffic.h"
 
 class MemoryRegion
 {
@@ -11,6 +17,30 @@ public:
 
     enum CompBlockType : char { Data, Repeat, End };
 
+    static const int maxCacheLevels = 3;
+
+    // simulated cache misses at each level, kept alongside the readings
+    // of a row when the cache simulator is enabled.
+    class MissReading
+    {
+    public:
+        MissReading() : misses{0, 0, 0} {}
+
+        bool empty() const {
+            for (int l=0; l<maxCacheLevels; ++l)
+                if (misses[l] != 0)
+                    return false;
+            return true;
+        }
+
+        void add(const MissReading &b) {
+            for (int l=0; l<maxCacheLevels; ++l)
+                misses[l] = std::min(0xffff, misses[l] + b.misses[l]);
+        }
+
+        unsigned short misses[maxCacheLevels];
+    };
+
     class MemoryReading
     {
     public:
@@ -35,9 +65,10 @@ public:
             stream.write((char*)&r.modCount, sizeof (unsigned short));
             stream.write((char*)&r.firstOp, sizeof (AccessType));
             stream.write((char*)&r.lastOp, sizeof (AccessType));
+            return stream;
         }
 
-        bool operator==(const MemoryReading& b) {
+        bool operator==(const MemoryReading& b) const {
             return (this->loadCount == b.loadCount &&
                     this->storeCount == b.storeCount &&
                     this->modCount == b.modCount &&
@@ -45,10 +76,21 @@ public:
                     this->lastOp == b.lastOp);
         }
 
-        bool operator!=(const MemoryReading& b) {
+        bool operator!=(const MemoryReading& b) const {
             return !(*this == b);
         }
 
+        // merges the reading of a later row into this one
+        void add(const MemoryReading& b) {
+            loadCount = std::min(0xffff, loadCount + b.loadCount);
+            storeCount = std::min(0xffff, storeCount + b.storeCount);
+            modCount = std::min(0xffff, modCount + b.modCount);
+            if (firstOp == None)
+                firstOp = b.firstOp;
+            if (b.lastOp != None)
+                lastOp = b.lastOp;
+        }
+
         unsigned short loadCount, storeCount, modCount;
         AccessType firstOp, lastOp;
     };
@@ -58,8 +100,12 @@ public:
         //std::cout << "MemoryRegion default contstructor.....\n";
         loadCount = 0;
         storeCount = 0;
+        firstRow = 0;
+        retired = false;
+        parent = -1;
         this->resolution = resolution;
         trace.push_back(std::vector<MemoryReading>(resolution));
+        traffic.push_back(ByteTraffic());
     }
     MemoryRegion(std::string name, unsigned long start, unsigned long end, unsigned int resolution = 1000)
     {
@@ -73,8 +119,12 @@ public:
 
         loadCount = 0;
         storeCount = 0;
+        firstRow = 0;
+        retired = false;
+        parent = -1;
         this->resolution = resolution;
         trace.push_back(std::vector<MemoryReading>(resolution));
+        traffic.push_back(ByteTraffic());
     }
 
     MemoryRegion(std::ifstream &in) {
@@ -85,6 +135,9 @@ public:
         in.read((char*)&(this->resolution), sizeof (unsigned int));
         in.read((char*)&(this->loadCount), sizeof (unsigned long));
         in.read((char*)&(this->storeCount), sizeof (unsigned long));
+        firstRow = 0;
+        retired = false;
+        parent = -1;
 
         std::cout << "Reading memory region [" << this->name << "]\n";
 
@@ -93,6 +146,9 @@ public:
         std::cout << "Reading " << size << "lines of memory region.\n";
         for (size_t i = 0; i < size; ++i)
             this->trace.push_back(MemoryRegion::lineFromStream(in));
+
+        // files without a traffic section have no byte counts
+        traffic.assign(trace.size(), ByteTraffic());
     }
 
     friend std::ostream& operator<< (std::ofstream& stream,
@@ -120,6 +176,8 @@ public:
             MemoryRegion::lineToStream(line, stream);
             //std::cout << "Wrote trace (file size " << stream.tellp() << " bytes) line " << c++ << std::endl;
         }
+
+        return stream;
     }
 
     static std::vector<MemoryReading> lineFromStream(std::ifstream &in) {
@@ -150,7 +208,7 @@ public:
         return line;
     }
 
-    static void lineToStream(std::vector<MemoryReading> line, std::ofstream &out) {
+    static void lineToStream(const std::vector<MemoryReading> &line, std::ofstream &out) {
 
         size_t pos = 0;
         size_t blockSize;
@@ -166,8 +224,9 @@ public:
                 else
                     blockSize = 2;
 
+                // up to the next pair of equal readings, which start a repeat
                 while (pos + blockSize < line.size()) {
-                    if (line[pos + blockSize] != line[pos + blockSize + 1])
+                    if (pos + blockSize + 1 == line.size() || line[pos + blockSize] != line[pos + blockSize + 1])
                         ++blockSize;
                     else
                         break;
@@ -182,12 +241,8 @@ public:
             } else {
                 type = Repeat;
                 blockSize = 2;
-                while (pos + blockSize < line.size()) {
-                    if (line[pos + blockSize] == line[pos + blockSize + 1])
-                        ++blockSize;
-                    else
-                        break;
-                }
+                while (pos + blockSize < line.size() && line[pos + blockSize] == line[pos])
+                    ++blockSize;
 
                 //std::cout << "Repeat [" << blockSize << "]\n";
 
@@ -208,15 +263,24 @@ public:
         out.write((char*)&type, sizeof (CompBlockType));
     }
 
-    inline int memAddrToPix(long addr) {
+    inline int memAddrToPix(long addr) const {
         int pixel = ((addr - startAddr) * resolution) / (endAddr - startAddr);
         return pixel;
     }
 
+    // pixels covered by an access, always at least the pixel it starts in
+    // so accesses smaller than a pixel are not lost.
+    inline void pixelRange(unsigned long address, unsigned int size, int &index, int &indexEnd) const {
+        index = ((address - startAddr) * resolution) / (endAddr - startAddr);
+        indexEnd = ((address + size - startAddr) * resolution) / (endAddr - startAddr);
+        index = std::min(std::max(index, 0), (int)resolution - 1);
+        indexEnd = std::min(std::max(indexEnd, index + 1), (int)resolution);
+    }
+
     void addLoad(unsigned long address, unsigned int size)
     {
-        int index = ((address - startAddr) * resolution) / (endAddr - startAddr);
-        int indexEnd = ((address + size - startAddr) * resolution) / (endAddr - startAddr);
+        int index, indexEnd;
+        pixelRange(address, size, index, indexEnd);
 
         for (int a=index; a<indexEnd; ++a) {
             ++trace.back()[a].loadCount;
@@ -224,13 +288,13 @@ public:
                 trace.back()[a].firstOp = Load;
             trace.back()[a].lastOp = Load;
         }
+        traffic.back().loadBytes += size;
     }
 
     void addStore(unsigned long address, unsigned int size)
     {
-
-        int index = ((address - startAddr) * resolution) / (endAddr - startAddr);
-        int indexEnd = ((address + size - startAddr) * resolution) / (endAddr - startAddr);
+        int index, indexEnd;
+        pixelRange(address, size, index, indexEnd);
 
         for (int a=index; a<indexEnd; ++a) {
             ++trace.back()[a].storeCount;
@@ -238,13 +302,13 @@ public:
                 trace.back()[a].firstOp = Store;
             trace.back()[a].lastOp = Store;
         }
+        traffic.back().storeBytes += size;
     }
 
     void addMod(unsigned long address, unsigned int size)
     {
-
-        int index = ((address - startAddr) * resolution) / (endAddr - startAddr);
-        int indexEnd = ((address + size - startAddr) * resolution) / (endAddr - startAddr);
+        int index, indexEnd;
+        pixelRange(address, size, index, indexEnd);
 
         for (int a=index; a<indexEnd; ++a) {
             ++trace.back()[a].modCount;
@@ -252,15 +316,118 @@ public:
                 trace.back()[a].firstOp = Modify;
             trace.back()[a].lastOp = Modify;
         }
+        traffic.back().modBytes += size;
+    }
+
+    // counts a miss at the pixel of the access in each of the first
+    // levelsMissed cache levels.
+    void addMisses(unsigned long address, int levelsMissed)
+    {
+        int index = std::min(std::max(memAddrToPix(address), 0), (int)resolution - 1);
+        MissReading &reading = misses.back()[index];
+        for (int l=0; l<levelsMissed && l<maxCacheLevels; ++l)
+            if (reading.misses[l] < 0xffff)
+                ++reading.misses[l];
+    }
+
+    // starts recording misses, with empty rows for those already stored
+    void trackMisses()
+    {
+        misses.assign(trace.size(), std::vector<MissReading>(resolution));
     }
 
     void storeRow()
     {
         trace.push_back(std::vector<MemoryReading>(resolution));
+        traffic.push_back(ByteTraffic());
+        if (!misses.empty())
+            misses.push_back(std::vector<MissReading>(resolution));
+    }
+
+    // Merges pairs of session rows, 2n and 2n+1, into one in place so the
+    // trace can carry on at twice the instructions per row. A region
+    // starting on an odd session row has its first row on its own.
+    void halveRows()
+    {
+        size_t pairBase = firstRow / 2;
+        size_t rows = 0;
+        for (size_t r=0; r<trace.size(); ++r) {
+            size_t dst = (firstRow + r) / 2 - pairBase;
+            if (dst == rows) {
+                if (dst != r) {
+                    trace[dst].swap(trace[r]);
+                    traffic[dst] = traffic[r];
+                    if (!misses.empty())
+                        misses[dst].swap(misses[r]);
+                }
+                ++rows;
+                continue;
+            }
+            for (unsigned int p=0; p<resolution; ++p)
+                trace[dst][p].add(trace[r][p]);
+            traffic[dst].add(traffic[r]);
+            if (!misses.empty())
+                for (unsigned int p=0; p<resolution; ++p)
+                    misses[dst][p].add(misses[r][p]);
+        }
+        trace.resize(rows);
+        traffic.resize(rows);
+        if (!misses.empty())
+            misses.resize(rows);
+        firstRow = pairBase;
+    }
+
+    // Misses are written sparsely as the pixels of each row with any misses,
+    // most pixels of most rows have none.
+    void missesToStream(std::ostream &out) const
+    {
+        unsigned long rows = misses.size();
+        out.write((char*)&rows, sizeof (rows));
+        for (auto &row : misses) {
+            unsigned int count = 0;
+            for (auto &reading : row)
+                count += !reading.empty();
+            out.write((char*)&count, sizeof (count));
+            for (unsigned int p=0; p<row.size(); ++p)
+                if (!row[p].empty()) {
+                    out.write((char*)&p, sizeof (p));
+                    out.write((char*)row[p].misses, sizeof (row[p].misses));
+                }
+        }
+    }
+
+    void missesFromStream(std::istream &in)
+    {
+        unsigned long rows = 0;
+        in.read((char*)&rows, sizeof (rows));
+        misses.assign(rows, std::vector<MissReading>(resolution));
+        for (auto &row : misses) {
+            unsigned int count = 0;
+            in.read((char*)&count, sizeof (count));
+            for (unsigned int i=0; i<count && in; ++i) {
+                unsigned int p;
+                MissReading reading;
+                in.read((char*)&p, sizeof (p));
+                in.read((char*)reading.misses, sizeof (reading.misses));
+                if (p < row.size())
+                    row[p] = reading;
+            }
+        }
+    }
+
+    // one past the last session row this region has data for
+    size_t lastRow() const {
+        return firstRow + trace.size();
     }
 
     std::vector<std::vector<MemoryReading> > trace;
 
+    // bytes accessed in each trace row
+    std::vector<ByteTraffic> traffic;
+
+    // empty unless misses are being recorded, otherwise one row per trace row
+    std::vector<std::vector<MissReading> > misses;
+
     unsigned long startAddr, endAddr;
     std::string name;
 
@@ -268,6 +435,16 @@ public:
 
     unsigned long loadCount;
     unsigned long storeCount;
+
+    // session row of trace[0], regions registered part way through a
+    // capture start at the row being recorded when they were added.
+    size_t firstRow;
+
+    // retired regions keep their rows but are no longer recorded into
+    bool retired;
+
+    // index of the region this one zooms into, see RegionRefiner, or -1
+    long parent;
 };
 
 #endif  // __MEMORY_REGION_H__
\ No newline at end of file
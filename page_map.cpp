@@ -0,0 +1,180 @@
+#include "page_map.h"
+
+#include <sstream>
+#include <algorithm>
+
+PageMap::PageMap() {
+    enabled = false;
+    maxGapPages = 16;
+    maxRegions = 32;
+    resolution = 1000;
+    outOfRange = 0;
+}
+
+PageMap::~PageMap() {
+    for (auto leaf : top)
+        delete[] leaf;
+}
+
+void PageMap::Page::mark(std::vector<unsigned long> &bits, size_t row) {
+    size_t word = row / 64 - firstWord;
+    if (bits.size() <= word)
+        bits.resize(word + 1, 0);
+    bits[word] |= 1ul << (row % 64);
+}
+
+void PageMap::touch(char type, unsigned long page, size_t row) {
+    unsigned long topIndex = page >> leafBits;
+    if (topIndex >= top.size()) {
+        ++outOfRange;
+        return;
+    }
+    unsigned int *&leaf = top[topIndex];
+    if (leaf == nullptr) {
+        leaf = new unsigned int[1ul << leafBits];
+        std::fill(leaf, leaf + (1ul << leafBits), 0u);
+    }
+
+    // leaves hold one plus the index of the page, zero for untouched pages
+    unsigned int &index = leaf[page & ((1ul << leafBits) - 1)];
+    if (index == 0) {
+        pages.push_back(Page(page, row));
+        index = pages.size();
+    }
+
+    Page &entry = pages[index - 1];
+    if (type == 'L') {
+        ++entry.loads;
+        entry.mark(entry.loadRows, row);
+    } else if (type == 'S') {
+        ++entry.stores;
+        entry.mark(entry.storeRows, row);
+    } else {
+        ++entry.mods;
+        entry.mark(entry.loadRows, row);
+        entry.mark(entry.storeRows, row);
+    }
+}
+
+void PageMap::access(char type, unsigned long addr, unsigned int size, size_t row) {
+    if (top.empty())
+        top.assign(1ul << topBits, nullptr);
+    unsigned long first = addr >> pageBits;
+    unsigned long last = (addr + std::max(size, 1u) - 1) >> pageBits;
+    for (unsigned long page = first; page <= last; ++page)
+        touch(type, page, row);
+}
+
+void PageMap::halveRows() {
+    for (auto &page : pages) {
+        size_t firstWord = page.firstWord / 2;
+        std::vector<unsigned long> *bitmaps[2] = { &page.loadRows, &page.storeRows };
+        for (auto bits : bitmaps) {
+            std::vector<unsigned long> halved;
+            page.forRows(*bits, [&](size_t row) {
+                size_t word = row / 2 / 64 - firstWord;
+                if (halved.size() <= word)
+                    halved.resize(word + 1, 0);
+                halved[word] |= 1ul << (row / 2 % 64);
+            });
+            bits->swap(halved);
+        }
+        page.firstWord = firstWord;
+    }
+}
+
+std::vector<MemoryRegion> PageMap::clusterRegions(size_t rows) {
+
+    std::vector<size_t> order(pages.size());
+    for (size_t p=0; p<order.size(); ++p)
+        order[p] = p;
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return pages[a].number < pages[b].number;
+    });
+
+    // runs of the sorted pages with gaps of at most maxGapPages untouched pages
+    class Cluster {
+    public:
+        size_t first, end;
+        unsigned long accesses;
+    };
+    std::vector<Cluster> clusters;
+    for (size_t i=0; i<order.size(); ++i) {
+        const Page &page = pages[order[i]];
+        if (clusters.empty() || page.number - pages[order[i-1]].number > maxGapPages + 1)
+            clusters.push_back(Cluster{ i, i, 0 });
+        clusters.back().end = i + 1;
+        clusters.back().accesses += page.loads + page.stores + page.mods;
+    }
+
+    std::cout << "[\033[92mVMT\033[0m] Touched " << pages.size() << " pages in " << clusters.size() << " clusters";
+    if (outOfRange > 0)
+        std::cout << ", ignored " << outOfRange << " pages above 2^48";
+    std::cout << ".\n";
+
+    // keep the busiest clusters, in address order
+    if (clusters.size() > maxRegions) {
+        std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) {
+            return a.accesses > b.accesses;
+        });
+        unsigned long dropped = 0;
+        for (size_t c=maxRegions; c<clusters.size(); ++c)
+            dropped += clusters[c].accesses;
+        std::cout << "[\033[92mVMT\033[0m] Keeping the " << maxRegions << " busiest clusters, ignoring "
+                  << clusters.size() - maxRegions << " with " << dropped << " accesses.\n";
+        clusters.resize(maxRegions);
+        std::sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) {
+            return a.first < b.first;
+        });
+    }
+
+    std::vector<MemoryRegion> regions;
+    for (auto &cluster : clusters) {
+        unsigned long start = pages[order[cluster.first]].number << pageBits;
+        unsigned long end = (pages[order[cluster.end - 1]].number + 1) << pageBits;
+        std::ostringstream name;
+        name << "0x" << std::hex << start;
+
+        MemoryRegion region(name.str(), start, end, resolution);
+        region.trace.assign(rows, std::vector<MemoryRegion::MemoryReading>(region.resolution));
+        region.traffic.assign(rows, ByteTraffic());
+
+        for (size_t i=cluster.first; i<cluster.end; ++i) {
+            const Page &page = pages[order[i]];
+            region.loadCount += page.loads;
+            region.storeCount += page.stores;
+            int first, last;
+            region.pixelRange(page.number << pageBits, 1ul << pageBits, first, last);
+
+            page.forRows(page.loadRows, [&](size_t row) {
+                if (row >= rows)
+                    return;
+                for (int p=first; p<last; ++p) {
+                    MemoryRegion::MemoryReading &reading = region.trace[row][p];
+                    if (reading.loadCount < 0xffff)
+                        ++reading.loadCount;
+                    reading.firstOp = MemoryRegion::Load;
+                    if (reading.lastOp == MemoryRegion::None)
+                        reading.lastOp = MemoryRegion::Load;
+                }
+            });
+            page.forRows(page.storeRows, [&](size_t row) {
+                if (row >= rows)
+                    return;
+                for (int p=first; p<last; ++p) {
+                    MemoryRegion::MemoryReading &reading = region.trace[row][p];
+                    if (reading.storeCount < 0xffff)
+                        ++reading.storeCount;
+                    if (reading.firstOp == MemoryRegion::None)
+                        reading.firstOp = MemoryRegion::Store;
+                    reading.lastOp = MemoryRegion::Store;
+                }
+            });
+        }
+
+        std::cout << "[\033[92mVMT\033[0m] Found region [" << region.name << "] " << (end - start) / 1024 << " KB, "
+                  << cluster.end - cluster.first << " pages touched, " << cluster.accesses << " accesses.\n";
+        regions.push_back(region);
+    }
+    return regions;
+}
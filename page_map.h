@@ -0,0 +1,84 @@
+#ifndef __PAGE_MAP_H__
+#define __PAGE_MAP_H__
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "memory_region.h"
+
+/*
+    Sparse page map of every access made by a process, for capturing
+    unmodified programs which register no regions of their own.
+
+    Pages are found through a two level radix table keyed by page number,
+    the top level holding a pointer to a leaf for every 2^16 pages and each
+    leaf the index of every touched page it covers in a dense list of
+    pages. Leaves are only allocated once a page within them is touched so
+    memory grows with the pages touched, apart from the 8 MB top level.
+    Each page keeps its access counts and a bitmap of the rows it was
+    loaded in and another of the rows it was stored in, starting at the
+    first row it was touched.
+
+    When the capture ends the touched pages are clustered into regions,
+    pages with at most maxGapPages untouched pages between them joining
+    the same region, and each region is given a row for every row of the
+    trace, with every pixel holding the number of its pages loaded and
+    stored in that row.
+*/
+class PageMap
+{
+public:
+    static const int pageBits = 12;
+    static const int leafBits = 16;
+    static const int topBits = 48 - pageBits - leafBits;
+
+    PageMap();
+    ~PageMap();
+
+    // records an access of type 'L', 'S' or 'M' made during the given row
+    void access(char type, unsigned long addr, unsigned int size, size_t row);
+
+    // merges pairs of rows in every page's bitmaps, see TraceSession::coarsenRows
+    void halveRows();
+
+    // Clusters the touched pages into regions with rows rows each, keeping
+    // the maxRegions with the most accesses, and reports them.
+    std::vector<MemoryRegion> clusterRegions(size_t rows);
+
+    size_t pagesTouched() const { return pages.size(); }
+
+    bool enabled;
+    unsigned long maxGapPages;
+    unsigned int maxRegions;
+    unsigned int resolution;
+
+private:
+    class Page {
+    public:
+        Page(unsigned long number, size_t row) : number(number), loads(0), stores(0), mods(0), firstWord(row / 64) {}
+
+        void mark(std::vector<unsigned long> &bits, size_t row);
+
+        // calls f(row) for every row marked in bits
+        template <class F>
+        void forRows(const std::vector<unsigned long> &bits, F f) const {
+            for (size_t w=0; w<bits.size(); ++w)
+                for (unsigned long word = bits[w]; word != 0; word &= word - 1)
+                    f((firstWord + w) * 64 + __builtin_ctzl(word));
+        }
+
+        unsigned long number;
+        unsigned long loads, stores, mods;
+        size_t firstWord;
+        std::vector<unsigned long> loadRows, storeRows;
+    };
+
+    void touch(char type, unsigned long page, size_t row);
+
+    std::vector<unsigned int*> top;
+    std::vector<Page> pages;
+    unsigned long outOfRange;
+};
+
+#endif  // __PAGE_MAP_H__
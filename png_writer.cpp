@@ -0,0 +1,138 @@
+#include "png_writer.h"
+
+#include <iostream>
+#include <cstring>
+
+static const size_t idatChunkSize = 64 * 1024;
+
+static void putUInt32BE(unsigned char *dst, unsigned int value) {
+    dst[0] = (value >> 24) & 0xFF;
+    dst[1] = (value >> 16) & 0xFF;
+    dst[2] = (value >> 8) & 0xFF;
+    dst[3] = value & 0xFF;
+}
+
+PngWriter::PngWriter(std::ostream &out, int width, int height, int compressionLevel) : out(out) {
+    this->width = width;
+    this->height = height;
+    rowsWritten = 0;
+    finished = false;
+    ok = true;
+
+    // every row is stored with the 'Up' filter, the first row has an
+    // all zero previous row so it is effectively unfiltered.
+    filtered.resize(1 + width * 3);
+    previous.assign(width * 3, 0);
+    idatBuffer.resize(idatChunkSize);
+
+    std::memset(&zStream, 0, sizeof (z_stream));
+    if (deflateInit(&zStream, compressionLevel) != Z_OK) {
+        std::cerr << "[\033[92mVMT\033[0m] Error: Failed to initialise zlib deflate stream.\n";
+        ok = false;
+    }
+    zStream.next_out = idatBuffer.data();
+    zStream.avail_out = idatBuffer.size();
+
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.write((char*)signature, 8);
+
+    unsigned char ihdr[13];
+    putUInt32BE(ihdr, width);
+    putUInt32BE(ihdr + 4, height);
+    ihdr[8] = 8;   // bit depth
+    ihdr[9] = 2;   // colour type RGB
+    ihdr[10] = 0;  // deflate compression
+    ihdr[11] = 0;  // adaptive filtering
+    ihdr[12] = 0;  // no interlace
+    writeChunk("IHDR", ihdr, 13);
+}
+
+PngWriter::~PngWriter() {
+    if (!finished)
+        finish();
+}
+
+void PngWriter::writeChunk(const char *type, const unsigned char *data, unsigned int length) {
+    unsigned char header[8];
+    putUInt32BE(header, length);
+    std::memcpy(header + 4, type, 4);
+    out.write((char*)header, 8);
+    if (length > 0)
+        out.write((char*)data, length);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (const Bytef*)type, 4);
+    if (length > 0)
+        crc = crc32(crc, data, length);
+    unsigned char crcBytes[4];
+    putUInt32BE(crcBytes, crc);
+    out.write((char*)crcBytes, 4);
+}
+
+void PngWriter::deflateRow(int flush) {
+    int result;
+    do {
+        result = deflate(&zStream, flush);
+        if (result == Z_STREAM_ERROR) {
+            ok = false;
+            return;
+        }
+
+        // emit a full IDAT chunk whenever the output buffer fills
+        if (zStream.avail_out == 0) {
+            writeChunk("IDAT", idatBuffer.data(), idatBuffer.size());
+            zStream.next_out = idatBuffer.data();
+            zStream.avail_out = idatBuffer.size();
+        }
+    } while (zStream.avail_in > 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+}
+
+void PngWriter::writeRow(const unsigned char *rgb) {
+    if (finished || !ok)
+        return;
+    if (rowsWritten == height) {
+        std::cerr << "[\033[92mVMT\033[0m] Error: Too many rows written to png stream.\n";
+        ok = false;
+        return;
+    }
+
+    filtered[0] = 2;
+    for (int i=0; i<width*3; ++i)
+        filtered[i + 1] = rgb[i] - previous[i];
+    std::memcpy(previous.data(), rgb, width * 3);
+
+    zStream.next_in = filtered.data();
+    zStream.avail_in = filtered.size();
+    deflateRow(Z_NO_FLUSH);
+    ++rowsWritten;
+}
+
+void PngWriter::finish() {
+    if (finished)
+        return;
+    finished = true;
+
+    // pad any rows that were never written so the file remains valid
+    if (rowsWritten < height) {
+        std::cerr << "[\033[92mVMT\033[0m] Warning: png stream finished after ";
+        std::cerr << rowsWritten << " of " << height << " rows.\n";
+        std::vector<unsigned char> blank(width * 3, 255);
+        while (ok && rowsWritten < height) {
+            finished = false;
+            writeRow(blank.data());
+            finished = true;
+        }
+    }
+
+    zStream.next_in = Z_NULL;
+    zStream.avail_in = 0;
+    deflateRow(Z_FINISH);
+
+    size_t remaining = idatBuffer.size() - zStream.avail_out;
+    if (remaining > 0)
+        writeChunk("IDAT", idatBuffer.data(), remaining);
+    deflateEnd(&zStream);
+
+    writeChunk("IEND", nullptr, 0);
+    out.flush();
+}
@@ -0,0 +1,48 @@
+#ifndef __PNG_WRITER_H__
+#define __PNG_WRITER_H__
+
+#include <ostream>
+#include <vector>
+#include <zlib.h>
+
+/*
+    Row streaming PNG encoder.
+
+    Writes an 8 bit RGB PNG to the given stream one row at a time. Each row
+    is filtered and pushed straight into the zlib deflate stream, IDAT chunks
+    are emitted whenever the compressed buffer fills, so only a single row of
+    the image ever needs to exist in memory.
+*/
+class PngWriter
+{
+public:
+    PngWriter(std::ostream &out, int width, int height, int compressionLevel = 6);
+
+    ~PngWriter();
+
+    // rgb must point to width * 3 bytes
+    void writeRow(const unsigned char *rgb);
+
+    // flushes the deflate stream and writes the IEND chunk, called
+    // automatically by the destructor if not called before.
+    void finish();
+
+    bool good() { return ok && out.good(); }
+
+    int width, height;
+
+private:
+    void writeChunk(const char *type, const unsigned char *data, unsigned int length);
+    void deflateRow(int flush);
+
+    std::ostream &out;
+    z_stream zStream;
+    std::vector<unsigned char> filtered;
+    std::vector<unsigned char> previous;
+    std::vector<unsigned char> idatBuffer;
+    int rowsWritten;
+    bool finished;
+    bool ok;
+};
+
+#endif  // __PNG_WRITER_H__
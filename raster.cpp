@@ -0,0 +1,441 @@
+#include "raster.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#ifndef VMT_USE_OPENCV
+#include "png_writer.h"
+#endif
+
+namespace raster {
+
+#ifndef VMT_USE_OPENCV
+
+// Classic 5x7 bitmap font covering printable ASCII (0x20 - 0x7E). Each glyph
+// is five columns, least significant bit at the top, bit 7 is the descender.
+static const unsigned char font5x7[95][5] = {
+    {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5F,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7F,0x14,0x7F,0x14},
+    {0x24,0x2A,0x7F,0x2A,0x12}, {0x23,0x13,0x08,0x64,0x62}, {0x36,0x49,0x56,0x20,0x50}, {0x00,0x08,0x07,0x03,0x00},
+    {0x00,0x1C,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1C,0x00}, {0x2A,0x1C,0x7F,0x1C,0x2A}, {0x08,0x08,0x3E,0x08,0x08},
+    {0x00,0x80,0x70,0x30,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x00,0x60,0x60,0x00}, {0x20,0x10,0x08,0x04,0x02},
+    {0x3E,0x51,0x49,0x45,0x3E}, {0x00,0x42,0x7F,0x40,0x00}, {0x72,0x49,0x49,0x49,0x46}, {0x21,0x41,0x49,0x4D,0x33},
+    {0x18,0x14,0x12,0x7F,0x10}, {0x27,0x45,0x45,0x45,0x39}, {0x3C,0x4A,0x49,0x49,0x31}, {0x41,0x21,0x11,0x09,0x07},
+    {0x36,0x49,0x49,0x49,0x36}, {0x46,0x49,0x49,0x29,0x1E}, {0x00,0x00,0x14,0x00,0x00}, {0x00,0x40,0x34,0x00,0x00},
+    {0x00,0x08,0x14,0x22,0x41}, {0x14,0x14,0x14,0x14,0x14}, {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x59,0x09,0x06},
+    {0x3E,0x41,0x5D,0x59,0x4E}, {0x7C,0x12,0x11,0x12,0x7C}, {0x7F,0x49,0x49,0x49,0x36}, {0x3E,0x41,0x41,0x41,0x22},
+    {0x7F,0x41,0x41,0x41,0x3E}, {0x7F,0x49,0x49,0x49,0x41}, {0x7F,0x09,0x09,0x09,0x01}, {0x3E,0x41,0x41,0x51,0x73},
+    {0x7F,0x08,0x08,0x08,0x7F}, {0x00,0x41,0x7F,0x41,0x00}, {0x20,0x40,0x41,0x3F,0x01}, {0x7F,0x08,0x14,0x22,0x41},
+    {0x7F,0x40,0x40,0x40,0x40}, {0x7F,0x02,0x1C,0x02,0x7F}, {0x7F,0x04,0x08,0x10,0x7F}, {0x3E,0x41,0x41,0x41,0x3E},
+    {0x7F,0x09,0x09,0x09,0x06}, {0x3E,0x41,0x51,0x21,0x5E}, {0x7F,0x09,0x19,0x29,0x46}, {0x26,0x49,0x49,0x49,0x32},
+    {0x03,0x01,0x7F,0x01,0x03}, {0x3F,0x40,0x40,0x40,0x3F}, {0x1F,0x20,0x40,0x20,0x1F}, {0x3F,0x40,0x38,0x40,0x3F},
+    {0x63,0x14,0x08,0x14,0x63}, {0x03,0x04,0x78,0x04,0x03}, {0x61,0x59,0x49,0x4D,0x43}, {0x00,0x7F,0x41,0x41,0x41},
+    {0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x41,0x7F}, {0x04,0x02,0x01,0x02,0x04}, {0x40,0x40,0x40,0x40,0x40},
+    {0x00,0x03,0x07,0x08,0x00}, {0x20,0x54,0x54,0x78,0x40}, {0x7F,0x28,0x44,0x44,0x38}, {0x38,0x44,0x44,0x44,0x28},
+    {0x38,0x44,0x44,0x28,0x7F}, {0x38,0x54,0x54,0x54,0x18}, {0x00,0x08,0x7E,0x09,0x02}, {0x18,0xA4,0xA4,0x9C,0x78},
+    {0x7F,0x08,0x04,0x04,0x78}, {0x00,0x44,0x7D,0x40,0x00}, {0x20,0x40,0x40,0x3D,0x00}, {0x7F,0x10,0x28,0x44,0x00},
+    {0x00,0x41,0x7F,0x40,0x00}, {0x7C,0x04,0x78,0x04,0x78}, {0x7C,0x08,0x04,0x04,0x78}, {0x38,0x44,0x44,0x44,0x38},
+    {0xFC,0x18,0x24,0x24,0x18}, {0x18,0x24,0x24,0x18,0xFC}, {0x7C,0x08,0x04,0x04,0x08}, {0x48,0x54,0x54,0x54,0x24},
+    {0x04,0x04,0x3F,0x44,0x24}, {0x3C,0x40,0x40,0x20,0x7C}, {0x1C,0x20,0x40,0x20,0x1C}, {0x3C,0x40,0x30,0x40,0x3C},
+    {0x44,0x28,0x10,0x28,0x44}, {0x4C,0x90,0x90,0x90,0x7C}, {0x44,0x64,0x54,0x4C,0x44}, {0x00,0x08,0x36,0x41,0x00},
+    {0x00,0x00,0x77,0x00,0x00}, {0x00,0x41,0x36,0x08,0x00}, {0x02,0x01,0x02,0x04,0x02}
+};
+
+static const int glyphWidth = 5;
+static const int glyphAdvance = 6;
+static const int glyphCapHeight = 7;
+static const int glyphHeight = 8;
+
+// font scales are chosen to approximately match the size of OpenCV's
+// hershey fonts at the same scale.
+static int glyphPixelSize(double scale) {
+    return std::max(1, (int)(scale * 3.0 + 0.5));
+}
+
+static const unsigned char *glyph(char c) {
+    if (c < 0x20 || c > 0x7E)
+        c = '?';
+    return font5x7[c - 0x20];
+}
+
+static void fillSpan(unsigned char *row, int x0, int x1, int clipLeft, int clipRight, const Color &color) {
+    x0 = std::max(x0, clipLeft);
+    x1 = std::min(x1, clipRight - 1);
+    for (int x=x0; x<=x1; ++x)
+        setPixel(row + x*3, color);
+}
+
+class LinePrimitive : public Canvas::Primitive {
+public:
+    LinePrimitive(Point a, Point b, Color color, int thickness) : a(a), b(b), color(color) {
+        half = std::max(thickness, 1) / 2;
+    }
+
+    void drawRow(int y, unsigned char *row) {
+        int minY = std::min(a.y, b.y);
+        int maxY = std::max(a.y, b.y);
+
+        if (a.y == b.y) {
+            fillSpan(row, std::min(a.x, b.x) - half, std::max(a.x, b.x) + half,
+                     clipLeft, clipRight, color);
+            return;
+        }
+
+        // union of the spans of the ideal line over the rows within
+        // the line thickness of this one
+        int x0 = 1 << 30, x1 = -(1 << 30);
+        float dx = b.x - a.x;
+        float dy = b.y - a.y;
+        for (int yy = std::max(y - half, minY); yy <= std::min(y + half, maxY); ++yy) {
+            float t0 = std::min(1.0f, std::max(0.0f, (yy - 0.5f - a.y) / dy));
+            float t1 = std::min(1.0f, std::max(0.0f, (yy + 0.5f - a.y) / dy));
+            int xa = (int)std::floor(a.x + t0 * dx + 0.5f);
+            int xb = (int)std::floor(a.x + t1 * dx + 0.5f);
+            x0 = std::min(x0, std::min(xa, xb));
+            x1 = std::max(x1, std::max(xa, xb));
+        }
+        fillSpan(row, x0 - half, x1 + half, clipLeft, clipRight, color);
+    }
+
+    Point a, b;
+    Color color;
+    int half;
+};
+
+class FillPrimitive : public Canvas::Primitive {
+public:
+    FillPrimitive(int left, int right, Color color, float alpha = 1.0)
+        : left(left), right(right), color(color), alpha(alpha) {}
+
+    void drawRow(int y, unsigned char *row) {
+        if (alpha >= 1.0) {
+            fillSpan(row, left, right, clipLeft, clipRight, color);
+            return;
+        }
+        int x0 = std::max(left, clipLeft);
+        int x1 = std::min(right, clipRight - 1);
+        for (int x=x0; x<=x1; ++x)
+            blendPixel(row + x*3, color, alpha);
+    }
+
+    int left, right;
+    Color color;
+    float alpha;
+};
+
+class TextPrimitive : public Canvas::Primitive {
+public:
+    TextPrimitive(const std::string &text, Point topLeft, int pixel, Color color, bool vertical)
+        : text(text), topLeft(topLeft), pixel(pixel), color(color), vertical(vertical) {
+        textWidth = text.length() * glyphAdvance * pixel;
+    }
+
+    void drawRow(int y, unsigned char *row) {
+        if (!vertical) {
+            int gy = (y - topLeft.y) / pixel;
+            for (size_t i=0; i<text.length(); ++i) {
+                const unsigned char *g = glyph(text[i]);
+                for (int col=0; col<glyphWidth; ++col)
+                    if ((g[col] >> gy) & 1) {
+                        int x = topLeft.x + (i * glyphAdvance + col) * pixel;
+                        fillSpan(row, x, x + pixel - 1, clipLeft, clipRight, color);
+                    }
+            }
+        } else {
+            // rotated 90 degrees anticlockwise, the first character is at the bottom
+            int u = textWidth - 1 - (y - topLeft.y);
+            int charIdx = u / (glyphAdvance * pixel);
+            int col = (u % (glyphAdvance * pixel)) / pixel;
+            if (col >= glyphWidth || charIdx >= (int)text.length())
+                return;
+            const unsigned char *g = glyph(text[charIdx]);
+            for (int gy=0; gy<glyphHeight; ++gy)
+                if ((g[col] >> gy) & 1) {
+                    int x = topLeft.x + gy * pixel;
+                    fillSpan(row, x, x + pixel - 1, clipLeft, clipRight, color);
+                }
+        }
+    }
+
+    std::string text;
+    Point topLeft;
+    int pixel;
+    Color color;
+    bool vertical;
+    int textWidth;
+};
+
+class LayerPrimitive : public Canvas::Primitive {
+public:
+    LayerPrimitive(Rect r, RowFunction function) : r(r), function(function) {}
+
+    void drawRow(int y, unsigned char *row) {
+        if (r.x >= clipLeft && r.x + r.width <= clipRight) {
+            function(y - r.y, row + r.x*3);
+            return;
+        }
+
+        // layer is partially clipped, render through a scratch row
+        scratch.assign(r.width * 3, 255);
+        int x0 = std::max(r.x, clipLeft);
+        int x1 = std::min(r.x + r.width, clipRight);
+        for (int x=x0; x<x1; ++x)
+            for (int c=0; c<3; ++c)
+                scratch[(x - r.x)*3 + c] = row[x*3 + c];
+        function(y - r.y, scratch.data());
+        for (int x=x0; x<x1; ++x)
+            for (int c=0; c<3; ++c)
+                row[x*3 + c] = scratch[(x - r.x)*3 + c];
+    }
+
+    Rect r;
+    RowFunction function;
+    std::vector<unsigned char> scratch;
+};
+
+Size getTextSize(const std::string &text,
+                 int face,
+                 double scale,
+                 int thickness,
+                 int *baseline) {
+    int pixel = glyphPixelSize(scale);
+    if (baseline)
+        *baseline = pixel;
+    int width = text.length() * glyphAdvance * pixel;
+    if (width > 0)
+        width -= pixel;
+    return Size(width, glyphCapHeight * pixel);
+}
+
+Canvas::Canvas(Size size, Color background) {
+    list = std::make_shared<DisplayList>();
+    list->size = size;
+    list->background = background;
+    clip = Rect(0, 0, size.width, size.height);
+    rows = size.height;
+    cols = size.width;
+}
+
+Canvas Canvas::operator()(Rect r) const {
+    Canvas view(*this);
+    int left = std::max(clip.x, clip.x + r.x);
+    int top = std::max(clip.y, clip.y + r.y);
+    int right = std::min(clip.x + clip.width, clip.x + r.x + r.width);
+    int bottom = std::min(clip.y + clip.height, clip.y + r.y + r.height);
+    view.clip = Rect(left, top, std::max(0, right - left), std::max(0, bottom - top));
+    view.rows = r.height;
+    view.cols = r.width;
+    return view;
+}
+
+void Canvas::add(Primitive *p, int top, int bottom) {
+    p->top = std::max(top, clip.y);
+    p->bottom = std::min(bottom, clip.y + clip.height - 1);
+    p->clipLeft = clip.x;
+    p->clipRight = clip.x + clip.width;
+
+    if (p->top > p->bottom || clip.width <= 0) {
+        delete p;
+        return;
+    }
+    list->primitives.push_back(std::unique_ptr<Primitive>(p));
+}
+
+void Canvas::line(Point a, Point b, Color color, int thickness) {
+    Point origin(clip.x, clip.y);
+    LinePrimitive *p = new LinePrimitive(a + origin, b + origin, color, thickness);
+    add(p, std::min(p->a.y, p->b.y) - p->half, std::max(p->a.y, p->b.y) + p->half);
+}
+
+void Canvas::rectangle(Point a, Point b, Color color, int thickness) {
+    if (thickness == FILLED) {
+        int left = std::min(a.x, b.x) + clip.x;
+        int right = std::max(a.x, b.x) + clip.x;
+        add(new FillPrimitive(left, right, color),
+            std::min(a.y, b.y) + clip.y,
+            std::max(a.y, b.y) + clip.y);
+        return;
+    }
+
+    line(a, Point(b.x, a.y), color, thickness);
+    line(Point(b.x, a.y), b, color, thickness);
+    line(b, Point(a.x, b.y), color, thickness);
+    line(Point(a.x, b.y), a, color, thickness);
+}
+
+void Canvas::blendRect(Rect r, Color fill, float alpha) {
+    if (r.width <= 0 || r.height <= 0)
+        return;
+    add(new FillPrimitive(r.x + clip.x, r.x + r.width - 1 + clip.x, fill, alpha),
+        r.y + clip.y,
+        r.y + r.height - 1 + clip.y);
+}
+
+void Canvas::putText(const std::string &text,
+                     Point origin,
+                     int face,
+                     double scale,
+                     Color color,
+                     int thickness) {
+    int pixel = glyphPixelSize(scale);
+    Point topLeft(origin.x + clip.x, origin.y + clip.y - glyphCapHeight * pixel);
+    add(new TextPrimitive(text, topLeft, pixel, color, false),
+        topLeft.y,
+        topLeft.y + glyphHeight * pixel - 1);
+}
+
+void Canvas::putTextVertical(const std::string &text,
+                             Point topLeft,
+                             int face,
+                             double scale,
+                             Color color,
+                             int thickness) {
+    int pixel = glyphPixelSize(scale);
+    Point pos(topLeft.x + clip.x, topLeft.y + clip.y);
+    TextPrimitive *p = new TextPrimitive(text, pos, pixel, color, true);
+    add(p, pos.y, pos.y + p->textWidth - 1);
+}
+
+void Canvas::rowLayer(Rect r, RowFunction function) {
+    if (r.width <= 0 || r.height <= 0)
+        return;
+    Rect canvasRect(r.x + clip.x, r.y + clip.y, r.width, r.height);
+    add(new LayerPrimitive(canvasRect, function),
+        canvasRect.y,
+        canvasRect.y + canvasRect.height - 1);
+}
+
+bool Canvas::save(const std::string &filename) {
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "[\033[92mVMT\033[0m] Error: Could not open \"" << filename << "\" to write image.\n";
+        return false;
+    }
+
+    int width = list->size.width;
+    int height = list->size.height;
+    std::vector<std::unique_ptr<Primitive> > &primitives = list->primitives;
+
+    // order primitives by their first row, the active set is kept in
+    // insertion order so primitives are still painted back to front.
+    std::vector<size_t> byTop(primitives.size());
+    for (size_t i=0; i<byTop.size(); ++i)
+        byTop[i] = i;
+    std::stable_sort(byTop.begin(), byTop.end(), [&](size_t a, size_t b) {
+        return primitives[a]->top < primitives[b]->top;
+    });
+
+    PngWriter png(file, width, height);
+    std::vector<unsigned char> row(width * 3);
+    std::vector<unsigned char> rgb(width * 3);
+    std::vector<size_t> active;
+    size_t next = 0;
+
+    for (int y=0; y<height; ++y) {
+        while (next < byTop.size() && primitives[byTop[next]]->top <= y) {
+            active.insert(std::lower_bound(active.begin(), active.end(), byTop[next]), byTop[next]);
+            ++next;
+        }
+
+        for (int x=0; x<width; ++x)
+            setPixel(&row[x*3], list->background);
+
+        size_t kept = 0;
+        for (size_t a=0; a<active.size(); ++a) {
+            Primitive *p = primitives[active[a]].get();
+            if (p->bottom < y)
+                continue;
+            p->drawRow(y, row.data());
+            active[kept++] = active[a];
+        }
+        active.resize(kept);
+
+        for (int x=0; x<width; ++x) {
+            rgb[x*3] = row[x*3 + 2];
+            rgb[x*3 + 1] = row[x*3 + 1];
+            rgb[x*3 + 2] = row[x*3];
+        }
+        png.writeRow(rgb.data());
+    }
+    png.finish();
+
+    return png.good();
+}
+
+#else  // VMT_USE_OPENCV
+
+Size getTextSize(const std::string &text,
+                 int face,
+                 double scale,
+                 int thickness,
+                 int *baseline) {
+    return cv::getTextSize(text, cv::FONT_HERSHEY_TRIPLEX, scale, thickness, baseline);
+}
+
+Canvas::Canvas(Size size, Color background) {
+    mat = cv::Mat(size, CV_8UC3, background);
+    rows = mat.rows;
+    cols = mat.cols;
+}
+
+Canvas Canvas::operator()(Rect r) const {
+    return Canvas(mat(r));
+}
+
+void Canvas::line(Point a, Point b, Color color, int thickness) {
+    cv::line(mat, a, b, color, thickness);
+}
+
+void Canvas::rectangle(Point a, Point b, Color color, int thickness) {
+    cv::rectangle(mat, a, b, color, thickness == FILLED ? CV_FILLED : thickness);
+}
+
+void Canvas::blendRect(Rect r, Color fill, float alpha) {
+    r &= Rect(0, 0, mat.cols, mat.rows);
+    if (r.width <= 0 || r.height <= 0)
+        return;
+    cv::Mat target = mat(r);
+    cv::Mat canvas(r.size(), CV_8UC3, fill);
+    cv::addWeighted(target, 1.0 - alpha, canvas, alpha, 0, target);
+}
+
+void Canvas::putText(const std::string &text,
+                     Point origin,
+                     int face,
+                     double scale,
+                     Color color,
+                     int thickness) {
+    cv::putText(mat, text, origin, cv::FONT_HERSHEY_TRIPLEX, scale, color, thickness);
+}
+
+void Canvas::putTextVertical(const std::string &text,
+                             Point topLeft,
+                             int face,
+                             double scale,
+                             Color color,
+                             int thickness) {
+    int baseline;
+    cv::Size textSize = cv::getTextSize(text, cv::FONT_HERSHEY_TRIPLEX, scale, thickness, &baseline);
+    cv::Mat textMat(textSize, CV_8UC3, cv::Scalar(255, 255, 255));
+    cv::putText(textMat, text, cv::Point(0, textMat.rows-1),
+                cv::FONT_HERSHEY_TRIPLEX, scale, color, thickness);
+
+    cv::Mat textRot(textSize.height, textSize.width, CV_8UC3);
+    cv::transpose(textMat, textRot);
+    cv::flip(textRot, textRot, 0);
+    textRot.copyTo(mat(cv::Rect(topLeft.x, topLeft.y, textRot.cols, textRot.rows)));
+}
+
+void Canvas::rowLayer(Rect r, RowFunction function) {
+    for (int row=0; row<r.height; ++row)
+        function(row, mat.ptr<unsigned char>(r.y + row) + r.x*3);
+}
+
+bool Canvas::save(const std::string &filename) {
+    return cv::imwrite(filename, mat);
+}
+
+#endif  // VMT_USE_OPENCV
+};
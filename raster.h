@@ -0,0 +1,171 @@
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+/*
+    Minimal raster drawing backend used by TraceImage.
+
+    Provides the handful of primitives the trace plots need (lines, filled and
+    outlined rectangles, alpha blended rectangles, text and per row layers)
+    behind a cv::Mat like interface.
+
+    By default primitives are recorded into a display list and the image is
+    produced by a single top to bottom scanline sweep, each finished row being
+    handed directly to the streaming PngWriter. The full image is never held
+    in memory. Building with VMT_USE_OPENCV instead draws immediately into a
+    cv::Mat and saves with cv::imwrite.
+
+    All colours are given in blue, green, red order to match OpenCV.
+*/
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#ifdef VMT_USE_OPENCV
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#endif
+
+namespace raster {
+
+    enum { FILLED = -1 };
+
+    enum FontFace { FONT_TRIPLEX = 0 };
+
+#ifdef VMT_USE_OPENCV
+    typedef cv::Point Point;
+    typedef cv::Size Size;
+    typedef cv::Rect Rect;
+    typedef cv::Scalar Color;
+#else
+    class Point {
+    public:
+        Point() : x(0), y(0) {}
+        Point(int x, int y) : x(x), y(y) {}
+
+        Point operator+(const Point &b) const { return Point(x + b.x, y + b.y); }
+        Point operator-(const Point &b) const { return Point(x - b.x, y - b.y); }
+
+        int x, y;
+    };
+
+    class Size {
+    public:
+        Size() : width(0), height(0) {}
+        Size(int width, int height) : width(width), height(height) {}
+
+        int width, height;
+    };
+
+    class Rect {
+    public:
+        Rect() : x(0), y(0), width(0), height(0) {}
+        Rect(int x, int y, int width, int height) : x(x), y(y), width(width), height(height) {}
+
+        int x, y, width, height;
+    };
+
+    class Color {
+    public:
+        Color(int b = 0, int g = 0, int r = 0) {
+            val[0] = b; val[1] = g; val[2] = r;
+        }
+
+        unsigned char val[3];
+    };
+#endif
+
+    /*
+        Called once for each row of a layer, top to bottom. pixels points to
+        the first pixel of the layer's rectangle in that row (BGR, 3 bytes per
+        pixel) and already holds everything drawn beneath the layer.
+    */
+    typedef std::function<void(int row, unsigned char *pixels)> RowFunction;
+
+    inline void setPixel(unsigned char *pixel, const Color &color) {
+        pixel[0] = color.val[0];
+        pixel[1] = color.val[1];
+        pixel[2] = color.val[2];
+    }
+
+    inline void blendPixel(unsigned char *pixel, const Color &color, float alpha) {
+        for (int c=0; c<3; ++c)
+            pixel[c] = (unsigned char)(pixel[c] * (1.0f - alpha) + color.val[c] * alpha + 0.5f);
+    }
+
+    // size of the given text in pixels, matching cv::getTextSize
+    Size getTextSize(const std::string &text,
+                     int face,
+                     double scale,
+                     int thickness,
+                     int *baseline);
+
+    class Canvas {
+    public:
+        Canvas(Size size, Color background = Color(255, 255, 255));
+
+        // returns a view onto a sub-rectangle of this canvas, drawing
+        // through the view is offset and clipped to the rectangle.
+        Canvas operator()(Rect r) const;
+
+        void line(Point a, Point b, Color color, int thickness = 1);
+
+        void rectangle(Point a, Point b, Color color, int thickness = 1);
+
+        void blendRect(Rect r, Color fill, float alpha);
+
+        void putText(const std::string &text,
+                     Point origin,
+                     int face,
+                     double scale,
+                     Color color,
+                     int thickness = 1);
+
+        // draws text rotated 90 degrees anticlockwise, reading bottom to top,
+        // with the top left of its bounding box at topLeft.
+        void putTextVertical(const std::string &text,
+                             Point topLeft,
+                             int face,
+                             double scale,
+                             Color color,
+                             int thickness = 1);
+
+        void rowLayer(Rect r, RowFunction function);
+
+        bool save(const std::string &filename);
+
+        int rows, cols;
+
+#ifndef VMT_USE_OPENCV
+        class Primitive {
+        public:
+            virtual ~Primitive() {}
+            virtual void drawRow(int y, unsigned char *row) = 0;
+
+            int top, bottom;   // canvas rows covered, inclusive
+            int clipLeft, clipRight;  // canvas columns, right exclusive
+        };
+
+    private:
+        class DisplayList {
+        public:
+            Size size;
+            Color background;
+            std::vector<std::unique_ptr<Primitive> > primitives;
+        };
+
+        void add(Primitive *p, int top, int bottom);
+
+        std::shared_ptr<DisplayList> list;
+        Rect clip;
+#else
+    private:
+        Canvas(cv::Mat mat) : mat(mat), rows(mat.rows), cols(mat.cols) {}
+
+        cv::Mat mat;
+#endif
+    };
+};
+
+#endif  // __RASTER_H__
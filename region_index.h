@@ -0,0 +1,63 @@
+#ifndef __REGION_INDEX_H__
+#define __REGION_INDEX_H__
+
+#include <vector>
+#include <algorithm>
+
+#include "memory_region.h"
+
+/*
+    Address lookup over the live memory regions.
+
+    Intervals are kept sorted by start address along with the running maximum
+    end address, so the regions containing an address are found with a binary
+    search and a short backwards scan which stops as soon as no earlier
+    interval can reach the address. Overlapping regions are all reported.
+*/
+class RegionIndex
+{
+public:
+    void build(const std::vector<MemoryRegion> &regions) {
+        intervals.clear();
+        for (size_t r=0; r<regions.size(); ++r)
+            if (!regions[r].retired)
+                intervals.push_back(Interval(regions[r].startAddr, regions[r].endAddr, r));
+        std::sort(intervals.begin(), intervals.end(),
+                  [](const Interval &a, const Interval &b) { return a.start < b.start; });
+
+        unsigned long maxEnd = 0;
+        for (auto &interval : intervals) {
+            maxEnd = std::max(maxEnd, interval.end);
+            interval.maxEnd = maxEnd;
+        }
+    }
+
+    // calls f(regionIndex) for every live region containing addr
+    template <class F>
+    void find(unsigned long addr, F f) const {
+        auto it = std::upper_bound(intervals.begin(), intervals.end(), addr,
+                                   [](unsigned long a, const Interval &i) { return a < i.start; });
+        while (it != intervals.begin()) {
+            --it;
+            if (it->maxEnd <= addr)
+                break;
+            if (addr < it->end)
+                f(it->region);
+        }
+    }
+
+    size_t size() const { return intervals.size(); }
+
+private:
+    class Interval {
+    public:
+        Interval(unsigned long start, unsigned long end, size_t region) :
+            start(start), end(end), maxEnd(end), region(region) {}
+        unsigned long start, end, maxEnd;
+        size_t region;
+    };
+
+    std::vector<Interval> intervals;
+};
+
+#endif  // __REGION_INDEX_H__
@@ -0,0 +1,97 @@
+#include "region_refiner.h"
+
+#include <sstream>
+#include <algorithm>
+
+RegionRefiner::RegionRefiner() {
+    enabled = false;
+    threshold = defaultThreshold;
+    zoom = 16;
+    pixelBudget = 4000;
+    pixelsUsed = 0;
+}
+
+void RegionRefiner::childPixels(const MemoryRegion &parent, const MemoryRegion &child, int &first, int &end) {
+    parent.pixelRange(child.startAddr, child.endAddr - child.startAddr, first, end);
+}
+
+std::vector<MemoryRegion> RegionRefiner::rowSealed(const std::vector<MemoryRegion> &regions) {
+
+    std::vector<MemoryRegion> children;
+    if (heat.size() < regions.size())
+        heat.resize(regions.size());
+
+    for (size_t r=0; r<regions.size(); ++r) {
+        const MemoryRegion &region = regions[r];
+        unsigned long size = region.endAddr - region.startAddr;
+        if (region.retired || size <= region.resolution)
+            continue;
+
+        std::vector<unsigned long> &regionHeat = heat[r];
+        if (regionHeat.empty())
+            regionHeat.assign(region.resolution, 0);
+        unsigned long rowAccesses = 0;
+        const std::vector<MemoryRegion::MemoryReading> &row = region.trace.back();
+        for (unsigned int p=0; p<region.resolution; ++p) {
+            unsigned long count = row[p].loadCount + row[p].storeCount + row[p].modCount;
+            regionHeat[p] += count;
+            rowAccesses += count;
+        }
+
+        // the hottest span can only have changed if the row saw accesses
+        if (rowAccesses == 0 || pixelsUsed + minChildResolution > pixelBudget)
+            continue;
+
+        // spans overlapping an existing child are skipped
+        std::vector<char> covered(region.resolution, 0);
+        for (size_t c=0; c<regions.size(); ++c)
+            if (regions[c].parent == (long)r) {
+                int first, end;
+                childPixels(region, regions[c], first, end);
+                std::fill(covered.begin() + first, covered.begin() + end, 1);
+            }
+
+        prefix.assign(region.resolution + 1, 0);
+        std::vector<unsigned int> coveredPrefix(region.resolution + 1, 0);
+        for (unsigned int p=0; p<region.resolution; ++p) {
+            prefix[p+1] = prefix[p] + regionHeat[p];
+            coveredPrefix[p+1] = coveredPrefix[p] + covered[p];
+        }
+
+        unsigned int width = std::max(1u, region.resolution / std::max(1u, zoom));
+        unsigned long best = 0;
+        unsigned int bestFirst = 0;
+        for (unsigned int p=0; p+width<=region.resolution; ++p) {
+            if (coveredPrefix[p+width] != coveredPrefix[p])
+                continue;
+            unsigned long spanHeat = prefix[p+width] - prefix[p];
+            if (spanHeat > best) {
+                best = spanHeat;
+                bestFirst = p;
+            }
+        }
+        if (best < threshold || best * 4 < prefix[region.resolution])
+            continue;
+
+        // the addresses of the span's pixels, the inverse of pixelRange
+        unsigned long startOffset = ((unsigned long)bestFirst * size + region.resolution - 1) / region.resolution;
+        unsigned long endOffset = ((unsigned long)(bestFirst + width) * size + region.resolution - 1) / region.resolution;
+
+        // named by its offsets into the top level region
+        const MemoryRegion *root = &region;
+        while (root->parent >= 0)
+            root = &regions[root->parent];
+        std::ostringstream name;
+        name << root->name << "[0x" << std::hex << (region.startAddr + startOffset - root->startAddr)
+             << ":0x" << (region.startAddr + endOffset - root->startAddr) << "]";
+        unsigned int resolution = std::min(region.resolution, pixelBudget - pixelsUsed);
+        MemoryRegion child(name.str(), region.startAddr + startOffset, region.startAddr + endOffset, resolution);
+        child.parent = r;
+        pixelsUsed += child.resolution;
+        children.push_back(child);
+
+        std::cout << "[\033[92mVMT\033[0m] Refining [" << region.name << "] over its hottest span, "
+                  << best << " accesses, as region [" << child.name << "]\n";
+    }
+    return children;
+}
@@ -0,0 +1,53 @@
+#ifndef __REGION_REFINER_H__
+#define __REGION_REFINER_H__
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "memory_region.h"
+
+/*
+    Adaptive refinement of the address space of memory regions.
+
+    A large region at a few thousand pixels can put hundreds of kilobytes in
+    each pixel, hiding small hot structures. Rather than raising the
+    resolution of the whole region, the access counts of each row are added
+    to a per pixel heat histogram of the region as the row is sealed. Once
+    the hottest span of 1/zoom of the region's pixels has seen threshold
+    accesses, and at least a quarter of the region's accesses, a child
+    region covering just that span is spawned at the region's resolution,
+    recording from the next row. Spans already covered by a child are not
+    spawned again. Children are refined in the same way, zooming further
+    into hot spans within them, with the pixels of all children kept within
+    a budget.
+*/
+class RegionRefiner
+{
+public:
+    static const unsigned long defaultThreshold = 100000;
+    static const unsigned int minChildResolution = 16;
+
+    RegionRefiner();
+
+    // Adds the row just sealed of every live region to its heat and returns
+    // the children to add for any region whose hottest span has reached the
+    // threshold, their parents set. Must be called with memRegionsMutex
+    // held, before the next row is started.
+    std::vector<MemoryRegion> rowSealed(const std::vector<MemoryRegion> &regions);
+
+    // the span of parent pixels covered by a child region
+    static void childPixels(const MemoryRegion &parent, const MemoryRegion &child, int &first, int &end);
+
+    bool enabled;
+    unsigned long threshold;
+    unsigned int zoom;
+    unsigned int pixelBudget;
+
+private:
+    std::vector<std::vector<unsigned long> > heat;
+    std::vector<unsigned long> prefix;
+    unsigned int pixelsUsed;
+};
+
+#endif  // __REGION_REFINER_H__
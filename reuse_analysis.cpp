@@ -0,0 +1,308 @@
+#include "reuse_analysis.h"
+
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+
+void ReuseAnalysis::Histogram::add(unsigned long distance) {
+    ++bins[bin(distance)];
+}
+
+unsigned long ReuseAnalysis::Histogram::accesses() const {
+    unsigned long total = coldAccesses;
+    for (auto count : bins)
+        total += count;
+    return total;
+}
+
+int ReuseAnalysis::Histogram::bin(unsigned long distance) {
+    int b = 0;
+    while (distance > 0 && b < binCount - 1) {
+        distance >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+std::string ReuseAnalysis::Histogram::binLabel(int b) {
+    if (b <= 1)
+        return "d" + std::to_string(b);
+    return "d" + std::to_string(1ul << (b-1)) + "-" + std::to_string((1ul << b) - 1);
+}
+
+ReuseAnalysis::Stream::Stream() : time(0), tree(4096 + 1, 0) {}
+
+void ReuseAnalysis::Stream::mark(unsigned long t, int delta) {
+    for (unsigned long i = t + 1; i < tree.size(); i += i & (~i + 1))
+        tree[i] += delta;
+}
+
+unsigned long ReuseAnalysis::Stream::prefix(unsigned long t) const {
+    unsigned long sum = 0;
+    for (unsigned long i = t + 1; i > 0; i -= i & (~i + 1))
+        sum += tree[i];
+    return sum;
+}
+
+std::vector<unsigned long> ReuseAnalysis::Stream::compact() {
+
+    std::vector<std::pair<unsigned long, unsigned long> > byTime;
+    byTime.reserve(lastAccess.size());
+    for (auto &entry : lastAccess)
+        byTime.push_back(std::make_pair(entry.second, entry.first));
+    std::sort(byTime.begin(), byTime.end());
+
+    // leave room for at least as many accesses again before the next compaction
+    tree.assign(std::max((size_t)4096, byTime.size() * 2) + 1, 0);
+    std::vector<unsigned long> oldTimes(byTime.size());
+    for (size_t t=0; t<byTime.size(); ++t) {
+        oldTimes[t] = byTime[t].first;
+        lastAccess[byTime[t].second] = t;
+        mark(t, 1);
+    }
+    time = byTime.size();
+    return oldTimes;
+}
+
+bool ReuseAnalysis::Stream::access(unsigned long line, unsigned long &distance, unsigned long &previousTime) {
+
+    auto it = lastAccess.find(line);
+    bool reused = it != lastAccess.end();
+    if (reused) {
+        // distinct lines touched since are the marks after the previous access
+        previousTime = it->second;
+        distance = lastAccess.size() - prefix(previousTime);
+        mark(previousTime, -1);
+        it->second = time;
+    } else
+        lastAccess[line] = time;
+
+    mark(time, 1);
+    ++time;
+    return reused;
+}
+
+ReuseAnalysis::ReuseAnalysis() {
+    enabled = false;
+    lineSize = 64;
+}
+
+void ReuseAnalysis::accessLines(Stream &stream, Histogram *histogram, unsigned long addr, unsigned int size, bool combined) {
+
+    unsigned long firstLine = addr / lineSize;
+    unsigned long lastLine = (addr + std::max(size, 1u) - 1) / lineSize;
+
+    for (unsigned long line=firstLine; line<=lastLine; ++line) {
+        if (stream.full()) {
+            std::vector<unsigned long> oldTimes = stream.compact();
+            if (combined)
+                for (size_t o : activeOccurrences) {
+                    OccurrenceHistogram &occ = occurrences[o];
+                    occ.startTime = std::lower_bound(oldTimes.begin(), oldTimes.end(), occ.startTime) - oldTimes.begin();
+                }
+        }
+
+        unsigned long distance = 0, previousTime = 0;
+        bool reused = stream.access(line, distance, previousTime);
+
+        if (histogram != nullptr) {
+            if (reused)
+                histogram->add(distance);
+            else {
+                ++histogram->coldAccesses;
+                ++histogram->workingSet;
+            }
+        }
+
+        if (!combined)
+            continue;
+
+        // lines not touched since an occurrence started are new to its working set
+        for (size_t o : activeOccurrences) {
+            OccurrenceHistogram &occ = occurrences[o];
+            if (reused)
+                occ.add(distance);
+            else
+                ++occ.coldAccesses;
+            if (!reused || previousTime < occ.startTime)
+                ++occ.workingSet;
+        }
+    }
+}
+
+void ReuseAnalysis::access(size_t region, unsigned long addr, unsigned int size) {
+    if (region >= regions.size()) {
+        regions.resize(region + 1);
+        regionStreams.resize(region + 1);
+    }
+    accessLines(regionStreams[region], &regions[region], addr, size, false);
+}
+
+void ReuseAnalysis::accessCombined(unsigned long addr, unsigned int size) {
+    accessLines(combinedStream, nullptr, addr, size, true);
+}
+
+void ReuseAnalysis::startOccurrence(size_t activity, size_t occurrence) {
+    OccurrenceHistogram occ;
+    occ.activity = activity;
+    occ.occurrence = occurrence;
+    occ.startTime = combinedStream.time;
+    occ.active = true;
+    activeOccurrences.push_back(occurrences.size());
+    occurrences.push_back(occ);
+}
+
+void ReuseAnalysis::stopOccurrence(size_t activity) {
+    for (auto it = activeOccurrences.rbegin(); it != activeOccurrences.rend(); ++it)
+        if (occurrences[*it].activity == activity) {
+            occurrences[*it].active = false;
+            activeOccurrences.erase(std::next(it).base());
+            return;
+        }
+}
+
+static void writeHistogram(std::ostream &out, const ReuseAnalysis::Histogram &h) {
+    out.write((char*)h.bins.data(), sizeof (unsigned long) * ReuseAnalysis::binCount);
+    out.write((char*)&h.coldAccesses, sizeof (unsigned long));
+    out.write((char*)&h.workingSet, sizeof (unsigned long));
+}
+
+static void readHistogram(std::istream &in, ReuseAnalysis::Histogram &h, unsigned int bins) {
+    std::vector<unsigned long> counts(bins);
+    in.read((char*)counts.data(), sizeof (unsigned long) * bins);
+    for (unsigned int b=0; b<bins; ++b)
+        h.bins[std::min((int)b, ReuseAnalysis::binCount-1)] += counts[b];
+    in.read((char*)&h.coldAccesses, sizeof (unsigned long));
+    in.read((char*)&h.workingSet, sizeof (unsigned long));
+}
+
+void ReuseAnalysis::toStream(std::ostream &out) const {
+    unsigned int bins = binCount;
+    out.write((char*)&lineSize, sizeof (lineSize));
+    out.write((char*)&bins, sizeof (bins));
+
+    unsigned long size = regions.size();
+    out.write((char*)&size, sizeof (size));
+    for (auto &region : regions)
+        writeHistogram(out, region);
+
+    size = occurrences.size();
+    out.write((char*)&size, sizeof (size));
+    for (auto &occ : occurrences) {
+        unsigned long activity = occ.activity, occurrence = occ.occurrence;
+        out.write((char*)&activity, sizeof (activity));
+        out.write((char*)&occurrence, sizeof (occurrence));
+        writeHistogram(out, occ);
+    }
+}
+
+void ReuseAnalysis::fromStream(std::istream &in) {
+    unsigned int bins;
+    in.read((char*)&lineSize, sizeof (lineSize));
+    in.read((char*)&bins, sizeof (bins));
+
+    unsigned long size;
+    in.read((char*)&size, sizeof (size));
+    regions.assign(size, Histogram());
+    for (auto &region : regions)
+        readHistogram(in, region, bins);
+
+    in.read((char*)&size, sizeof (size));
+    occurrences.assign(size, OccurrenceHistogram());
+    for (auto &occ : occurrences) {
+        unsigned long activity, occurrence;
+        in.read((char*)&activity, sizeof (activity));
+        in.read((char*)&occurrence, sizeof (occurrence));
+        occ.activity = activity;
+        occ.occurrence = occurrence;
+        occ.startTime = 0;
+        occ.active = false;
+        readHistogram(in, occ, bins);
+    }
+    enabled = true;
+}
+
+bool ReuseAnalysis::saveCsv(const std::string &filename,
+                            const std::vector<std::string> &regionNames,
+                            const std::vector<std::string> &activityNames) const {
+
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Could not open \"" << filename << "\" to save reuse distances" << std::endl;
+        return false;
+    }
+
+    out << "scope,name,occurrence,accesses,cold_accesses,working_set_lines";
+    for (int b=0; b<binCount; ++b)
+        out << "," << Histogram::binLabel(b);
+    out << "\n";
+
+    auto writeRow = [&](const char *scope, const std::string &name, const std::string &occurrence, const Histogram &h) {
+        out << scope << "," << name << "," << occurrence << "," << h.accesses() << ","
+            << h.coldAccesses << "," << h.workingSet;
+        for (auto count : h.bins)
+            out << "," << count;
+        out << "\n";
+    };
+
+    for (size_t r=0; r<regions.size(); ++r)
+        writeRow("region", r < regionNames.size() ? regionNames[r] : std::to_string(r), "", regions[r]);
+    for (auto &occ : occurrences)
+        writeRow("occurrence",
+                 occ.activity < activityNames.size() ? activityNames[occ.activity] : std::to_string(occ.activity),
+                 std::to_string(occ.occurrence), occ);
+    return true;
+}
+
+static std::string jsonString(const std::string &text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        quoted += (unsigned char)c < 0x20 ? ' ' : c;
+    }
+    return quoted + "\"";
+}
+
+bool ReuseAnalysis::saveJson(const std::string &filename,
+                             const std::vector<std::string> &regionNames,
+                             const std::vector<std::string> &activityNames) const {
+
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Could not open \"" << filename << "\" to save reuse distances" << std::endl;
+        return false;
+    }
+
+    auto writeHistogramJson = [&](const Histogram &h) {
+        out << "\"accesses\": " << h.accesses()
+            << ", \"coldAccesses\": " << h.coldAccesses
+            << ", \"workingSetLines\": " << h.workingSet
+            << ", \"histogram\": [";
+        for (int b=0; b<binCount; ++b)
+            out << (b ? ", " : "") << h.bins[b];
+        out << "]";
+    };
+
+    out << "{\n  \"lineSize\": " << lineSize << ",\n  \"bins\": [";
+    for (int b=0; b<binCount; ++b)
+        out << (b ? ", " : "") << jsonString(Histogram::binLabel(b));
+    out << "],\n  \"regions\": [";
+    for (size_t r=0; r<regions.size(); ++r) {
+        out << (r ? ",\n" : "\n") << "    {\"name\": "
+            << jsonString(r < regionNames.size() ? regionNames[r] : std::to_string(r)) << ", ";
+        writeHistogramJson(regions[r]);
+        out << "}";
+    }
+    out << "\n  ],\n  \"occurrences\": [";
+    for (size_t o=0; o<occurrences.size(); ++o) {
+        const OccurrenceHistogram &occ = occurrences[o];
+        out << (o ? ",\n" : "\n") << "    {\"activity\": "
+            << jsonString(occ.activity < activityNames.size() ? activityNames[occ.activity] : std::to_string(occ.activity))
+            << ", \"occurrence\": " << occ.occurrence << ", ";
+        writeHistogramJson(occ);
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef __REUSE_ANALYSIS_H__
+#define __REUSE_ANALYSIS_H__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+
+/*
+    Reuse distance (LRU stack distance) analysis of the recorded accesses.
+
+    Accesses are split into cache lines and the reuse distance of each is the
+    number of distinct other lines touched since the previous access to the
+    same line. Distances are found in O(log n) with a Fenwick tree holding a
+    mark at the time of the latest access to every line, the distance is the
+    number of marks after the previous access.
+
+    Histograms are kept per memory region, each region being its own access
+    stream, and per activity occurrence over the combined stream of every
+    region. Distances are binned in powers of two, bin 0 holds distance 0 and
+    bin b holds distances from 2^(b-1) to 2^b - 1. First accesses to a line
+    are counted separately as cold accesses.
+*/
+class ReuseAnalysis
+{
+public:
+    static const int binCount = 40;
+
+    class Histogram {
+    public:
+        Histogram() : bins(binCount, 0), coldAccesses(0), workingSet(0) {}
+
+        void add(unsigned long distance);
+        unsigned long accesses() const;
+
+        static int bin(unsigned long distance);
+        static std::string binLabel(int b);
+
+        std::vector<unsigned long> bins;
+        unsigned long coldAccesses;
+        unsigned long workingSet;  // distinct lines touched
+    };
+
+    class OccurrenceHistogram : public Histogram {
+    public:
+        size_t activity, occurrence;
+        unsigned long startTime;  // combined stream time of the start
+        bool active;
+    };
+
+    ReuseAnalysis();
+
+    // an access to a region, called once for every region containing it
+    void access(size_t region, unsigned long addr, unsigned int size);
+
+    // an access to any region, called once per access
+    void accessCombined(unsigned long addr, unsigned int size);
+
+    void startOccurrence(size_t activity, size_t occurrence);
+    void stopOccurrence(size_t activity);
+
+    void toStream(std::ostream &out) const;
+    void fromStream(std::istream &in);
+
+    bool saveCsv(const std::string &filename,
+                 const std::vector<std::string> &regionNames,
+                 const std::vector<std::string> &activityNames) const;
+    bool saveJson(const std::string &filename,
+                  const std::vector<std::string> &regionNames,
+                  const std::vector<std::string> &activityNames) const;
+
+    bool enabled;
+    unsigned int lineSize;
+
+    std::vector<Histogram> regions;
+    std::vector<OccurrenceHistogram> occurrences;
+
+private:
+    // LRU stack of a single access stream
+    class Stream {
+    public:
+        Stream();
+
+        // returns false for the first access to a line, otherwise sets the
+        // reuse distance and the time of the previous access.
+        bool access(unsigned long line, unsigned long &distance, unsigned long &previousTime);
+
+        // true when the tree has no room for another access
+        bool full() const { return time + 1 >= tree.size(); }
+
+        // renumbers the latest access times to 0..n-1, keeping their order,
+        // and returns the old times in order so other times can be mapped.
+        std::vector<unsigned long> compact();
+
+        unsigned long time;
+
+    private:
+        void mark(unsigned long t, int delta);
+        unsigned long prefix(unsigned long t) const;
+
+        std::vector<unsigned int> tree;
+        std::unordered_map<unsigned long, unsigned long> lastAccess;
+    };
+
+    void accessLines(Stream &stream, Histogram *histogram, unsigned long addr, unsigned int size, bool combined);
+
+    std::vector<Stream> regionStreams;
+    Stream combinedStream;
+
+    // indexes into occurrences of those still running
+    std::vector<size_t> activeOccurrences;
+};
+
+#endif  // __REUSE_ANALYSIS_H__
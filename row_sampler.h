@@ -0,0 +1,70 @@
+#ifndef __ROW_SAMPLER_H__
+#define __ROW_SAMPLER_H__
+
+#include <string>
+#include <cstdlib>
+
+/*
+    Chooses which trace rows are recorded when sampling a long capture.
+
+    Rows are taken in groups of periodRows and sampleRows of each group are
+    recorded, either the first rows of the group or, with random bursts, a
+    run of consecutive rows starting at a random row of the group. The
+    choice depends only on the row and the seed, so every row's fate is
+    known as it starts and the fraction of rows recorded is always
+    sampleRows / periodRows. The accesses of the other rows are skipped,
+    counting only their instructions and any event markers.
+*/
+class RowSampler
+{
+public:
+    RowSampler() : enabled(false), sampleRows(1), periodRows(1), randomBursts(false), seed(1) {}
+
+    // parses "N/M" or "N/M,random", returns false if it is not valid
+    bool configure(const std::string &spec) {
+        size_t slash = spec.find('/');
+        if (slash == std::string::npos)
+            return false;
+        unsigned long n = std::strtoul(spec.substr(0, slash).c_str(), nullptr, 10);
+        size_t comma = spec.find(',', slash);
+        unsigned long m = std::strtoul(spec.substr(slash + 1, comma - slash - 1).c_str(), nullptr, 10);
+        if (n == 0 || m < n)
+            return false;
+        if (comma != std::string::npos && spec.substr(comma + 1) != "random")
+            return false;
+        sampleRows = n;
+        periodRows = m;
+        randomBursts = comma != std::string::npos;
+        enabled = true;
+        return true;
+    }
+
+    bool sampled(size_t row) const {
+        if (!enabled)
+            return true;
+        unsigned long group = row / periodRows;
+        unsigned long offset = row % periodRows;
+        unsigned long start = 0;
+        if (randomBursts)
+            start = hash(group) % (periodRows - sampleRows + 1);
+        return offset >= start && offset < start + sampleRows;
+    }
+
+    double fraction() const { return enabled ? (double)sampleRows / periodRows : 1.0; }
+
+    bool enabled;
+    unsigned long sampleRows, periodRows;
+    bool randomBursts;
+    unsigned long seed;
+
+private:
+    // splitmix64 of the group, so each group's burst is independent
+    unsigned long hash(unsigned long group) const {
+        unsigned long z = group + seed * 0x9e3779b97f4a7c15ul;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ul;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebul;
+        return z ^ (z >> 31);
+    }
+};
+
+#endif  // __ROW_SAMPLER_H__
@@ -0,0 +1,58 @@
+#include "stage_profile.h"
+
+#include <fstream>
+#include <iomanip>
+
+std::atomic<unsigned long> StageProfile::cycles[StageProfile::StageCount];
+std::atomic<unsigned long> StageProfile::events[StageProfile::StageCount];
+
+std::string StageProfile::name(Stage stage) {
+    switch (stage) {
+        case ReadInput: return "read input";
+        case Parse: return "parse";
+        case SyncWait: return "sync wait";
+        case CacheSim: return "cache simulation";
+        case RegionMatch: return "region match";
+        case ActivityMatch: return "activity match";
+        case RowSeal: return "row sealing";
+        case Progress: return "progress output";
+        case ControlWait: return "control wait";
+        case ControlRead: return "control read";
+        default: return "control handling";
+    }
+}
+
+void StageProfile::report(std::ostream &out) {
+    unsigned long totals[2] = { 0, 0 };
+    for (int s=0; s<StageCount; ++s)
+        totals[controlStage((Stage)s)] += cycles[s].load(std::memory_order_relaxed);
+
+    for (int t=0; t<2; ++t) {
+        out << "[\033[92mVMT\033[0m] " << (t == 0 ? "Access loop" : "Control thread") << " profile, "
+            << totals[t] / 1000000 << " M cycles\n";
+        for (int s=0; s<StageCount; ++s) {
+            if (controlStage((Stage)s) != (t == 1))
+                continue;
+            unsigned long c = cycles[s].load(std::memory_order_relaxed);
+            unsigned long e = events[s].load(std::memory_order_relaxed);
+            out << "[\033[92mVMT\033[0m]   " << std::left << std::setw(18) << name((Stage)s) << std::right
+                << std::setw(12) << e << " events " << std::setw(10) << c / 1000000 << " M cycles "
+                << std::setw(8) << (e > 0 ? c / e : 0) << " per event "
+                << std::fixed << std::setprecision(1) << std::setw(5) << (totals[t] > 0 ? 100.0 * c / totals[t] : 0.0) << "%\n"
+                << std::defaultfloat;
+        }
+    }
+}
+
+bool StageProfile::saveStats(const std::string &filename) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Could not open \"" << filename << "\" to save profile stats" << std::endl;
+        return false;
+    }
+    out << "thread,stage,events,cycles\n";
+    for (int s=0; s<StageCount; ++s)
+        out << (controlStage((Stage)s) ? "control" : "access") << "," << name((Stage)s) << ","
+            << events[s].load(std::memory_order_relaxed) << "," << cycles[s].load(std::memory_order_relaxed) << "\n";
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef __STAGE_PROFILE_H__
+#define __STAGE_PROFILE_H__
+
+#include <string>
+#include <iostream>
+#include <atomic>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+    Cycle and event counts of each stage of the analyser's access loop and
+    control thread, built in with 'make PROFILE=1' which defines VMT_PROFILE.
+
+    Each thread keeps a Clock and laps it at the end of every stage, which
+    charges the cycles since the previous lap and one event to that stage.
+    Every stage is only ever charged by one thread, so the counters are
+    updated with plain relaxed loads and stores, and can be read at any
+    time to write the stats file. Without VMT_PROFILE the macros below
+    compile to nothing.
+*/
+class StageProfile
+{
+public:
+    enum Stage { ReadInput, Parse, SyncWait, CacheSim, RegionMatch, ActivityMatch, RowSeal, Progress,
+                 ControlWait, ControlRead, ControlHandle, StageCount };
+
+    // timestamp counter where there is one, nanoseconds otherwise
+    static unsigned long now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    class Clock {
+    public:
+        Clock() : last(now()) {}
+
+        void lap(Stage stage) {
+            unsigned long time = now();
+            charge(stage, time - last, 1);
+            last = time;
+        }
+
+    private:
+        unsigned long last;
+    };
+
+    static void charge(Stage stage, unsigned long cycles, unsigned long events) {
+        StageProfile::cycles[stage].store(StageProfile::cycles[stage].load(std::memory_order_relaxed) + cycles,
+                                          std::memory_order_relaxed);
+        StageProfile::events[stage].store(StageProfile::events[stage].load(std::memory_order_relaxed) + events,
+                                          std::memory_order_relaxed);
+    }
+
+    static std::string name(Stage stage);
+
+    // true for the stages of the control thread
+    static bool controlStage(Stage stage) { return stage >= ControlWait; }
+
+    // breakdown of each thread's time by stage
+    static void report(std::ostream &out);
+
+    static bool saveStats(const std::string &filename);
+
+    static std::atomic<unsigned long> cycles[StageCount];
+    static std::atomic<unsigned long> events[StageCount];
+};
+
+#ifdef VMT_PROFILE
+#define VMT_PROFILE_CLOCK(clock) StageProfile::Clock clock
+#define VMT_PROFILE_LAP(clock, stage) clock.lap(StageProfile::stage)
+#else
+#define VMT_PROFILE_CLOCK(clock)
+#define VMT_PROFILE_LAP(clock, stage)
+#endif
+
+#endif  // __STAGE_PROFILE_H__
@@ -0,0 +1,137 @@
+#include "synthetic_workload.h"
+
+#include <cstdio>
+#include <algorithm>
+
+// gap left between regions so accesses at a region's end don't run into the next
+static const unsigned long regionGap = 4096;
+
+SyntheticWorkload::SyntheticWorkload(const Config &config) :
+    config(config), cursors(config.regions, 0) {
+    state = config.seed * 0x9e3779b97f4a7c15ul + 1;
+    instruction = 0;
+    activeActivity = 0;
+    pendingAccesses = 0;
+    started = false;
+    ended = false;
+}
+
+std::vector<MemoryRegion> SyntheticWorkload::regions() const {
+    std::vector<MemoryRegion> regions;
+    for (unsigned int r=0; r<config.regions; ++r) {
+        unsigned long start = regionBase + r * (config.regionSize + regionGap);
+        regions.push_back(MemoryRegion("region" + std::to_string(r), start, start + config.regionSize, config.resolution));
+    }
+    return regions;
+}
+
+std::vector<Activity> SyntheticWorkload::activities() const {
+    std::vector<Activity> activities;
+    activities.push_back(Activity("Recording", flagBase));
+    for (unsigned int a=1; a<=config.activities; ++a)
+        activities.push_back(Activity("op" + std::to_string(a), flagBase + a * 8));
+    return activities;
+}
+
+void SyntheticWorkload::controlToStream(std::ostream &out) const {
+    out << "\"Synthetic workload\"\n";
+    for (auto &activity : activities())
+        out << "#" << activity.name << "(" << activity.addr << ")\n";
+    for (auto &region : regions())
+        out << ":" << region.name << "(" << region.startAddr << "," << region.endAddr << "," << region.resolution << ")\n";
+}
+
+// xorshift64*, fast and the same on every platform
+unsigned long SyntheticWorkload::random() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dul;
+}
+
+double SyntheticWorkload::uniform() {
+    return (random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void SyntheticWorkload::access(std::string &line, char type, unsigned long addr) {
+    char text[64];
+    std::snprintf(text, sizeof (text), " %c %08lx,%u", type, addr, config.accessSize);
+    line = text;
+}
+
+bool SyntheticWorkload::next(std::string &line) {
+    if (!queued.empty()) {
+        line = queued.back();
+        queued.pop_back();
+        return true;
+    }
+    if (ended)
+        return false;
+
+    // lines of the next step are queued in reverse so they pop in order
+    std::vector<std::string> step;
+    std::string text;
+
+    if (!started) {
+        started = true;
+        access(text, 'S', flagBase);
+        step.push_back(text);
+    }
+
+    if (instruction == config.instructions) {
+        access(text, 'L', flagBase);
+        step.push_back(text);
+        step.push_back("==0== Exit code: 0");
+        ended = true;
+    }
+    else {
+        char pc[32];
+        std::snprintf(pc, sizeof (pc), "I  %08lx,3", 0x4000000ul + (instruction % 4096) * 4);
+        step.push_back(pc);
+
+        // activities run one at a time in turn
+        if (config.activities > 0 && config.eventEvery > 0 && instruction % config.eventEvery == 0) {
+            if (activeActivity > 0) {
+                access(text, 'L', flagBase + activeActivity * 8);
+                step.push_back(text);
+            }
+            activeActivity = activeActivity % config.activities + 1;
+            access(text, 'S', flagBase + activeActivity * 8);
+            step.push_back(text);
+        }
+
+        pendingAccesses += config.accessesPerInstruction;
+        for (; pendingAccesses >= 1.0; pendingAccesses -= 1.0) {
+            double mix = uniform();
+            char type = mix < config.loadFraction ? 'L' :
+                        mix < config.loadFraction + config.storeFraction ? 'S' : 'M';
+
+            unsigned long addr;
+            unsigned long span = std::max(config.regionSize, (unsigned long)config.accessSize) - config.accessSize + 1;
+            double kind = uniform();
+            if (config.regions == 0 || kind < config.outsideFraction)
+                addr = outsideBase + (random() % 65536) / config.accessSize * config.accessSize;
+            else {
+                unsigned int r = random() % config.regions;
+                unsigned long offset;
+                if (kind < config.outsideFraction + config.randomFraction)
+                    offset = (random() % span) / config.accessSize * config.accessSize;
+                else {
+                    offset = cursors[r];
+                    cursors[r] += config.stride;
+                    if (cursors[r] >= span)
+                        cursors[r] = 0;
+                }
+                addr = regionBase + r * (config.regionSize + regionGap) + offset;
+            }
+            access(text, type, addr);
+            step.push_back(text);
+        }
+        ++instruction;
+    }
+
+    queued.assign(step.rbegin(), step.rend());
+    line = queued.back();
+    queued.pop_back();
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef __SYNTHETIC_WORKLOAD_H__
+#define __SYNTHETIC_WORKLOAD_H__
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "memory_region.h"
+#include "activity.h"
+
+/*
+    Deterministic generator of a synthetic Lackey access stream.
+
+    A number of equally sized regions are laid out one after another, each
+    swept by its own cursor at a fixed stride, with a fraction of accesses
+    going to random addresses of a random region and another fraction to
+    addresses outside every region, like stack traffic. A few activities are
+    started and stopped in turn every eventEvery instructions. The same
+    configuration and seed always give the same stream.
+*/
+class SyntheticWorkload
+{
+public:
+    class Config {
+    public:
+        Config() : regions(4),
+                   regionSize(1 << 20),
+                   resolution(1000),
+                   instructions(1000000),
+                   accessesPerInstruction(0.5),
+                   loadFraction(0.6),
+                   storeFraction(0.3),
+                   stride(8),
+                   accessSize(8),
+                   randomFraction(0.1),
+                   outsideFraction(0.2),
+                   activities(4),
+                   eventEvery(10000),
+                   seed(1) {}
+
+        unsigned int regions;
+        unsigned long regionSize;
+        unsigned int resolution;
+        unsigned long instructions;
+        double accessesPerInstruction;
+
+        // the remaining accesses are modifies
+        double loadFraction, storeFraction;
+
+        unsigned long stride;
+        unsigned int accessSize;
+        double randomFraction, outsideFraction;
+
+        unsigned int activities;
+        unsigned long eventEvery;
+        unsigned long seed;
+    };
+
+    SyntheticWorkload(const Config &config);
+
+    // regions and activities the stream accesses, the first activity
+    // is the recording flag which the stream sets before anything else.
+    std::vector<MemoryRegion> regions() const;
+    std::vector<Activity> activities() const;
+
+    // the next line of the stream, false once it has ended
+    bool next(std::string &line);
+
+    // writes the regions and activities as text protocol control messages
+    void controlToStream(std::ostream &out) const;
+
+    const Config config;
+
+    static const unsigned long regionBase = 0x10000000;
+    static const unsigned long flagBase = 0x8000;
+    static const unsigned long outsideBase = 0x7ff000000000;
+
+private:
+    unsigned long random();
+    double uniform();
+    void access(std::string &line, char type, unsigned long addr);
+
+    unsigned long state;
+    unsigned long instruction;
+    unsigned long activeActivity;
+    double pendingAccesses;
+    bool started, ended;
+    std::vector<unsigned long> cursors;
+    std::vector<std::string> queued;
+};
+
+#endif  // __SYNTHETIC_WORKLOAD_H__
@@ -12,10 +12,18 @@ public:
         this->endOp = endOp;
         this->offset = offset;
         this->size = size;
+        firstUse = 0;
+        lastUse = 0;
+        region = 0;
     }
 
     std::string startOp, endOp;
     unsigned long offset, size;
+
+    // instruction range the block is live for, from its first store to the
+    // end of the row of its last load, and the region it was found in.
+    unsigned long firstUse, lastUse;
+    size_t region;
 };
 
-#endif  // __TRACE_SESSION_H__
\ No newline at end of file
+#endif  // __TENSOR_BLOCK_H__
@@ -0,0 +1,375 @@
+/*
+    Trace tile server.
+    -------------------------
+
+    Serves a saved memory trace to a web browser as a pyramid of 256 pixel
+    square PNG tiles so it can be zoomed and panned without rendering a full
+    size plot. The trace file is memory mapped and only the rows needed by
+    each tile are decoded, recently rendered tiles are kept in an LRU cache.
+
+    Usage: vis_mem_serve model.trace [--port=8090] [--threads=4] [--cache_tiles=1024]
+
+    Then open http://localhost:8090/ in a browser, or fetch tiles directly:
+
+        /info                          JSON description of the regions
+        /tile/{region}/{level}/{x}/{y} PNG tile, each pixel covers 2^level
+                                       columns and 2^level rows of the trace
+*/
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "trace_file_view.h"
+#include "png_writer.h"
+#include "lru_cache.h"
+
+static const int tileSize = 256;
+static const int maxLevel = 20;
+
+static const char *viewerPage = R"(<!DOCTYPE html>
+<html>
+<head>
+<title>Visual Memory Trace</title>
+<style>
+body { margin: 0; font-family: sans-serif; }
+#bar { padding: 6px; background: #eee; border-bottom: 1px solid #ccc; }
+#view { position: absolute; top: 40px; bottom: 0; left: 0; right: 0; overflow: auto; background: #ddd; }
+#plane { position: relative; }
+#plane img { position: absolute; width: 256px; height: 256px; image-rendering: pixelated; }
+</style>
+</head>
+<body>
+<div id="bar">
+Region <select id="region"></select>
+<button id="zoomIn">+</button> <button id="zoomOut">-</button>
+<span id="status"></span>
+</div>
+<div id="view"><div id="plane"></div></div>
+<script>
+var info = null, region = 0, level = 0, tiles = {};
+var view = document.getElementById('view'), plane = document.getElementById('plane');
+
+function extent() {
+  var r = info.regions[region], s = Math.pow(2, level);
+  return { w: Math.ceil(r.resolution / s), h: Math.ceil(r.rows / s) };
+}
+
+function reset() {
+  plane.innerHTML = ''; tiles = {};
+  var e = extent();
+  plane.style.width = e.w + 'px'; plane.style.height = e.h + 'px';
+  document.getElementById('status').textContent =
+    'level ' + level + ', ' + info.regions[region].rows + ' rows, ' +
+    info.instructionsPerRow + ' instructions per row';
+  update();
+}
+
+function update() {
+  var e = extent();
+  var x0 = Math.floor(view.scrollLeft / 256), x1 = Math.floor((view.scrollLeft + view.clientWidth) / 256);
+  var y0 = Math.floor(view.scrollTop / 256), y1 = Math.floor((view.scrollTop + view.clientHeight) / 256);
+  for (var y = y0; y <= y1 && y * 256 < e.h; ++y)
+    for (var x = x0; x <= x1 && x * 256 < e.w; ++x) {
+      var key = x + ',' + y;
+      if (tiles[key]) continue;
+      var img = document.createElement('img');
+      img.src = '/tile/' + region + '/' + level + '/' + x + '/' + y;
+      img.style.left = (x * 256) + 'px'; img.style.top = (y * 256) + 'px';
+      plane.appendChild(img); tiles[key] = img;
+    }
+}
+
+function zoom(delta) {
+  var next = Math.max(0, Math.min(20, level + delta));
+  if (next == level) return;
+  var f = Math.pow(2, level - next);
+  var cx = (view.scrollLeft + view.clientWidth / 2) * f, cy = (view.scrollTop + view.clientHeight / 2) * f;
+  level = next; reset();
+  view.scrollLeft = cx - view.clientWidth / 2; view.scrollTop = cy - view.clientHeight / 2;
+  update();
+}
+
+view.addEventListener('scroll', update);
+window.addEventListener('resize', update);
+document.getElementById('zoomIn').onclick = function() { zoom(-1); };
+document.getElementById('zoomOut').onclick = function() { zoom(1); };
+document.getElementById('region').onchange = function() { region = this.selectedIndex; reset(); };
+
+fetch('/info').then(function(r) { return r.json(); }).then(function(i) {
+  info = i;
+  var select = document.getElementById('region');
+  info.regions.forEach(function(r) {
+    var o = document.createElement('option'); o.textContent = r.name; select.appendChild(o);
+  });
+  if (info.regions.length) {
+    while (level < 20 && extent().h > 4 * view.clientHeight) ++level;
+    reset();
+  }
+});
+</script>
+</body>
+</html>
+)";
+
+static TraceFileView traceView;
+static LruCache<std::string, std::string> *tileCache;
+
+static std::mutex queueMutex;
+static std::condition_variable queueSignal;
+static std::deque<int> pendingClients;
+
+static std::string jsonEscape(const std::string &text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        if ((unsigned char)c < 0x20)
+            escaped += ' ';
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+static std::string infoJson() {
+    std::stringstream json;
+    json << "{\"instructionsPerRow\": " << traceView.instructionsPerRow
+         << ", \"tileSize\": " << tileSize
+         << ", \"regions\": [";
+    for (size_t r=0; r<traceView.regions.size(); ++r) {
+        const TraceFileView::RegionInfo &region = traceView.regions[r];
+        json << (r ? ", " : "")
+             << "{\"name\": \"" << jsonEscape(region.name) << "\""
+             << ", \"resolution\": " << region.resolution
+             << ", \"rows\": " << traceView.traceRows
+             << ", \"firstRow\": " << region.firstRow
+             << ", \"lastRow\": " << region.firstRow + region.rowOffsets.size() << "}";
+    }
+    json << "]}\n";
+    return json.str();
+}
+
+// Renders a single tile, every tile pixel combines a square block of
+// 2^level trace pixels. Blocks with both loads and stores are drawn green,
+// loads only blue and stores only red. Anything outside the trace or the
+// live span of the region is grey.
+static std::string renderTile(size_t r, int level, unsigned long x, unsigned long y) {
+
+    const TraceFileView::RegionInfo &region = traceView.regions[r];
+    unsigned long scale = 1ul << level;
+    unsigned long firstColumn = x * tileSize * scale;
+    unsigned long firstRow = y * tileSize * scale;
+    unsigned long liveBegin = region.firstRow;
+    unsigned long liveEnd = region.firstRow + region.rowOffsets.size();
+
+    // per tile pixel bit 0 set for loads, bit 1 for stores
+    std::vector<unsigned char> access(tileSize * tileSize, 0);
+    std::vector<MemoryRegion::MemoryReading> line;
+    unsigned long beginRow = std::max(liveBegin, firstRow);
+    unsigned long endRow = std::min(liveEnd, firstRow + tileSize * scale);
+    for (unsigned long row=beginRow; row<endRow; ++row) {
+        traceView.readRow(r, row - liveBegin, line);
+        unsigned char *tileRow = &access[((row - firstRow) / scale) * tileSize];
+        unsigned long endColumn = std::min((unsigned long)line.size(), firstColumn + tileSize * scale);
+        for (unsigned long c=firstColumn; c<endColumn; ++c) {
+            const MemoryRegion::MemoryReading &reading = line[c];
+            unsigned char bits = (reading.loadCount > 0 ? 1 : 0) | (reading.storeCount > 0 ? 2 : 0);
+            tileRow[(c - firstColumn) / scale] |= bits;
+        }
+    }
+
+    std::ostringstream png;
+    PngWriter writer(png, tileSize, tileSize);
+    std::vector<unsigned char> rgb(tileSize * 3);
+    for (int ty=0; ty<tileSize; ++ty) {
+        unsigned long row = firstRow + ty * scale;
+        bool rowInTrace = row + scale > liveBegin && row < liveEnd;
+        for (int tx=0; tx<tileSize; ++tx) {
+            unsigned char *p = &rgb[tx * 3];
+            bool inTrace = rowInTrace && firstColumn + tx * scale < region.resolution;
+            switch (inTrace ? access[ty * tileSize + tx] : 4) {
+                case 1:  p[0] = 0;   p[1] = 0;   p[2] = 255; break;
+                case 2:  p[0] = 255; p[1] = 0;   p[2] = 0;   break;
+                case 3:  p[0] = 0;   p[1] = 255; p[2] = 0;   break;
+                case 4:  p[0] = 220; p[1] = 220; p[2] = 220; break;
+                default: p[0] = 255; p[1] = 255; p[2] = 255; break;
+            }
+        }
+        writer.writeRow(rgb.data());
+    }
+    writer.finish();
+    return png.str();
+}
+
+static void sendResponse(int client, const std::string &status, const std::string &type, const std::string &body) {
+    std::stringstream header;
+    header << "HTTP/1.0 " << status << "\r\n"
+           << "Content-Type: " << type << "\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n";
+    std::string response = header.str() + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+}
+
+static void handleClient(int client) {
+
+    // only the request line is needed, read until the end of the headers
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t n = recv(client, buffer, sizeof (buffer), 0);
+        if (n <= 0)
+            break;
+        request.append(buffer, n);
+    }
+
+    std::stringstream requestLine(request.substr(0, request.find("\r\n")));
+    std::string method, path;
+    requestLine >> method >> path;
+
+    if (method != "GET") {
+        sendResponse(client, "405 Method Not Allowed", "text/plain", "Only GET is supported.\n");
+        return;
+    }
+
+    if (path == "/" || path == "/index.html") {
+        sendResponse(client, "200 OK", "text/html", viewerPage);
+        return;
+    }
+
+    if (path == "/info") {
+        sendResponse(client, "200 OK", "application/json", infoJson());
+        return;
+    }
+
+    unsigned long r, level, x, y;
+    char trailing;
+    if (std::sscanf(path.c_str(), "/tile/%lu/%lu/%lu/%lu%c", &r, &level, &x, &y, &trailing) == 4 &&
+        r < traceView.regions.size() && level <= maxLevel) {
+
+        const TraceFileView::RegionInfo &region = traceView.regions[r];
+        unsigned long span = tileSize * (1ul << level);
+        if (x * span >= region.resolution || y * span >= std::max((size_t)1, traceView.traceRows)) {
+            sendResponse(client, "404 Not Found", "text/plain", "Tile outside the trace.\n");
+            return;
+        }
+
+        std::string png;
+        if (!tileCache->get(path, png)) {
+            png = renderTile(r, level, x, y);
+            tileCache->put(path, png);
+        }
+        sendResponse(client, "200 OK", "image/png", png);
+        return;
+    }
+
+    sendResponse(client, "404 Not Found", "text/plain", "Not found.\n");
+}
+
+static void worker() {
+    while (true) {
+        int client;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueSignal.wait(lock, []{ return !pendingClients.empty(); });
+            client = pendingClients.front();
+            pendingClients.pop_front();
+        }
+        handleClient(client);
+        close(client);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "[\033[92mVisual Memory Trace - Tile Server\033[0m] Starting up.\n";
+
+    if (argc < 2) {
+        std::cerr << "Usage: vis_mem_serve <trace file> [--port=8090] [--threads=4] [--cache_tiles=1024]\n";
+        return 1;
+    }
+
+    std::string traceFilename = std::string(argv[1]);
+    int port = 8090;
+    int threads = 4;
+    size_t cacheTiles = 1024;
+
+    for (int a=2; a<argc; ++a)
+    {
+        std::string arg(argv[a]);
+        if (arg.substr(0,7) == "--port=") {
+            port = std::atoi(arg.substr(7, std::string::npos).c_str());
+        }
+        if (arg.substr(0,10) == "--threads=") {
+            threads = std::max(1, std::atoi(arg.substr(10, std::string::npos).c_str()));
+            std::cout << "[\033[92mVMT\033[0m] Serving with " << threads << " threads.\n";
+        }
+        if (arg.substr(0,14) == "--cache_tiles=") {
+            cacheTiles = std::max(1, std::atoi(arg.substr(14, std::string::npos).c_str()));
+            std::cout << "[\033[92mVMT\033[0m] Caching up to " << cacheTiles << " tiles.\n";
+        }
+    }
+
+    std::cout << "Opening memory trace [" << traceFilename << "]\n";
+    if (!traceView.open(traceFilename))
+        return 1;
+    for (auto &region : traceView.regions)
+        std::cout << "[\033[92mVMT\033[0m] Region \"" << region.name << "\" "
+                  << region.resolution << " x " << region.rowOffsets.size() << " pixels.\n";
+
+    LruCache<std::string, std::string> cache(cacheTiles);
+    tileCache = &cache;
+
+    // only accept connections from this machine
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof (address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (server < 0 ||
+        bind(server, (sockaddr*)&address, sizeof (address)) != 0 ||
+        listen(server, 64) != 0) {
+        std::cerr << "[\033[92mVMT\033[0m] Error: Could not listen on port " << port << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    std::vector<std::thread> pool;
+    for (int t=0; t<threads; ++t)
+        pool.push_back(std::thread(worker));
+
+    std::cout << "[\033[92mVMT\033[0m] Serving on http://localhost:" << port << "/\n";
+
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        queueMutex.lock();
+        pendingClients.push_back(client);
+        queueMutex.unlock();
+        queueSignal.notify_one();
+    }
+
+    return 0;
+}
@@ -2,28 +2,39 @@
 #define __TIME_MEMORY_AREA_H__
 
 #include <string>
+#include <iostream>
 
 class TimeMemoryArea {
 public:
     TimeMemoryArea(unsigned long startMem,
                    unsigned long endMem,
                    unsigned long startEventAddr,
-                   unsigned long endEventAddr) {
+                   unsigned long endEventAddr,
+                   unsigned int startOccurrence = 0,
+                   unsigned int endOccurrence = 0) {
         this->startMem = startMem;
         this->endMem = endMem;
         this->startEventAddr = startEventAddr;
         this->endEventAddr = endEventAddr;
+        this->startOccurrence = startOccurrence;
+        this->endOccurrence = endOccurrence;
         startInstruction = 0;
         endInstruction = 0;
     }
 
-    TimeMemoryArea(std::istream &in) {
+    TimeMemoryArea(std::istream &in, unsigned int version) {
         in.read((char*)&this->startMem, sizeof(unsigned long));
         in.read((char*)&this->endMem, sizeof(unsigned long));
         in.read((char*)&this->startEventAddr, sizeof(unsigned long));
         in.read((char*)&this->endEventAddr, sizeof(unsigned long));
         in.read((char*)&this->startInstruction, sizeof(unsigned long));
         in.read((char*)&this->endInstruction, sizeof(unsigned long));
+        startOccurrence = 0;
+        endOccurrence = 0;
+        if (version >= 2) {
+            in.read((char*)&this->startOccurrence, sizeof(unsigned int));
+            in.read((char*)&this->endOccurrence, sizeof(unsigned int));
+        }
     }
 
     friend std::ostream& operator<< (std::ostream& stream,
@@ -34,12 +45,20 @@ public:
         stream.write((char*)&area.endEventAddr, sizeof(unsigned long));
         stream.write((char*)&area.startInstruction, sizeof(unsigned long));
         stream.write((char*)&area.endInstruction, sizeof(unsigned long));
+        stream.write((char*)&area.startOccurrence, sizeof(unsigned int));
+        stream.write((char*)&area.endOccurrence, sizeof(unsigned int));
+        return stream;
     }
 
     unsigned long startMem;
     unsigned long endMem;
     unsigned long startEventAddr;
     unsigned long endEventAddr;
+
+    // which occurrence of the start and end events bound the area
+    unsigned int startOccurrence;
+    unsigned int endOccurrence;
+
     unsigned long startInstruction;
     unsigned long endInstruction;
 };
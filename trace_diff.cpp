@@ -0,0 +1,372 @@
+/*
+    Trace diff utility.
+    -------------------------
+
+    Compares two saved memory traces, typically captured before and after
+    changing a layout or kernel. Regions are matched by name and activities
+    by name and occurrence number. Both files are memory mapped and streamed
+    in blocks of rows, each block being decoded and compared for all regions
+    in parallel, so only one block of each region is ever held in memory.
+
+    Usage: vis_mem_diff before.trace after.trace [--out=trace_diff.png]
+                        [--csv=trace_diff.csv] [--threads=4] [--block_rows=256]
+
+    The diff image shows each matched region at the resolution of the first
+    trace, pixels only accessed before are red, only accessed after are
+    green, and accessed in both are grey tinted towards red or green by how
+    much the number of accesses changed. When one trace has coarser rows,
+    for example after coarsening a long capture, the rows of the other are
+    summed onto them.
+*/
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include "trace_file_view.h"
+#include "raster.h"
+
+class Totals {
+public:
+    Totals() : accesses(0), bytes(0), activeRows(0), occurrences(0), instructions(0) {}
+    unsigned long accesses, bytes, activeRows, occurrences, instructions;
+};
+
+class RegionPair {
+public:
+    std::string name;
+    int index[2];
+    Totals totals[2];
+    unsigned long changedPixels, comparedPixels;
+    int left;
+
+    // BGR pixels of the current block, block rows x resolution
+    std::vector<unsigned char> block;
+};
+
+static unsigned int pairResolution(const TraceFileView *views, const RegionPair &pair) {
+    return views[0].regions[pair.index[0]].resolution;
+}
+
+static raster::Color diffColor(unsigned long before, unsigned long after) {
+    if (before == 0 && after == 0)
+        return raster::Color(255, 255, 255);
+    if (after == 0)
+        return raster::Color(0, 0, 230);
+    if (before == 0)
+        return raster::Color(0, 170, 0);
+
+    // tint grey towards the direction of the change, fully at 16x
+    const raster::Color same(200, 200, 200);
+    raster::Color tint = after > before ? raster::Color(0, 170, 0) : raster::Color(0, 0, 230);
+    float strength = std::min(1.0f, (float)std::fabs(std::log2((double)after / before)) / 4.0f);
+    raster::Color c;
+    for (int i=0; i<3; ++i)
+        c.val[i] = (unsigned char)(same.val[i] * (1.0f - strength) + tint.val[i] * strength + 0.5f);
+    return c;
+}
+
+// Decodes and compares rows [top, top+count) of the diff for one region.
+// Each diff row covers rowScale[v] rows of trace v, so a trace with finer
+// rows is summed onto the rows of the coarser one.
+static void diffBlock(const TraceFileView *views, const size_t *rowScale, RegionPair &pair, size_t top, size_t count) {
+
+    unsigned int resolution = pairResolution(views, pair);
+    pair.block.assign(count * resolution * 3, 255);
+
+    std::vector<std::vector<MemoryRegion::MemoryReading> > rows[2];
+    long offset[2];
+    for (int v=0; v<2; ++v) {
+        const TraceFileView::RegionInfo &region = views[v].regions[pair.index[v]];
+        offset[v] = (long)(top * rowScale[v]) - (long)region.firstRow;
+        long first = std::max(offset[v], 0l);
+        long last = std::min(offset[v] + (long)(count * rowScale[v]), (long)region.rowOffsets.size());
+        if (last > first)
+            views[v].readRows(pair.index[v], first, last - first, rows[v]);
+        else
+            rows[v].clear();
+        offset[v] = first - offset[v];  // block trace row of rows[v][0]
+    }
+
+    unsigned int resolutionAfter = views[1].regions[pair.index[1]].resolution;
+    std::vector<unsigned long> before(resolution), after(resolution);
+    for (size_t r=0; r<count; ++r) {
+        std::fill(before.begin(), before.end(), 0);
+        std::fill(after.begin(), after.end(), 0);
+
+        for (size_t k=0; k<rowScale[0]; ++k) {
+            bool active = false;
+            long rowBefore = (long)(r * rowScale[0] + k) - offset[0];
+            if (rowBefore >= 0 && rowBefore < (long)rows[0].size())
+                for (unsigned int p=0; p<resolution && p<rows[0][rowBefore].size(); ++p) {
+                    const MemoryRegion::MemoryReading &reading = rows[0][rowBefore][p];
+                    unsigned long accesses = reading.loadCount + reading.storeCount + reading.modCount;
+                    before[p] += accesses;
+                    active |= accesses > 0;
+                }
+            pair.totals[0].activeRows += active;
+        }
+
+        // the second trace is resampled onto the pixels of the first
+        for (size_t k=0; k<rowScale[1]; ++k) {
+            bool active = false;
+            long rowAfter = (long)(r * rowScale[1] + k) - offset[1];
+            if (rowAfter >= 0 && rowAfter < (long)rows[1].size())
+                for (unsigned int p=0; p<resolutionAfter && p<rows[1][rowAfter].size(); ++p) {
+                    const MemoryRegion::MemoryReading &reading = rows[1][rowAfter][p];
+                    unsigned long accesses = reading.loadCount + reading.storeCount + reading.modCount;
+                    after[((unsigned long)p * resolution) / resolutionAfter] += accesses;
+                    active |= accesses > 0;
+                }
+            pair.totals[1].activeRows += active;
+        }
+
+        unsigned char *pixels = &pair.block[r * resolution * 3];
+        for (unsigned int p=0; p<resolution; ++p) {
+            pair.totals[0].accesses += before[p];
+            pair.totals[1].accesses += after[p];
+            if (before[p] == 0 && after[p] == 0)
+                continue;
+            ++pair.comparedPixels;
+            if (before[p] != after[p])
+                ++pair.changedPixels;
+            raster::setPixel(pixels + p*3, diffColor(before[p], after[p]));
+        }
+    }
+}
+
+static std::string signedDelta(long before, long after) {
+    long delta = after - before;
+    std::string text = (delta > 0 ? "+" : "") + std::to_string(delta);
+    if (before != 0)
+        text += " (" + std::string(delta > 0 ? "+" : "") +
+                std::to_string((int)std::lround(100.0 * delta / before)) + "%)";
+    return text;
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "[\033[92mVisual Memory Trace - Diff\033[0m] Starting up.\n";
+
+    std::vector<std::string> files;
+    std::string outputImageFilename = "trace_diff.png";
+    std::string csvFilename = "trace_diff.csv";
+    int threads = 4;
+    int blockRows = 256;
+
+    for (int a=1; a<argc; ++a)
+    {
+        std::string arg(argv[a]);
+        if (arg.substr(0,6) == "--out=")
+            outputImageFilename = arg.substr(6, std::string::npos);
+        else if (arg.substr(0,6) == "--csv=")
+            csvFilename = arg.substr(6, std::string::npos);
+        else if (arg.substr(0,10) == "--threads=")
+            threads = std::max(1, std::atoi(arg.substr(10, std::string::npos).c_str()));
+        else if (arg.substr(0,13) == "--block_rows=")
+            blockRows = std::max(1, std::atoi(arg.substr(13, std::string::npos).c_str()));
+        else
+            files.push_back(arg);
+    }
+
+    if (files.size() != 2) {
+        std::cerr << "Usage: vis_mem_diff before.trace after.trace [--out=trace_diff.png] [--csv=trace_diff.csv] [--threads=4] [--block_rows=256]\n";
+        return 1;
+    }
+
+    TraceFileView views[2];
+    for (int v=0; v<2; ++v)
+        if (!views[v].open(files[v]))
+            return 1;
+
+    // rows of the finer trace are summed onto the rows of the coarser one,
+    // as when one capture coarsened its rows more often than the other.
+    unsigned long coarseInstructionsPerRow = std::max(views[0].instructionsPerRow, views[1].instructionsPerRow);
+    size_t rowScale[2];
+    for (int v=0; v<2; ++v)
+        rowScale[v] = std::max(1ul, (coarseInstructionsPerRow + views[v].instructionsPerRow / 2) / std::max(1ul, views[v].instructionsPerRow));
+    if (views[0].instructionsPerRow != views[1].instructionsPerRow) {
+        bool exact = rowScale[0] * views[0].instructionsPerRow == rowScale[1] * views[1].instructionsPerRow;
+        std::cout << "[\033[92mVMT\033[0m] Traces have different instructions per row ("
+                  << views[0].instructionsPerRow << " and " << views[1].instructionsPerRow
+                  << "), comparing " << rowScale[0] << " row(s) of the first with " << rowScale[1]
+                  << " row(s) of the second" << (exact ? "" : ", which cover different numbers of instructions") << ".\n";
+    }
+
+    // match regions by name, the first unmatched region of each name is used
+    std::vector<RegionPair> pairs;
+    std::vector<bool> used(views[1].regions.size(), false);
+    std::vector<std::string> unmatched[2];
+    for (size_t r=0; r<views[0].regions.size(); ++r) {
+        int match = -1;
+        for (size_t s=0; s<views[1].regions.size() && match == -1; ++s)
+            if (!used[s] && views[1].regions[s].name == views[0].regions[r].name)
+                match = s;
+        if (match == -1) {
+            unmatched[0].push_back(views[0].regions[r].name);
+            continue;
+        }
+        used[match] = true;
+        RegionPair pair;
+        pair.name = views[0].regions[r].name;
+        pair.index[0] = r;
+        pair.index[1] = match;
+        pair.changedPixels = 0;
+        pair.comparedPixels = 0;
+        pairs.push_back(pair);
+    }
+    for (size_t s=0; s<views[1].regions.size(); ++s)
+        if (!used[s])
+            unmatched[1].push_back(views[1].regions[s].name);
+
+    for (auto &pair : pairs)
+        for (int v=0; v<2; ++v)
+            for (auto &row : views[v].regions[pair.index[v]].traffic)
+                pair.totals[v].bytes += row.total();
+
+    // lay the regions out side by side under a header of their names
+    const int margin = 20, spacing = 40, headerHeight = 60;
+    int width = margin;
+    for (auto &pair : pairs) {
+        pair.left = width;
+        width += pairResolution(views, pair) + spacing;
+    }
+    width = std::max(width - spacing + margin, 2 * margin + 1);
+    size_t rows = std::max((views[0].traceRows + rowScale[0] - 1) / rowScale[0],
+                           (views[1].traceRows + rowScale[1] - 1) / rowScale[1]);
+
+    raster::Canvas image(raster::Size(width, headerHeight + rows + margin), raster::Color(255, 255, 255));
+    for (auto &pair : pairs) {
+        unsigned int resolution = pairResolution(views, pair);
+        image.putText(pair.name, raster::Point(pair.left, headerHeight - 15),
+                      raster::FONT_TRIPLEX, 1.0, raster::Color(0, 0, 0), 1);
+        image.rectangle(raster::Point(pair.left - 1, headerHeight - 1),
+                        raster::Point(pair.left + resolution, headerHeight + rows),
+                        raster::Color(0, 0, 0), 1);
+    }
+
+    // Rows are produced top to bottom as the image is written, the first
+    // region asked for a row outside the current block diffs the next block
+    // of every region in parallel.
+    class BlockState {
+    public:
+        size_t top = 0, count = 0;
+    };
+    std::shared_ptr<BlockState> state = std::make_shared<BlockState>();
+    auto ensureBlock = [&, state](size_t row) {
+        if (row >= state->top && row < state->top + state->count)
+            return;
+        state->top = (row / blockRows) * blockRows;
+        state->count = std::min((size_t)blockRows, rows - state->top);
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (int t=0; t<threads; ++t)
+            workers.push_back(std::thread([&]() {
+                for (size_t p = next++; p < pairs.size(); p = next++)
+                    diffBlock(views, rowScale, pairs[p], state->top, state->count);
+            }));
+        for (auto &worker : workers)
+            worker.join();
+    };
+
+    for (auto &pair : pairs) {
+        unsigned int resolution = pairResolution(views, pair);
+        RegionPair *pairPtr = &pair;
+        image.rowLayer(raster::Rect(pair.left, headerHeight, resolution, rows),
+                       [pairPtr, resolution, state, ensureBlock](int r, unsigned char *pixels) {
+            ensureBlock(r);
+            std::copy(pairPtr->block.begin() + (r - state->top) * resolution * 3,
+                      pairPtr->block.begin() + (r - state->top + 1) * resolution * 3,
+                      pixels);
+        });
+    }
+
+    if (rows > 0 && !pairs.empty())
+        image.save(outputImageFilename);
+    else
+        std::cout << "[\033[92mVMT\033[0m] No matching regions with rows to draw.\n";
+
+    // Activity totals by name, and each occurrence of a name compared with
+    // the occurrence of the same number in the other trace, numbered in
+    // order of their start.
+    std::map<std::string, Totals> activityTotals[2];
+    std::map<std::string, std::vector<std::pair<unsigned long, Totals> > > occurrenceTotals[2];
+    std::vector<std::string> activityNames;
+    unsigned long traceEnd[2];
+    for (int v=0; v<2; ++v)
+        traceEnd[v] = views[v].traceStartInstruction + views[v].traceRows * views[v].instructionsPerRow;
+    for (int v=0; v<2; ++v)
+        for (size_t a=1; a<views[v].activities.size(); ++a) {
+            const Activity &activity = views[v].activities[a];
+            if (activityTotals[0].count(activity.name) == 0 && activityTotals[1].count(activity.name) == 0)
+                activityNames.push_back(activity.name);
+            Totals &totals = activityTotals[v][activity.name];
+            for (auto &occ : activity.occurrences) {
+                // occurrences never stopped run to the end of the trace, as in saveChromeTrace
+                unsigned long stop = occ.stop >= occ.start ? occ.stop : std::max(traceEnd[v], occ.start);
+                Totals occurrence;
+                occurrence.occurrences = 1;
+                occurrence.instructions = stop - occ.start;
+                occurrence.bytes = occ.traffic.total();
+                occurrenceTotals[v][activity.name].push_back(std::make_pair(occ.start, occurrence));
+                ++totals.occurrences;
+                totals.instructions += occurrence.instructions;
+                totals.bytes += occurrence.bytes;
+            }
+        }
+    for (int v=0; v<2; ++v)
+        for (auto &entry : occurrenceTotals[v])
+            std::stable_sort(entry.second.begin(), entry.second.end(),
+                             [](const std::pair<unsigned long, Totals> &a, const std::pair<unsigned long, Totals> &b) {
+                return a.first < b.first;
+            });
+
+    std::ofstream csv(csvFilename);
+    if (!csv.is_open())
+        std::cerr << "Could not open \"" << csvFilename << "\" to save diff statistics" << std::endl;
+    csv << "scope,name,metric,before,after,delta\n";
+    auto report = [&](const char *scope, const std::string &name, const char *metric, unsigned long before, unsigned long after) {
+        csv << scope << "," << name << "," << metric << "," << before << "," << after << "," << ((long)after - (long)before) << "\n";
+        std::cout << "    " << metric << " : " << before << " -> " << after << "  " << signedDelta(before, after) << "\n";
+    };
+
+    unsigned long instructionsPerRow[2] = { views[0].instructionsPerRow, views[1].instructionsPerRow };
+    for (auto &pair : pairs) {
+        std::cout << "[" << pair.name << "] " << pair.changedPixels << " of " << pair.comparedPixels << " accessed pixels changed\n";
+        report("region", pair.name, "accesses", pair.totals[0].accesses, pair.totals[1].accesses);
+        report("region", pair.name, "bytes", pair.totals[0].bytes, pair.totals[1].bytes);
+        report("region", pair.name, "active_instructions",
+               pair.totals[0].activeRows * instructionsPerRow[0], pair.totals[1].activeRows * instructionsPerRow[1]);
+    }
+    for (auto &name : activityNames) {
+        std::cout << "[" << name << "]\n";
+        Totals &before = activityTotals[0][name], &after = activityTotals[1][name];
+        report("activity", name, "occurrences", before.occurrences, after.occurrences);
+        report("activity", name, "bytes", before.bytes, after.bytes);
+        report("activity", name, "active_instructions", before.instructions, after.instructions);
+
+        // an occurrence missing from one trace counts as zero there
+        std::vector<std::pair<unsigned long, Totals> > &occBefore = occurrenceTotals[0][name], &occAfter = occurrenceTotals[1][name];
+        for (size_t n=0; n<std::max(occBefore.size(), occAfter.size()); ++n) {
+            Totals none;
+            const Totals &b = n < occBefore.size() ? occBefore[n].second : none;
+            const Totals &a = n < occAfter.size() ? occAfter[n].second : none;
+            std::string occName = name + "#" + std::to_string(n);
+            std::cout << "[" << occName << "]\n";
+            report("occurrence", occName, "bytes", b.bytes, a.bytes);
+            report("occurrence", occName, "active_instructions", b.instructions, a.instructions);
+        }
+    }
+    for (int v=0; v<2; ++v)
+        for (auto &name : unmatched[v])
+            std::cout << "[\033[92mVMT\033[0m] Region \"" << name << "\" is only in " << files[v] << "\n";
+
+    std::cout << "Complete.\n";
+
+    return 0;
+}
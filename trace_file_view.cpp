@@ -0,0 +1,325 @@
+#include "trace_file_view.h"
+#include "trace_session.h"
+
+#include <iostream>
+#include <cstring>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+// size of a MemoryReading as written by operator<<
+static const size_t readingSize = 3 * sizeof (unsigned short) + 2 * sizeof (MemoryRegion::AccessType);
+
+TraceFileView::TraceFileView() : data(nullptr), size(0), fd(-1) {
+    version = 1;
+}
+
+TraceFileView::~TraceFileView() {
+    close();
+}
+
+template <class T>
+bool TraceFileView::read(size_t &pos, T &value) const {
+    if (pos + sizeof (T) > size)
+        return false;
+    std::memcpy(&value, data + pos, sizeof (T));
+    pos += sizeof (T);
+    return true;
+}
+
+bool TraceFileView::readString(size_t &pos, std::string &value) const {
+    const void *end = std::memchr(data + pos, '\0', size - pos);
+    if (end == nullptr)
+        return false;
+    size_t length = (const unsigned char*)end - (data + pos);
+    value.assign((const char*)data + pos, length);
+    pos += length + 1;
+    return true;
+}
+
+bool TraceFileView::skipRow(size_t &pos) const {
+    MemoryRegion::CompBlockType type;
+    do {
+        if (!read(pos, type))
+            return false;
+        size_t blockSize = 0;
+        if (type == MemoryRegion::Data) {
+            if (!read(pos, blockSize))
+                return false;
+            pos += blockSize * readingSize;
+        } else if (type == MemoryRegion::Repeat) {
+            if (!read(pos, blockSize))
+                return false;
+            pos += readingSize;
+        } else if (type != MemoryRegion::End)
+            return false;
+    } while (type != MemoryRegion::End);
+    return pos <= size;
+}
+
+bool TraceFileView::open(const std::string &filename) {
+    close();
+
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open trace file \"" << filename << "\"\n";
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size = st.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Could not map trace file \"" << filename << "\"\n";
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    data = (const unsigned char*)mapping;
+
+    // header, version 1 files have none
+    size_t pos = 0;
+    version = 1;
+    if (size >= 12 && std::memcmp(data, "VMTRACE", 8) == 0) {
+        pos = 8;
+        read(pos, version);
+    }
+
+    bool ok = read(pos, boxAlpha) &&
+              read(pos, instructionsPerRow) &&
+              read(pos, maxTraceRows) &&
+              read(pos, traceStartInstruction);
+
+    size_t count = 0;
+    ok = ok && read(pos, count);
+    for (size_t r=0; ok && r<count; ++r) {
+        RegionInfo region;
+        region.firstRow = 0;
+        region.retired = false;
+        size_t rows = 0;
+        ok = read(pos, region.startAddr) &&
+             read(pos, region.endAddr) &&
+             readString(pos, region.name) &&
+             read(pos, region.resolution) &&
+             read(pos, region.loadCount) &&
+             read(pos, region.storeCount) &&
+             read(pos, rows);
+        if (!ok)
+            break;
+        // every row takes at least a byte, so a corrupt count can't reserve more than the file
+        region.rowOffsets.reserve(std::min(rows, size - pos));
+        for (size_t i=0; ok && i<rows; ++i) {
+            region.rowOffsets.push_back(pos);
+            ok = skipRow(pos);
+        }
+        regions.push_back(region);
+    }
+
+    ok = ok && read(pos, count);
+    for (size_t a=0; ok && a<count; ++a) {
+        std::string name;
+        unsigned long addr = 0;
+        size_t occurrences = 0;
+        ok = readString(pos, name) && read(pos, addr) && read(pos, occurrences);
+        if (!ok)
+            break;
+        Activity activity(name, addr);
+        for (size_t o=0; ok && o<occurrences; ++o) {
+            Activity::Occurrence occ(0);
+            ok = read(pos, occ.start) && read(pos, occ.stop);
+            activity.occurrences.push_back(occ);
+        }
+        activities.push_back(activity);
+    }
+
+    // time-memory areas are not needed by the view, skip to the sections
+    size_t areaSize = 6 * sizeof (unsigned long) + (version >= 2 ? 2 * sizeof (unsigned int) : 0);
+    ok = ok && read(pos, count) && count <= (size - pos) / areaSize;
+    if (ok)
+        pos += count * areaSize;
+
+    if (ok && version >= 3) {
+        unsigned int tag;
+        while ((ok = read(pos, tag)) && tag != TraceSession::EndOfSections) {
+            unsigned long length;
+            ok = read(pos, length) && pos + length <= size;
+            if (!ok)
+                break;
+            size_t sectionPos = pos;
+            if (tag == TraceSession::RegionSpans) {
+                for (auto &region : regions) {
+                    unsigned long firstRow = 0, lastRow = 0;
+                    char retired = 0;
+                    ok = read(sectionPos, firstRow) &&
+                         read(sectionPos, lastRow) &&
+                         read(sectionPos, retired);
+                    if (!ok)
+                        break;
+                    region.firstRow = firstRow;
+                    region.retired = retired;
+                }
+            }
+            else if (tag == TraceSession::Traffic) {
+                std::istringstream section(std::string((const char*)data + pos, length));
+                for (auto &region : regions) {
+                    unsigned long rows = ByteTraffic::readVarint(section);
+                    if (rows > region.rowOffsets.size())
+                        break;
+                    region.traffic.resize(rows);
+                    for (auto &row : region.traffic)
+                        row.fromStream(section);
+                }
+                for (auto &activity : activities) {
+                    unsigned long count = ByteTraffic::readVarint(section);
+                    for (unsigned long o=0; o<count; ++o) {
+                        ByteTraffic traffic;
+                        traffic.fromStream(section);
+                        if (o < activity.occurrences.size())
+                            activity.occurrences[o].traffic = traffic;
+                    }
+                }
+            }
+            else if (tag == TraceSession::WindowIndexes) {
+                unsigned int blockRows = 0;
+                read(sectionPos, blockRows);
+                for (auto &region : regions) {
+                    WindowIndex::Table table;
+                    if (blockRows == 0 ||
+                        !read(sectionPos, table.rows) ||
+                        !read(sectionPos, table.resolution))
+                        break;
+                    size_t tableSize = WindowIndex::tableSize(table.rows, table.resolution, blockRows);
+                    if (sectionPos + tableSize > pos + length)
+                        break;
+                    table.blockRows = blockRows;
+                    table.data = data + sectionPos;
+                    if (table.rows == region.rowOffsets.size() && table.resolution == region.resolution)
+                        region.index = table;
+                    sectionPos += tableSize;
+                }
+            }
+            if (!ok)
+                break;
+            pos += length;
+        }
+    }
+
+    traceRows = 0;
+    for (auto &region : regions)
+        traceRows = std::max(traceRows, region.firstRow + region.rowOffsets.size());
+
+    if (!ok) {
+        std::cerr << "Trace file \"" << filename << "\" is truncated or corrupt.\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TraceFileView::close() {
+    if (data != nullptr)
+        munmap((void*)data, size);
+    if (fd >= 0)
+        ::close(fd);
+    data = nullptr;
+    size = 0;
+    fd = -1;
+    regions.clear();
+    activities.clear();
+}
+
+void TraceFileView::readRow(size_t r, size_t row, std::vector<MemoryRegion::MemoryReading> &line) const {
+
+    line.clear();
+    size_t pos = regions[r].rowOffsets[row];
+    MemoryRegion::CompBlockType type = MemoryRegion::End;
+    MemoryRegion::MemoryReading reading;
+
+    auto decode = [&](size_t p) {
+        std::memcpy(&reading.loadCount, data + p, sizeof (unsigned short));
+        std::memcpy(&reading.storeCount, data + p + 2, sizeof (unsigned short));
+        std::memcpy(&reading.modCount, data + p + 4, sizeof (unsigned short));
+        std::memcpy(&reading.firstOp, data + p + 6, sizeof (MemoryRegion::AccessType));
+        std::memcpy(&reading.lastOp, data + p + 7, sizeof (MemoryRegion::AccessType));
+    };
+
+    do {
+        // a row cut short by the end of the file ends where it is cut
+        if (!read(pos, type))
+            break;
+        size_t blockSize = 0;
+        if (type == MemoryRegion::Data) {
+            read(pos, blockSize);
+            for (size_t i=0; i<blockSize; ++i) {
+                decode(pos);
+                line.push_back(reading);
+                pos += readingSize;
+            }
+        } else if (type == MemoryRegion::Repeat) {
+            read(pos, blockSize);
+            decode(pos);
+            line.insert(line.end(), blockSize, reading);
+            pos += readingSize;
+        }
+    } while (type != MemoryRegion::End);
+}
+
+unsigned int TraceFileView::RegionInfo::column(unsigned long addr) const {
+    if (addr <= startAddr)
+        return 0;
+    if (addr >= endAddr)
+        return resolution;
+    return ((addr - startAddr) * resolution) / (endAddr - startAddr);
+}
+
+WindowIndex::Counts TraceFileView::windowCounts(size_t r,
+                                                size_t firstRow, size_t endRow,
+                                                unsigned int firstColumn, unsigned int endColumn) const {
+    const RegionInfo &region = regions[r];
+    const WindowIndex::Table &index = region.index;
+    endRow = std::min(endRow, region.rowOffsets.size());
+    endColumn = std::min(endColumn, region.resolution);
+
+    WindowIndex::Counts counts;
+    if (firstRow >= endRow || firstColumn >= endColumn)
+        return counts;
+
+    // whole blocks from the index, the rows either side decoded
+    size_t firstBlock = 0, endBlock = 0;
+    if (!index.empty()) {
+        firstBlock = (firstRow + index.blockRows - 1) / index.blockRows;
+        endBlock = endRow == region.rowOffsets.size() ? index.blocks() : endRow / index.blockRows;
+    }
+
+    std::vector<MemoryRegion::MemoryReading> line;
+    auto decode = [&](size_t from, size_t to) {
+        for (size_t row=from; row<to; ++row) {
+            readRow(r, row, line);
+            for (unsigned int x=firstColumn; x<endColumn && x<line.size(); ++x)
+                counts.add(line[x]);
+        }
+    };
+
+    if (firstBlock < endBlock) {
+        counts += index.sum(firstBlock, endBlock, firstColumn, endColumn);
+        decode(firstRow, index.blockStart(firstBlock));
+        decode(index.blockStart(endBlock), endRow);
+    }
+    else
+        decode(firstRow, endRow);
+    return counts;
+}
+
+void TraceFileView::readRows(size_t r,
+                             size_t firstRow,
+                             size_t count,
+                             std::vector<std::vector<MemoryRegion::MemoryReading> > &rows) const {
+    size_t end = std::min(firstRow + count, regions[r].rowOffsets.size());
+    rows.resize(end > firstRow ? end - firstRow : 0);
+    for (size_t row=firstRow; row<end; ++row)
+        readRow(r, row, rows[row - firstRow]);
+}
@@ -0,0 +1,91 @@
+#ifndef __TRACE_FILE_VIEW_H__
+#define __TRACE_FILE_VIEW_H__
+
+#include <string>
+#include <vector>
+
+#include "memory_region.h"
+#include "activity.h"
+#include "byte_traffic.h"
+#include "window_index.h"
+
+/*
+    Read only, memory mapped view of a trace file.
+
+    Opening the view makes a single pass over the file recording where the
+    compressed data of every trace row starts, without decoding any of it.
+    Arbitrary row ranges of any region can then be decoded directly from the
+    mapping, so tools can work on very large traces in bounded memory.
+*/
+class TraceFileView
+{
+public:
+    class RegionInfo {
+    public:
+        std::string name;
+        unsigned long startAddr, endAddr;
+        unsigned int resolution;
+        unsigned long loadCount, storeCount;
+        std::vector<size_t> rowOffsets;
+
+        // session row of the region's first row, see MemoryRegion
+        size_t firstRow;
+        bool retired;
+
+        // bytes accessed per row, empty if the file has no traffic section
+        std::vector<ByteTraffic> traffic;
+
+        // summed-area index into the mapping, empty if none was saved
+        WindowIndex::Table index;
+
+        // pixel column holding a byte address, clamped to the region
+        unsigned int column(unsigned long addr) const;
+    };
+
+    TraceFileView();
+    ~TraceFileView();
+
+    bool open(const std::string &filename);
+    void close();
+
+    // decodes count rows of region r starting at firstRow into rows,
+    // rows past the end of the region are left out.
+    void readRows(size_t r,
+                  size_t firstRow,
+                  size_t count,
+                  std::vector<std::vector<MemoryRegion::MemoryReading> > &rows) const;
+
+    void readRow(size_t r, size_t row, std::vector<MemoryRegion::MemoryReading> &line) const;
+
+    // load, store and modify counts of region r in rows [firstRow, endRow)
+    // of the region and pixel columns [firstColumn, endColumn). Uses the
+    // region's index when there is one, decoding only the rows outside
+    // whole index blocks, otherwise decodes every row of the window.
+    WindowIndex::Counts windowCounts(size_t r,
+                                     size_t firstRow, size_t endRow,
+                                     unsigned int firstColumn, unsigned int endColumn) const;
+
+    unsigned int version;
+    float boxAlpha;
+    unsigned long instructionsPerRow;
+    unsigned long maxTraceRows;
+    unsigned long traceStartInstruction;
+
+    // number of rows in the whole trace
+    size_t traceRows;
+
+    std::vector<RegionInfo> regions;
+    std::vector<Activity> activities;
+
+private:
+    template <class T>
+    bool read(size_t &pos, T &value) const;
+    bool readString(size_t &pos, std::string &value) const;
+    bool skipRow(size_t &pos) const;
+
+    const unsigned char *data;
+    size_t size;
+    int fd;
+};
+
+#endif  // __TRACE_FILE_VIEW_H__
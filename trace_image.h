@@ -4,7 +4,12 @@
 #include <vector>
 #include <iomanip>
 //#include <initializer_list>
-#include <opencv2/opencv.hpp>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include "raster.h"
 
 #include "activity.h"
 #include "memory_region.h"
@@ -16,20 +21,9 @@ public:
 
     class FontSettings {
     public:
-        FontSettings() : face(CV_FONT_HERSHEY_TRIPLEX), scale(1.0), thickness(1) {
-            cvInitFont(&font,
-                       face,
-                       scale, scale,
-                       thickness);
-        }
-        FontSettings(int face, double scale, int thickness=1) : face(face), scale(scale), thickness(thickness) {
-            cvInitFont(&font,
-                       face,
-                       scale, scale,
-                       thickness);
-        };
-
-        CvFont font;
+        FontSettings() : face(raster::FONT_TRIPLEX), scale(1.0), thickness(1) {}
+        FontSettings(int face, double scale, int thickness=1) : face(face), scale(scale), thickness(thickness) {};
+
         int face;
         double scale;
         int thickness;
@@ -37,17 +31,29 @@ public:
 
     class moveableLabel {
     public:
-        moveableLabel(cv::Point position, cv::Size size) {
+        moveableLabel(raster::Point position, raster::Size size) {
             this->size = size;
             origPosition = position;
             newPosition = position;
         }
 
-        cv::Size size;
-        cv::Point origPosition, newPosition;
+        raster::Size size;
+        raster::Point origPosition, newPosition;
     };
 
-    void saveTraceImage(std::vector<MemoryRegion> regions,
+    // run of pixel rows covered by one or more occurrences of an activity
+    class EventSpan {
+    public:
+        EventSpan(int activity, int top, int bottom) : activity(activity),
+                                                       top(top),
+                                                       bottom(bottom),
+                                                       count(1) {}
+        int activity;
+        int top, bottom;
+        int count;
+    };
+
+    void saveTraceImage(const std::vector<MemoryRegion> &regions,
                         std::string filename,
                         std::string title = "Title",
                         bool memoryBlocks = true,
@@ -55,12 +61,15 @@ public:
 
     TraceImage() {
         // set default fonts
-        titleFont = FontSettings(CV_FONT_HERSHEY_TRIPLEX, 5.0, 5);
-        memoryLabelFont = FontSettings(CV_FONT_HERSHEY_TRIPLEX, 1.5, 2);
-        regionTitleFont = FontSettings(CV_FONT_HERSHEY_TRIPLEX, 3.0, 4);
-        operationLabelFont = FontSettings(CV_FONT_HERSHEY_TRIPLEX, 1.3, 2);
+        titleFont = FontSettings(raster::FONT_TRIPLEX, 5.0, 5);
+        memoryLabelFont = FontSettings(raster::FONT_TRIPLEX, 1.5, 2);
+        regionTitleFont = FontSettings(raster::FONT_TRIPLEX, 3.0, 4);
+        operationLabelFont = FontSettings(raster::FONT_TRIPLEX, 1.3, 2);
 
         operationBarWidth = 100;
+        sparklineWidth = 60;
+        patternBandWidth = 20;
+        sparklineGap = 20;
         imageMargin = 200;
     }
 
@@ -69,6 +78,9 @@ public:
     FontSettings regionTitleFont;
     FontSettings operationLabelFont;
     int operationBarWidth;
+    int sparklineWidth;
+    int sparklineGap;
+    int patternBandWidth;
     int imageMargin;
 
 private:
@@ -78,10 +90,10 @@ private:
                              int targetStep_pixels,
                              std::initializer_list<float> scaleJumpsI = {2.0});
 
-    void drawInsAxis(cv::Mat region, unsigned long instructionCount);
-    void drawInstructionTick(cv::Mat target,
+    void drawInsAxis(raster::Canvas region, unsigned long instructionCount);
+    void drawInstructionTick(raster::Canvas target,
                              unsigned long ins,
-                             cv::Point pos);
+                             raster::Point pos);
 
     void spreadoutLabels(std::vector<moveableLabel> *labels,
                          int min,
@@ -92,9 +104,20 @@ private:
     int getTitleHeight();
     int getOperationsWidth();
 
-    int drawRegionTrace(cv::Mat region, MemoryRegion memRegion, bool memoryBlocks = true);
-    std::vector<int> drawEventBlocks(cv::Mat region);
-    void drawMemoryScale(cv::Mat region,
+    void findEventSpans(std::vector<EventSpan> *spans,
+                        std::vector<EventSpan> *labels);
+    std::string eventLabelText(const EventSpan &label);
+
+    int drawRegionTrace(raster::Canvas region, const MemoryRegion &memRegion, bool memoryBlocks = true);
+    int getSparklineSpace();
+    void drawTrafficSparkline(raster::Canvas region, const MemoryRegion &memRegion);
+    raster::RowFunction traceRowFunction(const MemoryRegion &memRegion);
+    raster::RowFunction areaRowFunction(const MemoryRegion &memRegion, int rows);
+    raster::RowFunction missRowFunction(const MemoryRegion &memRegion, int level);
+    std::vector<int> drawEventBlocks(raster::Canvas region);
+    static raster::Color patternColor(PatternDetector::Pattern pattern);
+    static raster::Color zoomColor(size_t zoom);
+    void drawMemoryScale(raster::Canvas region,
                          unsigned long memRange,
                          int approxPixelsPerDivision = 400);
 
@@ -158,15 +181,14 @@ std::string TraceImage::floatSigDigits(T f, int n)
     return ss.str();
 }
 
-void TraceImage::drawInstructionTick(cv::Mat target,
+void TraceImage::drawInstructionTick(raster::Canvas target,
                                      unsigned long ins,
-                                     cv::Point pos) {
+                                     raster::Point pos) {
 
-    cv::line(target,
-             pos,
-             pos - cv::Point(40,0),
-             cv::Scalar(0, 0, 0),
-             3);
+    target.line(pos,
+                pos - raster::Point(40,0),
+                raster::Color(0, 0, 0),
+                3);
 
     std::string tickLabel = std::to_string(ins);
     if (ins >= 1000)
@@ -177,23 +199,22 @@ void TraceImage::drawInstructionTick(cv::Mat target,
         tickLabel = floatSigDigits(ins / 1000000000.0, 3) + " G";
 
     int baseline;
-    cv::Size textSize = cv::getTextSize(tickLabel,
-                                        memoryLabelFont.face,
-                                        memoryLabelFont.scale,
-                                        memoryLabelFont.thickness,
-                                        &baseline);
-
-    cv::putText(target,
-                tickLabel,
-                cv::Point(pos.x - 50 - textSize.width,
-                          pos.y + textSize.height/2),
-                memoryLabelFont.face,
-                memoryLabelFont.scale,
-                cv::Scalar(0, 0, 0),
-                memoryLabelFont.thickness);
+    raster::Size textSize = raster::getTextSize(tickLabel,
+                                                memoryLabelFont.face,
+                                                memoryLabelFont.scale,
+                                                memoryLabelFont.thickness,
+                                                &baseline);
+
+    target.putText(tickLabel,
+                   raster::Point(pos.x - 50 - textSize.width,
+                                 pos.y + textSize.height/2),
+                   memoryLabelFont.face,
+                   memoryLabelFont.scale,
+                   raster::Color(0, 0, 0),
+                   memoryLabelFont.thickness);
 }
 
-void TraceImage::drawInsAxis(cv::Mat region, unsigned long instructionCount) {
+void TraceImage::drawInsAxis(raster::Canvas region, unsigned long instructionCount) {
 
     int header = imageMargin + getTitleHeight() + getHeaderHeight();
     int baseline;
@@ -207,10 +228,9 @@ void TraceImage::drawInsAxis(cv::Mat region, unsigned long instructionCount) {
                                           {2.0, 2.5, 2.0});  // Jumps needed to create a 1 2 5 10 20 50 100 200 . . . sequence.
 
     // draw axis edge line
-    cv::line(region,
-             cv::Point(region.cols-1, header),
-             cv::Point(region.cols-1, region.rows - imageMargin - 1),
-             cv::Scalar(0, 0, 0));
+    region.line(raster::Point(region.cols-1, header),
+                raster::Point(region.cols-1, region.rows - imageMargin - 1),
+                raster::Color(0, 0, 0));
 
     // draw tick marks and labels
     for (unsigned long ins=0; ins <= instructionCount; ins += insPerTick) {
@@ -219,44 +239,29 @@ void TraceImage::drawInsAxis(cv::Mat region, unsigned long instructionCount) {
 
         drawInstructionTick(region,
                             ins,
-                            cv::Point(region.cols-1, header + pos));
+                            raster::Point(region.cols-1, header + pos));
     }
 
     // draw final tick with total instruction count
     drawInstructionTick(region,
                         instructionCount,
-                        cv::Point(region.cols-1, region.rows - imageMargin));
+                        raster::Point(region.cols-1, region.rows - imageMargin));
 
     // draw axis label
     std::string text = "Instructions";
 
-    cv::Size textSize = cv::getTextSize(text,
-                                        regionTitleFont.face,
-                                        regionTitleFont.scale,
-                                        regionTitleFont.thickness,
-                                        &baseline);
-    cv::Mat textMat(textSize, CV_8UC3, cv::Scalar(255, 255, 255));
-    cv::putText(textMat,
-                text,
-                cv::Point(0, textMat.rows-1),
-                regionTitleFont.face,
-                regionTitleFont.scale,
-                cv::Scalar(0, 0, 0),
-                regionTitleFont.thickness);
-
-    //std::cout << "textMat size (" << textMat.cols << ", " << textMat.rows << "]\n";
-
-    cv::Mat textRot(textSize.height, textSize.width, CV_8UC3);
-
-    //std::cout << "textRot size (" << textRot.cols << ", " << textRot.rows << "]\n";
-
-    cv::transpose(textMat, textRot);
-    cv::flip(textRot, textRot, 0);
-    //cv::rotate(textMat, textMat, cv::ROTATE_90_COUNTERCLOCKWISE);
-
-    cv::Point textLoc(100, (region.rows-header)/2 - (textMat.rows/2));
-    textRot.copyTo(region(cv::Rect(textLoc.x, textLoc.y,
-                                   textRot.cols, textRot.rows)));
+    raster::Size textSize = raster::getTextSize(text,
+                                                regionTitleFont.face,
+                                                regionTitleFont.scale,
+                                                regionTitleFont.thickness,
+                                                &baseline);
+    raster::Point textLoc(100, (region.rows-header)/2 - (textSize.width/2));
+    region.putTextVertical(text,
+                           textLoc,
+                           regionTitleFont.face,
+                           regionTitleFont.scale,
+                           raster::Color(0, 0, 0),
+                           regionTitleFont.thickness);
 }
 
 void TraceImage::spreadoutLabels(std::vector<moveableLabel> *labels,
@@ -264,58 +269,82 @@ void TraceImage::spreadoutLabels(std::vector<moveableLabel> *labels,
                                  int max,
                                  int border) {
 
-    // use a repulsive field to iteratively move the labels until they
-    // stop moving
-    int totalMovement;
-    do {
-        // calcaulte repulsive forces
-        std::vector<int> forces(labels->size(), 0);
-        for (int l=0; l<labels->size()-1; ++l) {
-            int dist = abs((*labels)[l+1].newPosition.y - (*labels)[l].newPosition.y);
-            dist -= (*labels)[l+1].size.height / 2;
-            dist -= (*labels)[l].size.height / 2;
-
-            if (dist < border) {
-                if ((*labels)[l+1].newPosition.y < (*labels)[l].newPosition.y) {
-                    forces[l+1] -= 1;
-                    forces[l] += 1;
-                } else {
-                    forces[l+1] += 1;
-                    forces[l] -= 1;
-                }
-            }
-        }
-
-        //for (auto const& force: forces)
-        //    std::cout << "force [" << force << "]\n";
-        //std::cout << "pos[0] = " << (*labels)[0].newPosition.y << "\n";
-
-        // apply forces
-        totalMovement = 0;
-        for (int l=0; l<labels->size(); ++l) {
-            int oldy = (*labels)[l].newPosition.y;
-            (*labels)[l].newPosition.y += forces[l];
-
-            if ((*labels)[l].newPosition.y < min)
-                (*labels)[l].newPosition.y = min;
-            if ((*labels)[l].newPosition.y > max)
-                (*labels)[l].newPosition.y = max;
-
-            totalMovement += abs(oldy - (*labels)[l].newPosition.y);
+    if (labels->size() == 0)
+        return;
+
+    // keep the current top to bottom ordering of the labels
+    std::vector<size_t> order(labels->size());
+    for (size_t l=0; l<order.size(); ++l)
+        order[l] = l;
+    std::stable_sort(order.begin(), order.end(), [labels](size_t a, size_t b) {
+        return (*labels)[a].origPosition.y < (*labels)[b].origPosition.y;
+    });
+
+    // offset of each label from the first when packed as tightly as allowed
+    std::vector<long> packed(order.size(), 0);
+    for (size_t i=1; i<order.size(); ++i)
+        packed[i] = packed[i-1] +
+                    (*labels)[order[i-1]].size.height / 2 +
+                    (*labels)[order[i]].size.height / 2 +
+                    border;
+
+    // Subtracting the packed offsets turns the minimum separation
+    // constraints into a simple non-decreasing constraint, the placement
+    // closest to the original positions is then the isotonic regression of
+    // the shifted positions, found in one pass by pooling adjacent violators.
+    class Block {
+    public:
+        Block(double sum, int count, size_t end) : sum(sum), count(count), end(end) {}
+        double mean() const { return sum / count; }
+        double sum;
+        int count;
+        size_t end;
+    };
+    std::vector<Block> blocks;
+    for (size_t i=0; i<order.size(); ++i) {
+        blocks.push_back(Block((*labels)[order[i]].origPosition.y - packed[i], 1, i));
+        while (blocks.size() > 1 && blocks[blocks.size()-2].mean() > blocks.back().mean()) {
+            Block last = blocks.back();
+            blocks.pop_back();
+            blocks.back().sum += last.sum;
+            blocks.back().count += last.count;
+            blocks.back().end = last.end;
         }
+    }
 
-    }  while(totalMovement > 0);
+    std::vector<long> y(order.size());
+    size_t i = 0;
+    for (auto const& block: blocks)
+        for (; i<=block.end; ++i)
+            y[i] = std::lround(block.mean()) + packed[i];
+
+    // clamp to the bounds, pushing neighbours along so that no overlap is
+    // introduced unless there is no room for all the labels.
+    for (size_t i=0; i<y.size(); ++i) {
+        long lower = min;
+        if (i > 0)
+            lower = std::max(lower, y[i-1] + packed[i] - packed[i-1]);
+        y[i] = std::max(y[i], lower);
+    }
+    for (size_t i=y.size(); i-- > 0;) {
+        long upper = max;
+        if (i + 1 < y.size())
+            upper = std::min(upper, y[i+1] - (packed[i+1] - packed[i]));
+        y[i] = std::max<long>(std::min(y[i], upper), min);
+    }
 
+    for (size_t i=0; i<order.size(); ++i)
+        (*labels)[order[i]].newPosition.y = y[i];
 }
 
 int TraceImage::getHeaderHeight() {
 
     int baseline;
-    cv::Size textSize = cv::getTextSize("SomeText",
-                                        regionTitleFont.face,
-                                        regionTitleFont.scale,
-                                        regionTitleFont.thickness,
-                                        &baseline);
+    raster::Size textSize = raster::getTextSize("SomeText",
+                                                regionTitleFont.face,
+                                                regionTitleFont.scale,
+                                                regionTitleFont.thickness,
+                                                &baseline);
 
     return textSize.height * 3;
 }
@@ -323,280 +352,516 @@ int TraceImage::getHeaderHeight() {
 int TraceImage::getTitleHeight() {
 
     int baseline;
-    cv::Size textSize = cv::getTextSize("SomeText",
-                                        titleFont.face,
-                                        titleFont.scale,
-                                        titleFont.thickness,
-                                        &baseline);
+    raster::Size textSize = raster::getTextSize("SomeText",
+                                                titleFont.face,
+                                                titleFont.scale,
+                                                titleFont.thickness,
+                                                &baseline);
 
     return textSize.height * 2.0;
 }
 
+void TraceImage::findEventSpans(std::vector<EventSpan> *spans,
+                                std::vector<EventSpan> *labels) {
+
+    // height of an operation label, labels of the same operation closer
+    // than this are merged into a single label.
+    int baseline;
+    int labelHeight = raster::getTextSize("SomeText",
+                                          operationLabelFont.face,
+                                          operationLabelFont.scale,
+                                          operationLabelFont.thickness,
+                                          &baseline).height + 10;
+
+    for (int a=0; a<TraceSession::activities.size(); ++a) {
+
+        // pixel rows covered by each completed occurrence, in time order
+        std::vector<std::pair<long, long> > rows;
+        for (auto const& occ: TraceSession::activities[a].occurrences)
+            if (occ.stop > 0)
+                rows.push_back(std::make_pair(((long)occ.start - (long)TraceSession::traceStartInstruction) / (long)TraceSession::instructionsPerRow,
+                                              ((long)occ.stop - (long)TraceSession::traceStartInstruction) / (long)TraceSession::instructionsPerRow));
+        if (rows.size() == 0)
+            continue;
+        std::sort(rows.begin(), rows.end());
+
+        // sweep the occurrences merging those which share a pixel row, so
+        // the number of blocks drawn is bounded by the image height.
+        size_t firstSpan = spans->size();
+        spans->push_back(EventSpan(a, rows[0].first, rows[0].second));
+        for (size_t r=1; r<rows.size(); ++r) {
+            EventSpan &last = spans->back();
+            if (rows[r].first <= last.bottom) {
+                last.bottom = std::max(last.bottom, (int)rows[r].second);
+                ++last.count;
+            } else
+                spans->push_back(EventSpan(a, rows[r].first, rows[r].second));
+        }
+
+        // second sweep over the blocks of this operation, one label per
+        // cluster of blocks whose labels would otherwise collide.
+        labels->push_back((*spans)[firstSpan]);
+        for (size_t s=firstSpan+1; s<spans->size(); ++s) {
+            EventSpan &last = labels->back();
+            if ((*spans)[s].top - last.bottom < labelHeight) {
+                last.bottom = (*spans)[s].bottom;
+                last.count += (*spans)[s].count;
+            } else
+                labels->push_back((*spans)[s]);
+        }
+    }
+}
+
+std::string TraceImage::eventLabelText(const EventSpan &label) {
+    std::string text = TraceSession::activities[label.activity].name;
+    if (label.count > 1)
+        text += " x" + std::to_string(label.count);
+    return text;
+}
+
 int TraceImage::getOperationsWidth() {
 
+    std::vector<EventSpan> spans, labels;
+    findEventSpans(&spans, &labels);
+
     // find the width of the longest operation memory
     int widestOpLabel = 0;
-    for (int a=0; a<TraceSession::activities.size(); ++a)
-        if (TraceSession::activities[a].occurrences.size() > 0 &&
-            TraceSession::activities[a].occurrences[0].stop > 0)
-        {
-            // get text box size
-            int baseline;
-            cv::Size textSize = cv::getTextSize(TraceSession::activities[a].name,
-                                                operationLabelFont.face,
-                                                operationLabelFont.scale,
-                                                operationLabelFont.thickness,
-                                                &baseline);
-            widestOpLabel = std::max(widestOpLabel, textSize.width);
-        }
+    for (auto const& label: labels) {
+        // get text box size
+        int baseline;
+        raster::Size textSize = raster::getTextSize(eventLabelText(label),
+                                                    operationLabelFont.face,
+                                                    operationLabelFont.scale,
+                                                    operationLabelFont.thickness,
+                                                    &baseline);
+        widestOpLabel = std::max(widestOpLabel, textSize.width);
+    }
 
     return widestOpLabel + (operationBarWidth * 2);
 }
 
-void transRectangle(cv::Mat region,
-                    cv::Rect shape,
-                    cv::Scalar border,
-                    cv::Scalar fill,
-                    int edgeWidth,
-                    float alpha,
-                    float outlineAlpha = 1.0) {
-
-    cv::Size rectSize(shape.width, shape.height);
-    cv::Mat canvas(rectSize, CV_8UC3, fill);
-    cv::Mat targetROI = region(shape);
-    cv::addWeighted(targetROI,
-                               1.0-alpha,
-                               canvas,
-                               alpha,
-                               0,
-                               targetROI);
-
-    // v crude for now.
-    if (outlineAlpha > 0.0)
-        cv::rectangle(region,
-                      cv::Point(shape.x, shape.y),
-                      cv::Point(shape.x+shape.width-1, shape.y+shape.height-1),
-                      border,
-                      edgeWidth);
+raster::RowFunction TraceImage::areaRowFunction(const MemoryRegion &memRegion, int rows) {
+
+    class AreaBox {
+    public:
+        int left, right, top, bottom;  // right and bottom exclusive
+    };
+
+    // Composites every time-memory area of the region in one top to bottom
+    // sweep, areas are activated when the sweep reaches their first row and
+    // blended in their original order so overlaps match drawing them in turn.
+    class State {
+    public:
+        std::vector<AreaBox> boxes;
+        std::vector<size_t> byTop;
+        std::vector<size_t> active;
+        size_t next = 0;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+
+    int empty = 0;
+    for (auto const& area : TraceSession::timeMemoryAreas) {
+        if (area.endMem <= memRegion.startAddr || area.startMem >= memRegion.endAddr)
+            continue;
+        AreaBox box;
+        box.left = std::max(memRegion.memAddrToPix(std::max(area.startMem, memRegion.startAddr)), 0);
+        box.right = std::min(memRegion.memAddrToPix(std::min(area.endMem, memRegion.endAddr)), (int)memRegion.resolution);
+        box.top = ((long)area.startInstruction - (long)TraceSession::traceStartInstruction) / (long)TraceSession::instructionsPerRow;
+        box.bottom = ((long)area.endInstruction - (long)TraceSession::traceStartInstruction) / (long)TraceSession::instructionsPerRow;
+        box.top = std::max(box.top - (int)memRegion.firstRow, 0);
+        box.bottom = std::min(box.bottom - (int)memRegion.firstRow, rows);
+        if (box.right <= box.left || box.bottom <= box.top) {
+            ++empty;
+            continue;
+        }
+        state->boxes.push_back(box);
+    }
+
+    if (empty > 0)
+        std::cout << "[" << memRegion.name << "] ignored " << empty << " memory areas with zero size.\n";
+
+    state->byTop.resize(state->boxes.size());
+    for (size_t i=0; i<state->byTop.size(); ++i)
+        state->byTop[i] = i;
+    std::stable_sort(state->byTop.begin(), state->byTop.end(), [state](size_t a, size_t b) {
+        return state->boxes[a].top < state->boxes[b].top;
+    });
+
+    float alpha = TraceSession::boxAlpha;
+    float outlineAlpha = TraceSession::boxOutlineAlpha;
+
+    return [state, alpha, outlineAlpha](int r, unsigned char *pixels) {
+        const raster::Color fill(0, 255, 255);
+        const raster::Color border(0, 0, 0);
+        const int edgeWidth = 3;
+
+        while (state->next < state->byTop.size() && state->boxes[state->byTop[state->next]].top <= r) {
+            size_t idx = state->byTop[state->next++];
+            state->active.insert(std::lower_bound(state->active.begin(), state->active.end(), idx), idx);
+        }
+
+        size_t kept = 0;
+        for (size_t a=0; a<state->active.size(); ++a) {
+            const AreaBox &box = state->boxes[state->active[a]];
+            if (box.bottom <= r)
+                continue;
+            state->active[kept++] = state->active[a];
+
+            if (alpha > 0.0)
+                for (int x=box.left; x<box.right; ++x)
+                    raster::blendPixel(pixels + x*3, fill, alpha);
+
+            if (outlineAlpha > 0.0) {
+                if (r < box.top + edgeWidth || r >= box.bottom - edgeWidth)
+                    for (int x=box.left; x<box.right; ++x)
+                        raster::blendPixel(pixels + x*3, border, outlineAlpha);
+                else
+                    for (int e=0; e<edgeWidth && e<box.right-box.left; ++e) {
+                        raster::blendPixel(pixels + (box.left + e)*3, border, outlineAlpha);
+                        if (box.right - 1 - e > box.left + e)
+                            raster::blendPixel(pixels + (box.right - 1 - e)*3, border, outlineAlpha);
+                    }
+            }
+        }
+        state->active.resize(kept);
+    };
 }
 
-int TraceImage::drawRegionTrace(cv::Mat region, MemoryRegion memRegion, bool memoryBlocks) {
+raster::RowFunction TraceImage::traceRowFunction(const MemoryRegion &memRegion) {
+
+    // Rows are produced top to bottom so the 'in use' span between an access
+    // and a following load is found by keeping, for every pixel column, the
+    // row of the next access and whether that access reads the data.
+    class State {
+    public:
+        State(int resolution) : seen(resolution, false),
+                                nextRow(resolution, -1),
+                                nextIsLoad(resolution, false) {}
+        std::vector<bool> seen;
+        std::vector<int> nextRow;
+        std::vector<bool> nextIsLoad;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>(memRegion.resolution);
+    const MemoryRegion *memRegionPtr = &memRegion;
+
+    return [state, memRegionPtr](int r, unsigned char *pixels) {
+        raster::Color storeColor(0, 0, 255);
+        raster::Color loadColor(255, 0, 0);
+        raster::Color modifyColor(0, 255, 0);
+        raster::Color inUseColor(235, 235, 235);
+
+        const std::vector<std::vector<MemoryRegion::MemoryReading> > &trace = memRegionPtr->trace;
+        for (int a=0; a<memRegionPtr->resolution; ++a) {
+            const MemoryRegion::MemoryReading &reading = trace[r][a];
+            if (reading.loadCount > 0 || reading.storeCount > 0) {
+                state->seen[a] = true;
+                if (reading.loadCount > 0 && reading.storeCount > 0)
+                    raster::setPixel(pixels + a*3, modifyColor);
+                else if (reading.loadCount > 0)
+                    raster::setPixel(pixels + a*3, loadColor);
+                else
+                    raster::setPixel(pixels + a*3, storeColor);
+                continue;
+            }
+
+            if (!state->seen[a])
+                continue;
+
+            if (state->nextRow[a] <= r) {
+                int s = r + 1;
+                while (s < (int)trace.size() &&
+                       trace[s][a].loadCount == 0 &&
+                       trace[s][a].storeCount == 0)
+                    ++s;
+                state->nextRow[a] = s;
+                state->nextIsLoad[a] = s < (int)trace.size() && trace[s][a].loadCount > 0;
+            }
+
+            if (state->nextIsLoad[a])
+                raster::setPixel(pixels + a*3, inUseColor);
+        }
+    };
+}
+
+raster::RowFunction TraceImage::missRowFunction(const MemoryRegion &memRegion, int level) {
+
+    // Tints every pixel with a miss at the level, the more of the accesses
+    // to the pixel that missed the stronger the tint.
+    const MemoryRegion *memRegionPtr = &memRegion;
+
+    return [memRegionPtr, level](int r, unsigned char *pixels) {
+        const raster::Color missColor(255, 0, 255);
+
+        const std::vector<MemoryRegion::MissReading> &misses = memRegionPtr->misses[r];
+        const std::vector<MemoryRegion::MemoryReading> &readings = memRegionPtr->trace[r];
+        for (int a=0; a<memRegionPtr->resolution; ++a) {
+            unsigned int missCount = misses[a].misses[level];
+            if (missCount == 0)
+                continue;
+            unsigned int accesses = readings[a].loadCount + readings[a].storeCount + readings[a].modCount;
+            float ratio = accesses > missCount ? (float)missCount / accesses : 1.0f;
+            raster::blendPixel(pixels + a*3, missColor, 0.25f + 0.75f * ratio);
+        }
+    };
+}
+
+int TraceImage::drawRegionTrace(raster::Canvas region, const MemoryRegion &memRegion, bool memoryBlocks) {
 
     // Add title
     int headerHeight = getHeaderHeight();
     int titleHeight = getTitleHeight();
     //int scaleTop = imageMargin +  / 2;
     int baseline;
-    cv::Size textSize = cv::getTextSize(memRegion.name,
-                                        regionTitleFont.face,
-                                        regionTitleFont.scale,
-                                        regionTitleFont.thickness,
-                                        &baseline);
-
-    cv::putText(region,
-                memRegion.name,
-                cv::Point(region.cols/2 - textSize.width/2,
-                          imageMargin + titleHeight + headerHeight/4 + textSize.height/2),
-                regionTitleFont.face,
-                regionTitleFont.scale,
-                cv::Scalar(0, 0, 0),
-                regionTitleFont.thickness);
+    raster::Size textSize = raster::getTextSize(memRegion.name,
+                                                regionTitleFont.face,
+                                                regionTitleFont.scale,
+                                                regionTitleFont.thickness,
+                                                &baseline);
+
+    region.putText(memRegion.name,
+                   raster::Point(region.cols/2 - textSize.width/2,
+                                 imageMargin + titleHeight + headerHeight/4 + textSize.height/2),
+                   regionTitleFont.face,
+                   regionTitleFont.scale,
+                   raster::Color(0, 0, 0),
+                   regionTitleFont.thickness);
 
     // draw memory scale bar
-    cv::Mat scaleRegion = region(cv::Rect(0, imageMargin + titleHeight + headerHeight/2, region.cols, headerHeight/2));
-    //scaleRegion = cv::Scalar(200,255,255);
+    raster::Canvas scaleRegion = region(raster::Rect(0, imageMargin + titleHeight + headerHeight/2, region.cols, headerHeight/2));
+    //scaleRegion = raster::Color(200,255,255);
     drawMemoryScale(scaleRegion,
                     memRegion.endAddr - memRegion.startAddr);
 
+    int traceTop = imageMargin + titleHeight + headerHeight + 1;
+    int liveTop = traceTop + memRegion.firstRow;
+    int liveBottom = traceTop + memRegion.lastRow();
+    int traceBottom = traceTop + TraceSession::traceRows();
+
+    // grey out the rows before the region was added and after it was
+    // retired, marking both ends of its live span.
+    raster::Color deadColor(225, 225, 225);
+    raster::Color spanColor(96, 96, 96);
+    if (liveTop > traceTop) {
+        region.blendRect(raster::Rect(0, traceTop, memRegion.resolution, liveTop - traceTop), deadColor, 1.0);
+        region.line(raster::Point(0, liveTop), raster::Point(memRegion.resolution-1, liveTop), spanColor);
+    }
+    if (liveBottom < traceBottom) {
+        region.blendRect(raster::Rect(0, liveBottom, memRegion.resolution, traceBottom - liveBottom), deadColor, 1.0);
+        region.line(raster::Point(0, liveBottom), raster::Point(memRegion.resolution-1, liveBottom), spanColor);
+    }
+
     // Add border
-    cv::rectangle(region,
-                  cv::Point(1, imageMargin + titleHeight + headerHeight + 1),
-                  cv::Point(region.cols-1, region.rows - imageMargin - 1),
-                  cv::Scalar(0, 0, 0),
-                  3,
-                  5);
+    region.rectangle(raster::Point(1, imageMargin + titleHeight + headerHeight + 1),
+                     raster::Point(region.cols-1, region.rows - imageMargin - 1),
+                     raster::Color(0, 0, 0),
+                     3);
 
     // Add memory trace data
     // add rows of memory operations to export_trace_image
-    int traceTop = imageMargin + titleHeight + headerHeight + 1;
     if (TraceSession::showTrace) {
-        cv::Vec3b storeColor(0, 0, 255);
-        cv::Vec3b loadColor(255, 0, 0);
-        cv::Vec3b modifyColor(0, 255, 0);
-        cv::Vec3b inUseColor(235, 235, 235);
-        cv::Vec3b inOutColor(170, 225, 225);
-        for (int a=0; a<memRegion.resolution; ++a) {
-            bool dataPresent = false;
-            int lastStore = -1;
-            for (int r=0; r<memRegion.trace.size(); ++r) {
-                if (memRegion.trace[r][a].loadCount > 0 && memRegion.trace[r][a].storeCount > 0) {
-                    if (lastStore != -1 && r-1 >= lastStore+1)
-                        cv::line(region,
-                                 cv::Point(a, traceTop+lastStore+1),
-                                 cv::Point(a, traceTop+r-1),
-                                 inUseColor);
-                    lastStore = r;
-                    region.at<cv::Vec3b>(traceTop+r, a) = modifyColor;
-                } else if (memRegion.trace[r][a].loadCount > 0) {
-                    if (lastStore != -1 && r-1 >= lastStore+1) {
-                        cv::line(region,
-                                 cv::Point(a, traceTop+lastStore+1),
-                                 cv::Point(a, traceTop+r-1),
-                                 inUseColor);
-                    }
-                    lastStore = r;
-                    region.at<cv::Vec3b>(traceTop+r, a) = loadColor;
-                } else if (memRegion.trace[r][a].storeCount > 0){
-                    region.at<cv::Vec3b>(traceTop+r, a) = storeColor;
-                    lastStore = r;
-                }
-            }
-        }
+        raster::Rect traceRect(0, liveTop, memRegion.resolution, memRegion.trace.size());
+        region.rowLayer(traceRect, traceRowFunction(memRegion));
+    }
+
+    int missLevel = TraceSession::missOverlayLevel - 1;
+    if (missLevel >= 0 && missLevel < (int)TraceSession::cacheSimulator.levels.size() &&
+        memRegion.misses.size() == memRegion.trace.size()) {
+        raster::Rect missRect(0, liveTop, memRegion.resolution, memRegion.trace.size());
+        region.rowLayer(missRect, missRowFunction(memRegion, missLevel));
     }
 
     if (memoryBlocks) {
-        // calculate pixel position of memory areas
-        for (auto &area : TraceSession::timeMemoryAreas) {
-            int pixMemStart = memRegion.memAddrToPix(area.startMem);
-            int pixMemEnd = memRegion.memAddrToPix(area.endMem);
-            long relInsStart = area.startInstruction - TraceSession::traceStartInstruction;
-            long relInsEnd = area.endInstruction - TraceSession::traceStartInstruction;
-            int pixInsStart = relInsStart / TraceSession::instructionsPerRow;
-            int pixInsEnd = relInsEnd / TraceSession::instructionsPerRow;
-
-            std::cout << "Area pix [" << pixMemStart << ", " << pixInsStart << ", " << pixMemEnd << ", " << pixInsEnd << "]\n";
-
-            if (pixMemEnd <= pixMemStart) {
-                std::cout << "Error zero of negative memory size for time-memory area.";
-                continue;
-            }
-            if (pixInsEnd <= pixInsStart) {
-                std::cout << "Error zero or negative instruction size for time-memory area.";
-                continue;
-            }
+        raster::Rect areaRect(0, liveTop, memRegion.resolution, memRegion.trace.size());
+        region.rowLayer(areaRect, areaRowFunction(memRegion, memRegion.trace.size()));
+    }
 
-            if (pixMemStart < 0 || pixMemEnd > region.cols) {
-                std::cout << "ignoring area outside of region." << std::endl;
-                continue;
-            }
+    // tint the rows whose accesses were skipped when sampling
+    raster::Color skippedColor(160, 220, 255);
+    const std::vector<char> &skipped = TraceSession::skippedRows;
+    size_t rowEnd = std::min(memRegion.lastRow(), skipped.size());
+    for (size_t row=memRegion.firstRow; row<rowEnd;) {
+        size_t runEnd = row;
+        while (runEnd < rowEnd && skipped[runEnd])
+            ++runEnd;
+        if (runEnd > row)
+            region.blendRect(raster::Rect(0, traceTop + row, memRegion.resolution, runEnd - row), skippedColor, 0.5);
+        row = runEnd + 1;
+    }
+
+    return memRegion.resolution;
+}
+
+int TraceImage::getSparklineSpace() {
+    return TraceSession::showTraffic ? sparklineGap + sparklineWidth : 0;
+}
 
-            transRectangle(region,
-                           cv::Rect(pixMemStart, traceTop+pixInsStart, pixMemEnd - pixMemStart, pixInsEnd-pixInsStart),
-                           cv::Scalar(0, 0, 0),
-                           cv::Scalar(0, 255, 255),
-                           3,
-                           TraceSession::boxAlpha,
-                           TraceSession::boxOutlineAlpha);
+void TraceImage::drawTrafficSparkline(raster::Canvas region, const MemoryRegion &memRegion) {
+
+    int traceTop = imageMargin + getTitleHeight() + getHeaderHeight() + 1;
+    int liveTop = traceTop + memRegion.firstRow;
+
+    unsigned long peak = 0;
+    for (auto const& row: memRegion.traffic)
+        peak = std::max(peak, row.total());
+
+    region.line(raster::Point(0, traceTop),
+                raster::Point(0, traceTop + TraceSession::traceRows()),
+                raster::Color(0, 0, 0));
+    if (peak == 0)
+        return;
+
+    // one bar per row, scaled to the busiest row of the region, split into
+    // the bytes loaded, stored and modified in the trace colours.
+    const MemoryRegion *memRegionPtr = &memRegion;
+    int width = sparklineWidth - 1;
+    raster::Rect sparkRect(1, liveTop, width, memRegion.traffic.size());
+    region.rowLayer(sparkRect, [memRegionPtr, peak, width](int r, unsigned char *pixels) {
+        const ByteTraffic &traffic = memRegionPtr->traffic[r];
+        int load = (traffic.loadBytes * width) / peak;
+        int store = ((traffic.loadBytes + traffic.storeBytes) * width) / peak;
+        int total = (traffic.total() * width) / peak;
+        for (int x=0; x<total; ++x) {
+            if (x < load)
+                raster::setPixel(pixels + x*3, raster::Color(255, 0, 0));
+            else if (x < store)
+                raster::setPixel(pixels + x*3, raster::Color(0, 0, 255));
+            else
+                raster::setPixel(pixels + x*3, raster::Color(0, 255, 0));
         }
+    });
+}
+
+raster::Color TraceImage::patternColor(PatternDetector::Pattern pattern) {
+    switch (pattern) {
+        case PatternDetector::Sequential: return raster::Color(0, 200, 0);
+        case PatternDetector::Strided: return raster::Color(255, 160, 0);
+        case PatternDetector::Gather: return raster::Color(0, 160, 255);
+        default: return raster::Color(0, 0, 220);
     }
+}
 
-    return memRegion.resolution;
+raster::Color TraceImage::zoomColor(size_t zoom) {
+    static const raster::Color colors[] = { raster::Color(0, 140, 255), raster::Color(160, 0, 128),
+                                            raster::Color(150, 150, 0), raster::Color(180, 0, 220),
+                                            raster::Color(30, 90, 140) };
+    return colors[zoom % (sizeof (colors) / sizeof (colors[0]))];
 }
 
-std::vector<int> TraceImage::drawEventBlocks(cv::Mat region) {
+std::vector<int> TraceImage::drawEventBlocks(raster::Canvas region) {
 
     std::vector<int> markerLines;
 
     int headerTop = imageMargin + getTitleHeight() + getHeaderHeight() + 1;
 
+    std::vector<EventSpan> spans, labels;
+    findEventSpans(&spans, &labels);
+
+    // The access patterns of the occurrences merged into each span, if
+    // patterns were recorded, found from the row each occurrence starts in
+    // among the spans of its activity, which are contiguous and in order.
+    std::vector<PatternDetector> spanPatterns;
+    if (TraceSession::accessPatterns.enabled) {
+        spanPatterns.resize(spans.size());
+        std::vector<std::pair<size_t, size_t> > activitySpans(TraceSession::activities.size(), std::make_pair(0, 0));
+        for (size_t s=0; s<spans.size(); ++s) {
+            std::pair<size_t, size_t> &range = activitySpans[spans[s].activity];
+            if (range.first == range.second)
+                range.first = s;
+            range.second = s + 1;
+        }
+        for (auto const& entry: TraceSession::accessPatterns.byOccurrence()) {
+            if (entry.first.first >= TraceSession::activities.size())
+                continue;
+            const std::vector<Activity::Occurrence> &occurrences = TraceSession::activities[entry.first.first].occurrences;
+            if (entry.first.second >= occurrences.size() || occurrences[entry.first.second].stop == 0)
+                continue;
+            long row = ((long)occurrences[entry.first.second].start - (long)TraceSession::traceStartInstruction) / (long)TraceSession::instructionsPerRow;
+            const std::pair<size_t, size_t> &range = activitySpans[entry.first.first];
+            auto span = std::upper_bound(spans.begin() + range.first, spans.begin() + range.second, row,
+                                         [](long row, const EventSpan &span) { return row < span.top; });
+            if (span != spans.begin() + range.first)
+                spanPatterns[span - spans.begin() - 1].merge(entry.second);
+        }
+    }
+
+    for (size_t s=0; s<spans.size(); ++s) {
+        const EventSpan &span = spans[s];
+        int top = headerTop + span.top;
+        int bottom = headerTop + span.bottom;
+
+        // add heights to marker line array
+        if (markerLines.size() == 0 || markerLines.back() != top)
+            markerLines.push_back(top);
+        if (markerLines.size() == 0 || markerLines.back() != bottom)
+            markerLines.push_back(bottom);
+
+        region.rectangle(raster::Point(0, top),
+                         raster::Point(operationBarWidth, bottom),
+                         raster::Color(0x88, 0xFF, 0x88),
+                         raster::FILLED);
+
+        // band down the right of the block coloured by the dominant
+        // access pattern of its occurrences.
+        if (!spanPatterns.empty() && spanPatterns[s].accesses() > 0)
+            region.rectangle(raster::Point(operationBarWidth - patternBandWidth, top),
+                             raster::Point(operationBarWidth, bottom),
+                             patternColor(spanPatterns[s].pattern()),
+                             raster::FILLED);
+
+        region.rectangle(raster::Point(0, top),
+                         raster::Point(operationBarWidth, bottom),
+                         raster::Color(0, 0, 0),
+                         1);
+    }
+
     std::vector<moveableLabel> labelPositions;
+    for (auto const& label: labels) {
 
-    for (int a=0; a<TraceSession::activities.size(); ++a)
-        if (TraceSession::activities[a].occurrences.size() > 0 && TraceSession::activities[a].occurrences[0].stop > 0) {
-            int top = headerTop + (TraceSession::activities[a].occurrences[0].start - TraceSession::traceStartInstruction) / TraceSession::instructionsPerRow;
-            int bottom = headerTop + (TraceSession::activities[a].occurrences[0].stop - TraceSession::traceStartInstruction) / TraceSession::instructionsPerRow;
-
-            // add heights to marker line array
-            if (markerLines.size() == 0 || markerLines.back() != top)
-                markerLines.push_back(top);
-            if (markerLines.size() == 0 || markerLines.back() != bottom)
-                markerLines.push_back(bottom);
-
-            cv::rectangle(region,
-                     cv::Point(0, top),
-                     cv::Point(operationBarWidth, bottom),
-                     cv::Scalar(0x88, 0xFF, 0x88),
-                     CV_FILLED);
-
-            cv::rectangle(region,
-                          cv::Point(0, top),
-                          cv::Point(operationBarWidth, bottom),
-                          cv::Scalar(0, 0, 0),
-                          1,
-                          8);
-
-            // get text box size
-            int baseline;
-            cv::Size textSize = cv::getTextSize(TraceSession::activities[a].name,
-                                                operationLabelFont.face,
-                                                operationLabelFont.scale,
-                                                operationLabelFont.thickness,
-                                                &baseline);
+        // get text box size
+        int baseline;
+        raster::Size textSize = raster::getTextSize(eventLabelText(label),
+                                                    operationLabelFont.face,
+                                                    operationLabelFont.scale,
+                                                    operationLabelFont.thickness,
+                                                    &baseline);
 
-            cv::Point centre((operationBarWidth * 2.0) + (textSize.width / 2),
-                             (top+bottom) / 2);
+        raster::Point centre((operationBarWidth * 2.0) + (textSize.width / 2),
+                             headerTop + (label.top + label.bottom) / 2);
 
-            labelPositions.push_back(moveableLabel(centre,
-                                                   textSize));
-        }
+        labelPositions.push_back(moveableLabel(centre,
+                                               textSize));
+    }
 
     spreadoutLabels(&labelPositions, 0, region.rows);
 
-    int lIdx = 0;
-    for (int a=0; a<TraceSession::activities.size(); ++a)
-        if (TraceSession::activities[a].occurrences.size() > 0 && TraceSession::activities[a].occurrences[0].stop > 0){
+    for (int lIdx=0; lIdx<labels.size(); ++lIdx) {
 
-            cv::Point location(labelPositions[lIdx].newPosition.x - labelPositions[lIdx].size.width / 2,
+        raster::Point location(labelPositions[lIdx].newPosition.x - labelPositions[lIdx].size.width / 2,
                                labelPositions[lIdx].newPosition.y + labelPositions[lIdx].size.height / 2);
 
-            cv::putText(region,
-                        TraceSession::activities[a].name,
-                        location,
-                        operationLabelFont.face,
-                        operationLabelFont.scale,
-                        cv::Scalar(0, 0, 0),
-                        operationLabelFont.thickness);
-
-            // draw a maker line from block centre to label
-            cv::line(region,
-                     cv::Point(operationBarWidth * 1.0, labelPositions[lIdx].origPosition.y),
-                     cv::Point(operationBarWidth * 1.2, labelPositions[lIdx].origPosition.y),
-                     cv::Scalar(0, 0, 0));
-            cv::line(region,
-                     cv::Point(operationBarWidth * 1.2, labelPositions[lIdx].origPosition.y),
-                     cv::Point(operationBarWidth * 1.8, labelPositions[lIdx].newPosition.y),
-                     cv::Scalar(0, 0, 0));
-            cv::line(region,
-                     cv::Point(operationBarWidth * 1.8, labelPositions[lIdx].newPosition.y),
-                     cv::Point(operationBarWidth * 1.9, labelPositions[lIdx].newPosition.y),
-                     cv::Scalar(0, 0, 0));
-
-            ++lIdx;
-        }
-
-    return markerLines;
-}
-
-void calculateMemoryAreaInstructions() {
-    for (auto &area : TraceSession::timeMemoryAreas) {
-        for (auto &event : TraceSession::activities) {
-            if (area.startEventAddr == event.addr &&
-                event.occurrences.size() > 0)
-                area.startInstruction = event.occurrences[0].start;
-            if (area.endEventAddr == event.addr &&
-                event.occurrences.size() > 0)
-                area.endInstruction = event.occurrences[0].stop;
-        }
+        region.putText(eventLabelText(labels[lIdx]),
+                       location,
+                       operationLabelFont.face,
+                       operationLabelFont.scale,
+                       raster::Color(0, 0, 0),
+                       operationLabelFont.thickness);
+
+        // draw a maker line from block centre to label
+        region.line(raster::Point(operationBarWidth * 1.0, labelPositions[lIdx].origPosition.y),
+                    raster::Point(operationBarWidth * 1.2, labelPositions[lIdx].origPosition.y),
+                    raster::Color(0, 0, 0));
+        region.line(raster::Point(operationBarWidth * 1.2, labelPositions[lIdx].origPosition.y),
+                    raster::Point(operationBarWidth * 1.8, labelPositions[lIdx].newPosition.y),
+                    raster::Color(0, 0, 0));
+        region.line(raster::Point(operationBarWidth * 1.8, labelPositions[lIdx].newPosition.y),
+                    raster::Point(operationBarWidth * 1.9, labelPositions[lIdx].newPosition.y),
+                    raster::Color(0, 0, 0));
     }
 
-    std::cout << "Area count [" << TraceSession::timeMemoryAreas.size() << "]\n";
-    for (auto &area : TraceSession::timeMemoryAreas) {
-        std::cout << "area [" << area.startMem << " " << area.endMem;
-        std::cout << "] ins [" << area.startInstruction << " " << area.endInstruction << "]\n";
-    }
+    return markerLines;
 }
 
-void TraceImage::saveTraceImage(std::vector<MemoryRegion> regions,
+void TraceImage::saveTraceImage(const std::vector<MemoryRegion> &regions,
                                 std::string filename,
                                 std::string title,
                                 bool memoryBlocks,
@@ -605,17 +870,17 @@ void TraceImage::saveTraceImage(std::vector<MemoryRegion> regions,
     std::cout << "Saving memory trace plot \"" << title;
     std::cout << "\" to file \"" << filename << "\"\n";
 
-    calculateMemoryAreaInstructions();
+    TraceSession::resolveMemoryAreas();
 
     int instructionAxisWidth = 500;
     int memRegionSpacing = 100;
     // calculate the size of the final image
-    cv::Size imageSize(instructionAxisWidth, regions[0].trace.size() + 2);
+    raster::Size imageSize(instructionAxisWidth, TraceSession::traceRows() + 2);
     imageSize.width += 2 * imageMargin;
     imageSize.height += 2 * imageMargin;
     imageSize.height += getTitleHeight();
     for (auto const& region: regions) {
-        imageSize.width += region.resolution + 2;
+        imageSize.width += region.resolution + 2 + getSparklineSpace();
     }
     imageSize.width += memRegionSpacing * (regions.size()-1);
     imageSize.height += getHeaderHeight();
@@ -623,22 +888,68 @@ void TraceImage::saveTraceImage(std::vector<MemoryRegion> regions,
         imageSize.width += getOperationsWidth();
 
     // create image
-    cv::Mat traceImage(imageSize, CV_8UC3, cv::Scalar(255, 255, 255));
+    raster::Canvas traceImage(imageSize, raster::Color(255, 255, 255));
 
     //std::cout << "Created image with size " << imageSize << std::endl;
 
+    // refined regions are drawn straight after the region they zoom into,
+    // children always come after their parents in the list of regions.
+    std::vector<size_t> order;
+    std::function<void(size_t)> addZooms = [&](size_t r) {
+        order.push_back(r);
+        for (size_t c=r+1; c<regions.size(); ++c)
+            if (regions[c].parent == (long)r)
+                addZooms(c);
+    };
+    for (size_t r=0; r<regions.size(); ++r)
+        if (regions[r].parent < 0 || regions[r].parent >= (long)r)
+            addZooms(r);
+
     // add memory regions
     int position = instructionAxisWidth + imageMargin;
-    for (auto const& region: regions) {
+    int traceTop = imageMargin + getTitleHeight() + getHeaderHeight() + 1;
+    size_t zooms = 0;
+    for (size_t r: order) {
+        const MemoryRegion &region = regions[r];
 
         //std::cout << "making memory region ROI (" << position << " 0) (" << (position+region.resolution) << " " << traceImage.rows << ")\n";
 
-        cv::Mat regionMat = traceImage(cv::Rect(position,
-                                                0,
-                                                region.resolution,
-                                                traceImage.rows));
-        //regionMat = cv::Scalar(233,255,233);
-        position += memRegionSpacing + drawRegionTrace(regionMat, region);
+        raster::Canvas regionMat = traceImage(raster::Rect(position,
+                                                           0,
+                                                           region.resolution,
+                                                           traceImage.rows));
+        //regionMat = raster::Color(233,255,233);
+        int regionWidth = drawRegionTrace(regionMat, region);
+
+        // link each zoom panel to the span of its parent it covers with a
+        // box round the span in the parent and a border in the same colour
+        if (region.parent >= 0 && region.parent < (long)r) {
+            raster::Color linkColor = zoomColor(zooms++);
+            regionMat.rectangle(raster::Point(1, traceTop),
+                                raster::Point(regionMat.cols-1, regionMat.rows - imageMargin - 1),
+                                linkColor,
+                                3);
+            const MemoryRegion &parent = regions[region.parent];
+            int parentLeft = instructionAxisWidth + imageMargin;
+            for (size_t o: order) {
+                if (o == (size_t)region.parent)
+                    break;
+                parentLeft += regions[o].resolution + memRegionSpacing + getSparklineSpace();
+            }
+            int first, end;
+            RegionRefiner::childPixels(parent, region, first, end);
+            traceImage.rectangle(raster::Point(parentLeft + first, traceTop + region.firstRow),
+                                 raster::Point(parentLeft + end - 1, traceTop + region.lastRow()),
+                                 linkColor,
+                                 2);
+        }
+        position += memRegionSpacing + regionWidth;
+
+        if (TraceSession::showTraffic) {
+            int sparkLeft = position - memRegionSpacing + sparklineGap;
+            drawTrafficSparkline(traceImage(raster::Rect(sparkLeft, 0, sparklineWidth, traceImage.rows)), region);
+            position += getSparklineSpace();
+        }
 
         //std::cout << "New Position is " << position << std::endl;
     }
@@ -646,57 +957,53 @@ void TraceImage::saveTraceImage(std::vector<MemoryRegion> regions,
     //std::cout << "Final Position is " << position << std::endl;
 
     // add instructions axis
-    cv::Mat instructionAxisRegion = traceImage(cv::Rect(imageMargin, 0, 500, traceImage.rows));
-    unsigned long instructionCount = TraceSession::memoryRegions[0].trace.size() * TraceSession::instructionsPerRow;
+    raster::Canvas instructionAxisRegion = traceImage(raster::Rect(imageMargin, 0, 500, traceImage.rows));
+    unsigned long instructionCount = TraceSession::traceRows() * TraceSession::instructionsPerRow;
     //std::cout << "Adding instructions axis with range " << instructionCount << std::endl;
     drawInsAxis(instructionAxisRegion, instructionCount);
 
     // add plot Title
     int baseline;
-    cv::Size textSize = cv::getTextSize(title,
-                                        titleFont.face,
-                                        titleFont.scale,
-                                        titleFont.thickness,
-                                        &baseline);
-
-    cv::putText(traceImage,
-                title,
-                cv::Point(traceImage.cols/2 - textSize.width/2,
-                          imageMargin + getHeaderHeight()/2 + textSize.height/2),
-                titleFont.face,
-                titleFont.scale,
-                cv::Scalar(0, 0, 0),
-                titleFont.thickness);
+    raster::Size textSize = raster::getTextSize(title,
+                                                titleFont.face,
+                                                titleFont.scale,
+                                                titleFont.thickness,
+                                                &baseline);
+
+    traceImage.putText(title,
+                       raster::Point(traceImage.cols/2 - textSize.width/2,
+                                     imageMargin + getHeaderHeight()/2 + textSize.height/2),
+                       titleFont.face,
+                       titleFont.scale,
+                       raster::Color(0, 0, 0),
+                       titleFont.thickness);
 
     // add event labels
     bool addEventLines = false;
     if (eventBlocks) {
-        cv::Mat eventsMat = traceImage(cv::Rect(position, 0,
-                                                traceImage.cols-position,
-                                                traceImage.rows));
-        //eventsMat = cv::Scalar(255,233,233);
+        raster::Canvas eventsMat = traceImage(raster::Rect(position, 0,
+                                                           traceImage.cols-position,
+                                                           traceImage.rows));
+        //eventsMat = raster::Color(255,233,233);
         std::vector<int> markerLines = drawEventBlocks(eventsMat);
 
         // Add horizontal lines demarking events
         if (addEventLines)
             for (auto const& height: markerLines) {
-                for (int x=instructionAxisWidth+imageMargin; x<position; ++x) {
-                    cv::Vec3b col = traceImage.at<cv::Vec3b>(height, x);
-                    col[0] *= 0.8;
-                    col[1] *= 0.8;
-                    col[2] *= 0.8;
-                    traceImage.at<cv::Vec3b>(height, x) = col;
-                }
+                traceImage.blendRect(raster::Rect(instructionAxisWidth+imageMargin, height,
+                                                  position-instructionAxisWidth-imageMargin, 1),
+                                     raster::Color(0, 0, 0),
+                                     0.2);
             }
     }
 
     // save image to disk
-    imwrite(filename, traceImage);
+    traceImage.save(filename);
 
     std::cout << "Complete.\n";
 }
 
-void TraceImage::drawMemoryScale(cv::Mat region,
+void TraceImage::drawMemoryScale(raster::Canvas region,
                                  unsigned long memRange,
                                  int approxPixelsPerDivision)
 {
@@ -723,7 +1030,7 @@ void TraceImage::drawMemoryScale(cv::Mat region,
 
     } while(!bestFound);
 
-    int labelDivisor = 0;
+    int labelDivisor = 1;
     std::string labelSuffix = " B";
     if (bestSize >= 1024) {
         labelDivisor = 1024;
@@ -737,34 +1044,31 @@ void TraceImage::drawMemoryScale(cv::Mat region,
     // draw marker ticks on the image
     for (unsigned long memPos = 0; memPos <= memRange; memPos += bestSize) {
         int position = (memPos * region.cols) / memRange;
-        cv::line(region,
-                 cv::Point(position, region.rows/2),
-                 cv::Point(position, region.rows-1),
-                 cv::Scalar(0, 0, 0),
-                 3);
+        region.line(raster::Point(position, region.rows/2),
+                    raster::Point(position, region.rows-1),
+                    raster::Color(0, 0, 0),
+                    3);
 
         std::string text = std::to_string(memPos / labelDivisor) + labelSuffix;
 
         int baseline;
-        cv::Size textSize = cv::getTextSize(text,
-                                            memoryLabelFont.face,
-                                            memoryLabelFont.scale,
-                                            memoryLabelFont.thickness,
-                                            &baseline);
-
-        cv::putText(region,
-                    text,
-                    cv::Point(position - textSize.width,
-                              (region.rows/2) + textSize.height/2),
-                    memoryLabelFont.face,
-                    memoryLabelFont.scale,
-                    cv::Scalar(0, 0, 0),
-                    memoryLabelFont.thickness);
+        raster::Size textSize = raster::getTextSize(text,
+                                                    memoryLabelFont.face,
+                                                    memoryLabelFont.scale,
+                                                    memoryLabelFont.thickness,
+                                                    &baseline);
+
+        region.putText(text,
+                       raster::Point(position - textSize.width,
+                                     (region.rows/2) + textSize.height/2),
+                       memoryLabelFont.face,
+                       memoryLabelFont.scale,
+                       raster::Color(0, 0, 0),
+                       memoryLabelFont.thickness);
     }
-    cv::line(region,
-             cv::Point(region.cols-1, region.rows/2),
-             cv::Point(region.cols-1, region.rows-1),
-             cv::Scalar(0, 0, 0),
-             3);
+    region.line(raster::Point(region.cols-1, region.rows/2),
+                raster::Point(region.cols-1, region.rows-1),
+                raster::Color(0, 0, 0),
+                3);
 
 }
\ No newline at end of file
@@ -18,7 +18,6 @@
 #include <chrono>
 #include <mutex>
 #include <cassert>
-#include <opencv2/opencv.hpp>
 #include "trace_image.h"
 #include "activity.h"
 #include "tensor_block.h"
@@ -31,13 +30,28 @@ int main(int argc, char **argv)
 
     std::string traceFilename = std::string(argv[1]);
     std::string outputImageFilename = "trace.png";
+    int missLevel = 0;
+    std::string planFilename = "";
+    std::string trafficFilename = "";
+    std::string chromeTraceFilename = "";
+    unsigned long planAlignment = 64;
 
     for (int a=0; a<argc; ++a)
     {
         if (std::string(argv[a]).substr(0,6) == "--out=") {
-            outputImageFilename = std::atof(std::string(argv[a]).substr(6, std::string::npos).c_str());
+            outputImageFilename = std::string(argv[a]).substr(6, std::string::npos);
             std::cout << "[\033[92mVMT\033[0m] Setting output image file name to : " << outputImageFilename << std::endl;
         }
+        else if (std::string(argv[a]).substr(0,13) == "--miss_level=")
+            missLevel = std::atoi(std::string(argv[a]).substr(13, std::string::npos).c_str());
+        else if (std::string(argv[a]).substr(0,10) == "--traffic=")
+            trafficFilename = std::string(argv[a]).substr(10, std::string::npos);
+        else if (std::string(argv[a]).substr(0,15) == "--chrome_trace=")
+            chromeTraceFilename = std::string(argv[a]).substr(15, std::string::npos);
+        else if (std::string(argv[a]).substr(0,7) == "--plan=")
+            planFilename = std::string(argv[a]).substr(7, std::string::npos);
+        else if (std::string(argv[a]).substr(0,13) == "--plan_align=")
+            planAlignment = std::atoi(std::string(argv[a]).substr(13, std::string::npos).c_str());
     }
 
     std::cout << "Loading memory trace [" << traceFilename << "]\n";
@@ -50,6 +64,23 @@ int main(int argc, char **argv)
     } else
         std::cerr << "Could not open trace file \"" << traceFilename << "\"\n";
 
+    if (trafficFilename != "" && TraceSession::saveTraffic(trafficFilename))
+        std::cout << "Saved memory traffic \"" << trafficFilename << "\"\n";
+
+    if (chromeTraceFilename != "")
+        TraceSession::saveChromeTrace(chromeTraceFilename);
+
+    if (planFilename != "" && TraceSession::planMemory(planFilename, planAlignment))
+        std::cout << "Saved memory plan \"" << planFilename << "\"\n";
+
+    // overlay simulated cache misses if the trace has them
+    if (missLevel > 0) {
+        if (TraceSession::cacheSimulator.enabled())
+            TraceSession::missOverlayLevel = std::min(missLevel, (int)TraceSession::cacheSimulator.levels.size());
+        else
+            std::cerr << "[\033[92mVMT\033[0m] Warning: Trace has no simulated cache misses.\n";
+    }
+
     // save trace image file
     std::cout << "Saving plot \"" << outputImageFilename << "\"\n";
     TraceImage traceSaver;
@@ -0,0 +1,161 @@
+/*
+    Trace window query utility.
+    -------------------------
+
+    Answers how many loads, stores and modifies hit a window of bytes and
+    time in the regions of a saved trace. With the summed-area index saved
+    by 'vis_mem_analyzer --index' each query costs a few lookups plus at most
+    two index blocks of decoded rows, without the index every row of the
+    window is decoded.
+
+    Usage: vis_mem_query model.trace [--region=<name>] [--bytes=<first>:<end>]
+                         [--rows=<first>:<end>] [--from=<activity>[#n]]
+                         [--to=<activity>[#n]] [--list]
+
+    Bytes are offsets into the region, end exclusive, and may be given in
+    hex. Rows are trace rows, end exclusive. --from and --to set the window
+    from the start of occurrence n (default 0) of one activity to the end of
+    occurrence n of another. Counts are of accesses touching each pixel, so
+    the byte window is widened to whole pixels.
+*/
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "trace_file_view.h"
+
+// parses "<first>:<end>", either side may be left out
+static bool parseRange(const std::string &text, unsigned long &first, unsigned long &end) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos)
+        return false;
+    if (colon > 0)
+        first = std::strtoul(text.substr(0, colon).c_str(), nullptr, 0);
+    if (colon + 1 < text.size())
+        end = std::strtoul(text.substr(colon + 1).c_str(), nullptr, 0);
+    return true;
+}
+
+// finds "<activity>[#n]", returns false if there is no such occurrence
+static bool findOccurrence(const TraceFileView &view, const std::string &text, Activity::Occurrence &occurrence) {
+    std::string name = text;
+    size_t number = 0;
+    size_t hash = text.rfind('#');
+    if (hash != std::string::npos) {
+        name = text.substr(0, hash);
+        number = std::atoi(text.substr(hash + 1).c_str());
+    }
+    for (auto &activity : view.activities)
+        if (activity.name == name && number < activity.occurrences.size()) {
+            occurrence = activity.occurrences[number];
+            return true;
+        }
+    std::cerr << "No occurrence " << number << " of activity \"" << name << "\" in the trace.\n";
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    std::string filename;
+    std::string regionName;
+    std::string from, to;
+    unsigned long firstByte = 0, endByte = ~0ul;
+    unsigned long firstRow = 0, endRow = ~0ul;
+    bool list = false;
+
+    for (int a=1; a<argc; ++a)
+    {
+        std::string arg(argv[a]);
+        if (arg.substr(0,9) == "--region=")
+            regionName = arg.substr(9, std::string::npos);
+        else if (arg.substr(0,8) == "--bytes=") {
+            if (!parseRange(arg.substr(8, std::string::npos), firstByte, endByte)) {
+                std::cerr << "Byte range must be given as <first>:<end>\n";
+                return 1;
+            }
+        }
+        else if (arg.substr(0,7) == "--rows=") {
+            if (!parseRange(arg.substr(7, std::string::npos), firstRow, endRow)) {
+                std::cerr << "Row range must be given as <first>:<end>\n";
+                return 1;
+            }
+        }
+        else if (arg.substr(0,7) == "--from=")
+            from = arg.substr(7, std::string::npos);
+        else if (arg.substr(0,5) == "--to=")
+            to = arg.substr(5, std::string::npos);
+        else if (arg == "--list")
+            list = true;
+        else
+            filename = arg;
+    }
+
+    if (filename.empty()) {
+        std::cerr << "Usage: vis_mem_query model.trace [--region=<name>] [--bytes=<first>:<end>] [--rows=<first>:<end>] [--from=<activity>[#n]] [--to=<activity>[#n]] [--list]\n";
+        return 1;
+    }
+
+    TraceFileView view;
+    if (!view.open(filename))
+        return 1;
+
+    if (list) {
+        for (auto &region : view.regions)
+            std::cout << "[\033[92mVMT\033[0m] region \"" << region.name << "\" "
+                      << (region.endAddr - region.startAddr) << " bytes, rows "
+                      << region.firstRow << ":" << (region.firstRow + region.rowOffsets.size())
+                      << (region.index.empty() ? ", not indexed" : ", indexed") << "\n";
+        for (auto &activity : view.activities)
+            std::cout << "[\033[92mVMT\033[0m] activity \"" << activity.name << "\" "
+                      << activity.occurrences.size() << " occurrences\n";
+        return 0;
+    }
+
+    // activity occurrences to trace rows
+    Activity::Occurrence occurrence(0);
+    if (!from.empty()) {
+        if (!findOccurrence(view, from, occurrence))
+            return 1;
+        long row = ((long)occurrence.start - (long)view.traceStartInstruction) / (long)view.instructionsPerRow;
+        firstRow = std::max(row, 0l);
+    }
+    if (!to.empty()) {
+        if (!findOccurrence(view, to, occurrence))
+            return 1;
+        long row = ((long)occurrence.stop - (long)view.traceStartInstruction) / (long)view.instructionsPerRow + 1;
+        endRow = std::max(row, 0l);
+    }
+    endRow = std::min(endRow, (unsigned long)view.traceRows);
+
+    std::cout << "[\033[92mVMT\033[0m] Rows " << firstRow << ":" << endRow << "\n";
+
+    bool found = false;
+    for (size_t r=0; r<view.regions.size(); ++r) {
+        const TraceFileView::RegionInfo &region = view.regions[r];
+        if (!regionName.empty() && region.name != regionName)
+            continue;
+        found = true;
+
+        // trace rows to the region's rows, bytes to whole pixels
+        size_t regionFirst = firstRow > region.firstRow ? firstRow - region.firstRow : 0;
+        size_t regionEnd = endRow > region.firstRow ? endRow - region.firstRow : 0;
+        unsigned long size = region.endAddr - region.startAddr;
+        unsigned int firstColumn = region.column(region.startAddr + std::min(firstByte, size));
+        unsigned int endColumn = firstColumn;
+        if (endByte > firstByte)
+            endColumn = std::min(region.column(region.startAddr + std::min(endByte, size) - 1) + 1, region.resolution);
+
+        WindowIndex::Counts counts = view.windowCounts(r, regionFirst, regionEnd, firstColumn, endColumn);
+        std::cout << "[\033[92mVMT\033[0m] [" << region.name << "] loads " << counts.loads
+                  << ", stores " << counts.stores << ", modifies " << counts.mods
+                  << " (pixels " << firstColumn << ":" << endColumn
+                  << (region.index.empty() ? ", no index" : "") << ")\n";
+    }
+
+    if (!found) {
+        std::cerr << "No region named \"" << regionName << "\" in the trace.\n";
+        return 1;
+    }
+    return 0;
+}
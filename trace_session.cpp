@@ -1,20 +1,42 @@
 
 #include "trace_session.h"
+#include "chrome_trace.h"
+
+#include <sstream>
+#include <algorithm>
+#include <unordered_set>
 
 std::string TraceSession::title = "Title not set";
 
 std::vector<MemoryRegion> TraceSession::memoryRegions;
 std::mutex TraceSession::memRegionsMutex;
+RegionIndex TraceSession::regionIndex;
+size_t TraceSession::rowsStored = 0;
+unsigned int TraceSession::rowCoarsenings = 0;
+bool TraceSession::publishRows = false;
+std::mutex TraceSession::sealedRowsMutex;
+std::vector<TraceSession::SealedRow> TraceSession::sealedRows;
 
 std::vector<Activity> TraceSession::activities;
 std::mutex TraceSession::activitiesMutex;
+std::unordered_map<unsigned long, std::vector<size_t> > TraceSession::activityIndex;
 
 std::vector<TimeMemoryArea> TraceSession::timeMemoryAreas;
+ReuseAnalysis TraceSession::reuseAnalysis;
+CacheSimulator TraceSession::cacheSimulator;
+int TraceSession::missOverlayLevel = 0;
+AccessPatterns TraceSession::accessPatterns;
+RegionRefiner TraceSession::regionRefiner;
+PageMap TraceSession::pageMap;
+RowSampler TraceSession::rowSampler;
+std::vector<char> TraceSession::skippedRows;
+unsigned int TraceSession::windowIndexRows = 0;
 float TraceSession::boxAlpha = 0.15;
 float TraceSession::boxOutlineAlpha = 1.0;
 bool TraceSession::showTrace = true;
+bool TraceSession::showTraffic = true;
 
-//std::vector<TensorBlock> TraceSession::tensors;
+std::vector<TensorBlock> TraceSession::tensors;
 unsigned long TraceSession::instructionsPerRow = 1 * 1000;
 unsigned long TraceSession::maxTraceRows = 30 * 1000;
 unsigned long TraceSession::traceStartInstruction = 0;
@@ -22,9 +44,515 @@ unsigned long TraceSession::traceStartInstruction = 0;
 bool TraceSession::readShutdown = false;
 std::mutex TraceSession::shutdownMutex;
 
+std::atomic<unsigned long> TraceSession::syncFlagAddr(0);
+unsigned long TraceSession::syncsReceived = 0;
+std::mutex TraceSession::syncMutex;
+std::condition_variable TraceSession::syncSignal;
+std::deque<TraceSession::RegionChange> TraceSession::regionChanges;
+
+static const char traceFileMagic[8] = "VMTRACE";
+
+// copies a sealed row of a region for the live preview
+static void queueSealedRow(std::vector<TraceSession::SealedRow> &rows, size_t region,
+                           const std::vector<MemoryRegion::MemoryReading> &readings) {
+    rows.push_back(TraceSession::SealedRow());
+    rows.back().region = region;
+    rows.back().rowCoarsenings = TraceSession::rowCoarsenings;
+    rows.back().readings = readings;
+}
+
+static void publishSealedRows(std::vector<TraceSession::SealedRow> &rows) {
+    if (rows.empty())
+        return;
+    TraceSession::sealedRowsMutex.lock();
+    if (TraceSession::sealedRows.empty())
+        TraceSession::sealedRows.swap(rows);
+    else
+        for (auto &row : rows)
+            TraceSession::sealedRows.push_back(std::move(row));
+    TraceSession::sealedRowsMutex.unlock();
+}
+
+void TraceSession::takeSealedRows(std::vector<SealedRow> &rows) {
+    rows.clear();
+    sealedRowsMutex.lock();
+    sealedRows.swap(rows);
+    sealedRowsMutex.unlock();
+}
+
+static void writeSection(std::ofstream &out, unsigned int tag, const std::string &data) {
+    unsigned long length = data.size();
+    out.write((char*)&tag, sizeof (tag));
+    if (tag == TraceSession::EndOfSections)
+        return;
+    out.write((char*)&length, sizeof (length));
+    out.write(data.data(), data.size());
+}
+
+void TraceSession::addActivity(const Activity &activity) {
+    activitiesMutex.lock();
+    activityIndex[activity.addr].push_back(activities.size());
+    activities.push_back(activity);
+    activitiesMutex.unlock();
+}
+
+void TraceSession::addMemoryRegions(const std::vector<MemoryRegion> &regions) {
+    memRegionsMutex.lock();
+    for (auto region : regions) {
+        region.firstRow = rowsStored;
+        if (cacheSimulator.enabled())
+            region.trackMisses();
+        memoryRegions.push_back(region);
+    }
+    regionIndex.build(memoryRegions);
+    memRegionsMutex.unlock();
+}
+
+void TraceSession::addDiscoveredRegions() {
+    std::vector<MemoryRegion> regions = pageMap.clusterRegions(rowsStored + 1);
+    memRegionsMutex.lock();
+    for (auto &region : regions) {
+        if (cacheSimulator.enabled())
+            region.trackMisses();
+        memoryRegions.push_back(region);
+    }
+    regionIndex.build(memoryRegions);
+    memRegionsMutex.unlock();
+}
+
+size_t TraceSession::retireMemoryRegions(const std::vector<unsigned long> &startAddrs) {
+    std::unordered_set<unsigned long> addrs(startAddrs.begin(), startAddrs.end());
+    size_t retired = 0;
+    std::vector<SealedRow> rows;
+    memRegionsMutex.lock();
+    for (size_t r=0; r<memoryRegions.size(); ++r) {
+        MemoryRegion &region = memoryRegions[r];
+        if (region.retired)
+            continue;
+        bool retire = addrs.count(region.startAddr) > 0;
+        retired += retire;
+        retire |= region.parent >= 0 && memoryRegions[region.parent].retired;
+        if (retire) {
+            region.retired = true;
+            if (publishRows)
+                queueSealedRow(rows, r, region.trace.back());
+        }
+    }
+    if (retired > 0)
+        regionIndex.build(memoryRegions);
+    memRegionsMutex.unlock();
+    publishSealedRows(rows);
+    return retired;
+}
+
+void TraceSession::queueMemoryRegions(const std::vector<MemoryRegion> &regions) {
+    syncMutex.lock();
+    regionChanges.push_back(RegionChange());
+    regionChanges.back().sync = syncsReceived + 1;
+    regionChanges.back().added = regions;
+    syncMutex.unlock();
+}
+
+void TraceSession::queueRetireMemoryRegions(const std::vector<unsigned long> &startAddrs) {
+    syncMutex.lock();
+    regionChanges.push_back(RegionChange());
+    regionChanges.back().sync = syncsReceived + 1;
+    regionChanges.back().retired = startAddrs;
+    syncMutex.unlock();
+}
+
+void TraceSession::applyRegionChanges(unsigned long sync) {
+    std::vector<RegionChange> changes;
+    syncMutex.lock();
+    while (!regionChanges.empty() && regionChanges.front().sync <= sync) {
+        changes.push_back(regionChanges.front());
+        regionChanges.pop_front();
+    }
+    syncMutex.unlock();
+
+    for (auto &change : changes) {
+        if (!change.added.empty())
+            addMemoryRegions(change.added);
+        if (!change.retired.empty())
+            retireMemoryRegions(change.retired);
+    }
+}
+
+void TraceSession::storeRow() {
+    std::vector<MemoryRegion> children;
+    std::vector<SealedRow> rows;
+    memRegionsMutex.lock();
+    if (regionRefiner.enabled)
+        children = regionRefiner.rowSealed(memoryRegions);
+    for (size_t r=0; r<memoryRegions.size(); ++r) {
+        MemoryRegion &region = memoryRegions[r];
+        if (region.retired)
+            continue;
+        if (publishRows)
+            queueSealedRow(rows, r, region.trace.back());
+        region.storeRow();
+    }
+    ++rowsStored;
+    memRegionsMutex.unlock();
+    publishSealedRows(rows);
+
+    // children record from the row just started
+    if (!children.empty())
+        addMemoryRegions(children);
+}
+
+void TraceSession::coarsenRows() {
+    memRegionsMutex.lock();
+    for (auto &region : memoryRegions)
+        region.halveRows();
+    if (pageMap.enabled)
+        pageMap.halveRows();
+    for (size_t r=0; r<skippedRows.size(); ++r)
+        skippedRows[r/2] = (r % 2 == 0) ? skippedRows[r] : (skippedRows[r/2] | skippedRows[r]);
+    skippedRows.resize((skippedRows.size() + 1) / 2);
+    rowsStored /= 2;
+    instructionsPerRow *= 2;
+    ++rowCoarsenings;
+
+    // the preview starts again from the coarsened rows
+    std::vector<SealedRow> rows;
+    if (publishRows)
+        for (size_t r=0; r<memoryRegions.size(); ++r) {
+            const MemoryRegion &region = memoryRegions[r];
+            size_t sealed = region.retired ? region.trace.size() : region.trace.size() - 1;
+            for (size_t row=0; row<sealed; ++row)
+                queueSealedRow(rows, r, region.trace[row]);
+        }
+    memRegionsMutex.unlock();
+    publishSealedRows(rows);
+}
+
+void TraceSession::markSkippedRow(size_t row, bool skipped) {
+    if (skippedRows.size() <= row)
+        skippedRows.resize(row + 1, 0);
+    skippedRows[row] |= skipped;
+}
+
+double TraceSession::scaleSampledCounts(unsigned long instructions, unsigned long sampledInstructions) {
+    if (sampledInstructions == 0 || sampledInstructions >= instructions)
+        return 1.0;
+
+    double scale = (double)instructions / sampledInstructions;
+    for (auto &region : memoryRegions) {
+        region.loadCount = region.loadCount * scale + 0.5;
+        region.storeCount = region.storeCount * scale + 0.5;
+    }
+    for (auto &activity : activities)
+        for (auto &occ : activity.occurrences) {
+            occ.traffic.loadBytes = occ.traffic.loadBytes * scale + 0.5;
+            occ.traffic.storeBytes = occ.traffic.storeBytes * scale + 0.5;
+            occ.traffic.modBytes = occ.traffic.modBytes * scale + 0.5;
+        }
+    return scale;
+}
+
+size_t TraceSession::traceRows() {
+    size_t rows = 0;
+    for (auto &region : memoryRegions)
+        rows = std::max(rows, region.lastRow());
+    return rows;
+}
+
+void TraceSession::syncReceived() {
+    syncMutex.lock();
+    ++syncsReceived;
+    syncMutex.unlock();
+    syncSignal.notify_all();
+}
+
+bool TraceSession::waitForSync(unsigned long count, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(syncMutex);
+    return syncSignal.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                               [count]{ return syncsReceived >= count; });
+}
+
+Activity* TraceSession::findActivity(unsigned long addr) {
+    auto it = activityIndex.find(addr);
+    if (it == activityIndex.end())
+        return nullptr;
+    return &activities[it->second.front()];
+}
+
+const std::vector<size_t>* TraceSession::findActivities(unsigned long addr) {
+    auto it = activityIndex.find(addr);
+    if (it == activityIndex.end())
+        return nullptr;
+    return &it->second;
+}
+
+void TraceSession::resolveMemoryAreas() {
+
+    size_t unresolved = 0;
+    for (auto &area : timeMemoryAreas) {
+        Activity *start = findActivity(area.startEventAddr);
+        Activity *end = findActivity(area.endEventAddr);
+
+        if (start && area.startOccurrence < start->occurrences.size())
+            area.startInstruction = start->occurrences[area.startOccurrence].start;
+        if (end && area.endOccurrence < end->occurrences.size())
+            area.endInstruction = end->occurrences[area.endOccurrence].stop;
+
+        if (area.endInstruction <= area.startInstruction)
+            ++unresolved;
+    }
+
+    std::cout << "Area count [" << timeMemoryAreas.size() << "]";
+    if (unresolved > 0)
+        std::cout << ", " << unresolved << " without a valid event occurrence";
+    std::cout << "\n";
+}
+
+/*
+    Finds the innermost activity occurrence running at an instruction, the
+    one started most recently. Occurrences are sorted by start, in activity
+    order for equal starts, under a tree holding the latest stop of each
+    span of them, so the last occurrence starting at or before the
+    instruction which is still running is found in O(log n).
+*/
+class OccurrenceIndex {
+public:
+    OccurrenceIndex() {
+        for (size_t a=1; a<TraceSession::activities.size(); ++a) {
+            auto &occurrences = TraceSession::activities[a].occurrences;
+            for (size_t o=0; o<occurrences.size(); ++o)
+                entries.push_back(Entry{ occurrences[o].start, occurrences[o].stop, a, o });
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            return a.start < b.start;
+        });
+        leaves = 1;
+        while (leaves < entries.size())
+            leaves *= 2;
+        latestStop.assign(2 * leaves, 0);
+        for (size_t e=0; e<entries.size(); ++e)
+            latestStop[leaves + e] = entries[e].stop;
+        for (size_t n=leaves-1; n>0; --n)
+            latestStop[n] = std::max(latestStop[2*n], latestStop[2*n+1]);
+    }
+
+    // name of the occurrence as activity[occurrence], empty if none is running
+    std::string at(unsigned long instruction) const {
+        size_t end = std::upper_bound(entries.begin(), entries.end(), instruction,
+                                      [](unsigned long i, const Entry &e) { return i < e.start; }) - entries.begin();
+        long e = lastRunning(1, 0, leaves, end, instruction);
+        if (e < 0)
+            return "";
+        const Entry &entry = entries[e];
+        return TraceSession::activities[entry.activity].name + "[" + std::to_string(entry.occurrence) + "]";
+    }
+
+private:
+    class Entry {
+    public:
+        unsigned long start, stop;
+        size_t activity, occurrence;
+    };
+
+    // the last entry before end of the node's span still running at the instruction
+    long lastRunning(size_t node, size_t first, size_t last, size_t end, unsigned long instruction) const {
+        if (first >= end || latestStop[node] <= instruction)
+            return -1;
+        if (last - first == 1)
+            return first;
+        size_t middle = (first + last) / 2;
+        long e = lastRunning(2*node+1, middle, last, end, instruction);
+        return e >= 0 ? e : lastRunning(2*node, first, middle, end, instruction);
+    }
+
+    std::vector<Entry> entries;
+    std::vector<unsigned long> latestStop;
+    size_t leaves;
+};
+
+// row of a region recording the instruction, rows before the region's first are 0
+static size_t regionRow(const MemoryRegion &region, unsigned long instruction) {
+    if (instruction < TraceSession::traceStartInstruction)
+        return 0;
+    size_t row = (instruction - TraceSession::traceStartInstruction) / TraceSession::instructionsPerRow;
+    return row > region.firstRow ? row - region.firstRow : 0;
+}
+
+void TraceSession::extractTensors() {
+    resolveMemoryAreas();
+    tensors.clear();
+    OccurrenceIndex occurrenceIndex;
+
+    for (auto &area : timeMemoryAreas) {
+        for (size_t r=0; r<memoryRegions.size(); ++r) {
+            const MemoryRegion &region = memoryRegions[r];
+            // refined children repeat the accesses of their parents
+            if (region.parent >= 0)
+                continue;
+            if (area.endMem <= region.startAddr || area.startMem >= region.endAddr)
+                continue;
+
+            unsigned long start = std::max(area.startMem, region.startAddr);
+            unsigned long end = std::min(area.endMem, region.endAddr);
+            int left = std::max(region.memAddrToPix(start), 0);
+            int right = std::min(std::max(region.memAddrToPix(end - 1) + 1, left + 1), (int)region.resolution);
+
+            // rows of the area's instruction window, every row if it has none
+            size_t firstRow = 0, endRow = region.trace.size();
+            if (area.endInstruction > area.startInstruction) {
+                firstRow = std::min(regionRow(region, area.startInstruction), endRow);
+                endRow = std::min(regionRow(region, area.endInstruction - 1) + 1, endRow);
+            }
+
+            // rows of the first store and last load, or of any access
+            long firstStore = -1, lastLoad = -1, firstAccess = -1, lastAccess = -1;
+            for (size_t row=firstRow; row<endRow; ++row)
+                for (int p=left; p<right; ++p) {
+                    const MemoryRegion::MemoryReading &reading = region.trace[row][p];
+                    if (reading.loadCount == 0 && reading.storeCount == 0 && reading.modCount == 0)
+                        continue;
+                    if (firstAccess == -1)
+                        firstAccess = row;
+                    lastAccess = row;
+                    if (firstStore == -1 && (reading.storeCount > 0 || reading.modCount > 0))
+                        firstStore = row;
+                    if (reading.loadCount > 0 || reading.modCount > 0)
+                        lastLoad = row;
+                }
+            if (firstStore == -1)
+                firstStore = firstAccess;
+            if (lastLoad < firstStore)
+                lastLoad = lastAccess;
+
+            TensorBlock block("", "", start - region.startAddr, end - start);
+            block.region = r;
+            if (firstStore != -1) {
+                block.firstUse = traceStartInstruction + (region.firstRow + firstStore) * instructionsPerRow;
+                block.lastUse = traceStartInstruction + (region.firstRow + lastLoad + 1) * instructionsPerRow;
+            } else {
+                block.firstUse = area.startInstruction;
+                block.lastUse = std::max(area.endInstruction, area.startInstruction + 1);
+            }
+            block.startOp = occurrenceIndex.at(block.firstUse);
+            block.endOp = occurrenceIndex.at(block.lastUse - 1);
+            tensors.push_back(block);
+        }
+    }
+}
+
+bool TraceSession::planMemory(const std::string &filename, unsigned long alignment) {
+
+    extractTensors();
+
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Could not open \"" << filename << "\" to save memory plan" << std::endl;
+        return false;
+    }
+    out << "region,tensor,start_op,end_op,first_use,last_use,size,observed_offset,greedy_by_size_offset,interval_colouring_offset\n";
+
+    for (size_t r=0; r<memoryRegions.size(); ++r) {
+        std::vector<TensorBlock> blocks;
+        std::vector<size_t> indices;
+        for (size_t t=0; t<tensors.size(); ++t)
+            if (tensors[t].region == r) {
+                blocks.push_back(tensors[t]);
+                indices.push_back(t);
+            }
+        if (blocks.empty())
+            continue;
+
+        MemoryPlanner planner(blocks, alignment);
+        MemoryPlanner::Plan greedy = planner.greedyBySize();
+        MemoryPlanner::Plan colouring = planner.intervalColouring();
+        const MemoryPlanner::Plan &best = greedy.arenaSize <= colouring.arenaSize ? greedy : colouring;
+
+        std::cout << "[" << memoryRegions[r].name << "] " << blocks.size() << " tensors, observed arena "
+                  << planner.observedArenaSize() << " bytes, peak live " << planner.peakLiveBytes()
+                  << " bytes, " << greedy.name << " " << greedy.arenaSize
+                  << " bytes, " << colouring.name << " " << colouring.arenaSize
+                  << " bytes, best " << best.name << "\n";
+
+        for (size_t b=0; b<blocks.size(); ++b)
+            out << memoryRegions[r].name << "," << indices[b] << ","
+                << blocks[b].startOp << "," << blocks[b].endOp << ","
+                << blocks[b].firstUse << "," << blocks[b].lastUse << ","
+                << blocks[b].size << "," << blocks[b].offset << ","
+                << greedy.offsets[b] << "," << colouring.offsets[b] << "\n";
+    }
+    return true;
+}
+
+bool TraceSession::saveTraffic(const std::string &filename) {
+
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Could not open \"" << filename << "\" to save memory traffic" << std::endl;
+        return false;
+    }
+
+    // region rows are indexed by session row, occurrences by their number
+    out << "scope,name,index,first_instruction,load_bytes,store_bytes,modify_bytes\n";
+    for (auto &region : memoryRegions)
+        for (size_t r=0; r<region.traffic.size(); ++r) {
+            const ByteTraffic &traffic = region.traffic[r];
+            size_t row = region.firstRow + r;
+            out << "region," << region.name << "," << row << ","
+                << (traceStartInstruction + row * instructionsPerRow) << ","
+                << traffic.loadBytes << "," << traffic.storeBytes << "," << traffic.modBytes << "\n";
+        }
+    for (size_t a=1; a<activities.size(); ++a)
+        for (size_t o=0; o<activities[a].occurrences.size(); ++o) {
+            const Activity::Occurrence &occ = activities[a].occurrences[o];
+            out << "occurrence," << activities[a].name << "," << o << "," << occ.start << ","
+                << occ.traffic.loadBytes << "," << occ.traffic.storeBytes << "," << occ.traffic.modBytes << "\n";
+        }
+    return true;
+}
+
+bool TraceSession::saveChromeTrace(const std::string &filename) {
+
+    ChromeTraceWriter writer;
+    if (!writer.open(filename, title))
+        return false;
+
+    // occurrences never stopped run to the end of the trace
+    unsigned long traceEnd = traceStartInstruction + traceRows() * instructionsPerRow;
+    for (size_t a=1; a<activities.size(); ++a) {
+        writer.threadName(a, activities[a].name);
+        for (size_t o=0; o<activities[a].occurrences.size(); ++o) {
+            const Activity::Occurrence &occ = activities[a].occurrences[o];
+            unsigned long stop = occ.stop >= occ.start ? occ.stop : std::max(traceEnd, occ.start);
+            writer.slice(a, activities[a].name, occ.start, stop - occ.start, o, occ.traffic);
+        }
+    }
+
+    // only rows where a region's traffic changes are written
+    for (auto &region : memoryRegions) {
+        std::string name = region.name + " bytes per row";
+        ByteTraffic last;
+        for (size_t r=0; r<region.traffic.size(); ++r) {
+            const ByteTraffic &traffic = region.traffic[r];
+            if (r > 0 && traffic.loadBytes == last.loadBytes && traffic.storeBytes == last.storeBytes &&
+                traffic.modBytes == last.modBytes)
+                continue;
+            writer.counter(name, traceStartInstruction + (region.firstRow + r) * instructionsPerRow, traffic);
+            last = traffic;
+        }
+        if (region.retired && last.total() > 0)
+            writer.counter(name, traceStartInstruction + (region.firstRow + region.traffic.size()) * instructionsPerRow, ByteTraffic());
+    }
+
+    std::cout << "[\033[92mVMT\033[0m] Wrote " << writer.events << " chrome trace events to " << filename << "\n";
+    return true;
+}
 
 void TraceSession::toStream(std::ofstream &out) {
 
+    // write file header
+    out.write(traceFileMagic, sizeof (traceFileMagic));
+    unsigned int version = fileVersion;
+    out.write((char*)&version, sizeof (version));
+
     // write single values
     out.write((char*)&TraceSession::boxAlpha, sizeof (TraceSession::boxAlpha));
     out.write((char*)&TraceSession::instructionsPerRow, sizeof (TraceSession::instructionsPerRow));
@@ -54,10 +582,99 @@ void TraceSession::toStream(std::ofstream &out) {
         out << timeMemoryArea;
 
     std::cout << "Wrote " << TraceSession::timeMemoryAreas.size() << " memory areas.\n";
+
+    // live span of each region
+    std::ostringstream spans;
+    for (auto &memoryRegion : TraceSession::memoryRegions) {
+        unsigned long firstRow = memoryRegion.firstRow;
+        unsigned long lastRow = memoryRegion.lastRow();
+        char retired = memoryRegion.retired;
+        spans.write((char*)&firstRow, sizeof (firstRow));
+        spans.write((char*)&lastRow, sizeof (lastRow));
+        spans.write(&retired, sizeof (retired));
+    }
+    writeSection(out, RegionSpans, spans.str());
+
+    // the region each refined region zooms into
+    bool refined = false;
+    for (auto &memoryRegion : TraceSession::memoryRegions)
+        refined |= memoryRegion.parent >= 0;
+    if (refined) {
+        std::ostringstream parents;
+        for (auto &memoryRegion : TraceSession::memoryRegions)
+            parents.write((char*)&memoryRegion.parent, sizeof (memoryRegion.parent));
+        writeSection(out, RegionParents, parents.str());
+    }
+
+    if (!skippedRows.empty()) {
+        std::ostringstream skipped;
+        unsigned long rows = skippedRows.size();
+        skipped.write((char*)&rows, sizeof (rows));
+        skipped.write(skippedRows.data(), skippedRows.size());
+        writeSection(out, SkippedRows, skipped.str());
+    }
+
+    if (reuseAnalysis.enabled) {
+        std::ostringstream reuse;
+        reuseAnalysis.toStream(reuse);
+        writeSection(out, ReuseHistograms, reuse.str());
+    }
+
+    // bytes accessed per row of each region then per activity occurrence
+    std::ostringstream traffic;
+    for (auto &memoryRegion : TraceSession::memoryRegions) {
+        ByteTraffic::writeVarint(traffic, memoryRegion.traffic.size());
+        for (auto &row : memoryRegion.traffic)
+            row.toStream(traffic);
+    }
+    for (auto &activity : TraceSession::activities) {
+        ByteTraffic::writeVarint(traffic, activity.occurrences.size());
+        for (auto &occ : activity.occurrences)
+            occ.traffic.toStream(traffic);
+    }
+    writeSection(out, Traffic, traffic.str());
+
+    if (accessPatterns.enabled) {
+        std::ostringstream patterns;
+        accessPatterns.toStream(patterns);
+        writeSection(out, PatternStreams, patterns.str());
+    }
+
+    if (windowIndexRows > 0) {
+        std::ostringstream index;
+        index.write((char*)&windowIndexRows, sizeof (windowIndexRows));
+        for (auto &memoryRegion : TraceSession::memoryRegions)
+            WindowIndex::regionToStream(index, memoryRegion, windowIndexRows);
+        writeSection(out, WindowIndexes, index.str());
+    }
+
+    // cache configuration followed by the misses of every region
+    if (cacheSimulator.enabled()) {
+        std::ostringstream misses;
+        cacheSimulator.toStream(misses);
+        for (auto &memoryRegion : TraceSession::memoryRegions)
+            memoryRegion.missesToStream(misses);
+        writeSection(out, CacheMisses, misses.str());
+    }
+    writeSection(out, EndOfSections, "");
 }
 
 void TraceSession::fromStream(std::ifstream &in) {
 
+    // read file header, legacy files have no header
+    unsigned int version = 1;
+    char magic[sizeof (traceFileMagic)];
+    in.read(magic, sizeof (magic));
+    if (in.gcount() == sizeof (magic) && std::string(magic, sizeof (magic)) == std::string(traceFileMagic, sizeof (traceFileMagic)))
+        in.read((char*)&version, sizeof (version));
+    else {
+        in.clear();
+        in.seekg(0);
+    }
+
+    if (version > fileVersion)
+        std::cerr << "Warning: trace file version " << version << " is newer than this tool (" << fileVersion << ").\n";
+
     // read single values
     in.read((char*)&TraceSession::boxAlpha, sizeof (TraceSession::boxAlpha));
     in.read((char*)&TraceSession::instructionsPerRow, sizeof (TraceSession::instructionsPerRow));
@@ -76,13 +693,79 @@ void TraceSession::fromStream(std::ifstream &in) {
 
     in.read((char*)&size, sizeof(size_t));
     for (size_t i = 0; i < size; ++i)
-        TraceSession::activities.push_back(Activity(in));
+        TraceSession::addActivity(Activity(in));
 
     std::cout << "read " << size << " activites.\n";
 
     in.read((char*)&size, sizeof(size_t));
     for (size_t i = 0; i < size; ++i)
-        TraceSession::timeMemoryAreas.push_back(TimeMemoryArea(in));
+        TraceSession::timeMemoryAreas.push_back(TimeMemoryArea(in, version));
 
     std::cout << "read " << size << " memory areas.\n";
+
+    if (version < 3)
+        return;
+
+    unsigned int tag;
+    unsigned long length;
+    while (in.read((char*)&tag, sizeof (tag)) && tag != EndOfSections) {
+        in.read((char*)&length, sizeof (length));
+        std::streampos sectionEnd = in.tellg() + (std::streamoff)length;
+        if (tag == RegionSpans) {
+            for (auto &memoryRegion : TraceSession::memoryRegions) {
+                unsigned long firstRow, lastRow;
+                char retired;
+                in.read((char*)&firstRow, sizeof (firstRow));
+                in.read((char*)&lastRow, sizeof (lastRow));
+                in.read(&retired, sizeof (retired));
+                memoryRegion.firstRow = firstRow;
+                memoryRegion.retired = retired;
+            }
+        }
+        else if (tag == ReuseHistograms)
+            reuseAnalysis.fromStream(in);
+        else if (tag == Traffic) {
+            for (auto &memoryRegion : TraceSession::memoryRegions) {
+                unsigned long rows = ByteTraffic::readVarint(in);
+                for (unsigned long row=0; row<rows; ++row) {
+                    ByteTraffic traffic;
+                    traffic.fromStream(in);
+                    if (row < memoryRegion.traffic.size())
+                        memoryRegion.traffic[row] = traffic;
+                }
+            }
+            for (auto &activity : TraceSession::activities) {
+                unsigned long count = ByteTraffic::readVarint(in);
+                for (unsigned long o=0; o<count; ++o) {
+                    ByteTraffic traffic;
+                    traffic.fromStream(in);
+                    if (o < activity.occurrences.size())
+                        activity.occurrences[o].traffic = traffic;
+                }
+            }
+        }
+        else if (tag == PatternStreams)
+            accessPatterns.fromStream(in);
+        else if (tag == SkippedRows) {
+            unsigned long rows = 0;
+            in.read((char*)&rows, sizeof (rows));
+            if (rows <= length - sizeof (rows)) {
+                skippedRows.resize(rows);
+                in.read(skippedRows.data(), rows);
+            }
+        }
+        else if (tag == RegionParents) {
+            for (auto &memoryRegion : TraceSession::memoryRegions) {
+                long parent = -1;
+                in.read((char*)&parent, sizeof (parent));
+                memoryRegion.parent = parent < (long)TraceSession::memoryRegions.size() ? parent : -1;
+            }
+        }
+        else if (tag == CacheMisses) {
+            cacheSimulator.fromStream(in);
+            for (auto &memoryRegion : TraceSession::memoryRegions)
+                memoryRegion.missesFromStream(in);
+        }
+        in.seekg(sectionEnd);
+    }
 }
@@ -6,38 +6,204 @@
 #include <thread>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
+#include <unordered_map>
+#include <deque>
 
 #include "tensor_block.h"
 #include "memory_region.h"
 #include "activity.h"
 #include "time_memory_area.h"
+#include "region_index.h"
+#include "reuse_analysis.h"
+#include "cache_simulator.h"
+#include "memory_planner.h"
+#include "access_pattern.h"
+#include "region_refiner.h"
+#include "page_map.h"
+#include "row_sampler.h"
+#include "window_index.h"
 
 class TraceSession {
 public:
     static void toStream(std::ofstream &out);
     static void fromStream(std::ifstream &in);
 
+    // current trace file format version, files without the magic header
+    // are read as version 1.
+    static const unsigned int fileVersion = 3;
+
+    // From version 3 the file ends with a list of tagged sections, each
+    // a u32 tag and u64 length followed by its data, ending with tag 0.
+    // Readers skip any sections they don't know.
+    enum SectionTag : unsigned int { EndOfSections = 0, RegionSpans = 1, ReuseHistograms = 2, CacheMisses = 3, Traffic = 4, PatternStreams = 5, WindowIndexes = 6, RegionParents = 7, SkippedRows = 8 };
+
+    static void addActivity(const Activity &activity);
+    // the first activity registered at addr, or nullptr
+    static Activity* findActivity(unsigned long addr);
+    // the indices of every activity registered at addr in the order they
+    // were added, all of which see its events, or nullptr
+    static const std::vector<size_t>* findActivities(unsigned long addr);
+
+    // sets the instruction range of each time-memory area from the
+    // occurrences of its start and end events.
+    static void resolveMemoryAreas();
+
     static std::string title;
 
     static std::vector<MemoryRegion> memoryRegions;
     static std::mutex memRegionsMutex;
 
+    // the following lock memRegionsMutex themselves. Regions are added
+    // starting at the row currently being recorded, retiring marks every
+    // live region starting at one of the addresses and returns how many,
+    // retiring their children along with them.
+    static void addMemoryRegions(const std::vector<MemoryRegion> &regions);
+    static size_t retireMemoryRegions(const std::vector<unsigned long> &startAddrs);
+    static void storeRow();
+
+    // Sealed rows handed over to the live preview while publishRows is set,
+    // so rows are never copied out of the regions under memRegionsMutex by
+    // another thread. Each row is queued as it is sealed, the last row of a
+    // region as it is retired, and every sealed row again when the rows are
+    // coarsened, tagged with the number of coarsenings at the time.
+    class SealedRow {
+    public:
+        size_t region;
+        unsigned int rowCoarsenings;
+        std::vector<MemoryRegion::MemoryReading> readings;
+    };
+    static bool publishRows;
+    static std::mutex sealedRowsMutex;
+    static std::vector<SealedRow> sealedRows;
+
+    // swaps the queued rows into rows, leaving the queue empty
+    static void takeSealedRows(std::vector<SealedRow> &rows);
+
+    // Halves the number of rows by merging adjacent pairs of rows in every
+    // region and doubles instructionsPerRow, used to keep capturing at a
+    // coarser resolution when the row budget is reached. Instruction
+    // counts, and so activities and areas, map onto the merged rows
+    // unchanged. rowCoarsenings counts how many times this has happened.
+    static void coarsenRows();
+    static unsigned int rowCoarsenings;
+
+    // With the binary protocol every region change is followed by a sync
+    // marker. Changes are queued against that sync and applied by the
+    // access thread when it reaches the marker, so they take effect at the
+    // right point in the access stream even though the control channel
+    // runs ahead of it.
+    static void queueMemoryRegions(const std::vector<MemoryRegion> &regions);
+    static void queueRetireMemoryRegions(const std::vector<unsigned long> &startAddrs);
+    static void applyRegionChanges(unsigned long sync);
+
+    // number of rows in the whole trace
+    static size_t traceRows();
+
+    // live regions only, must be used with memRegionsMutex held
+    static RegionIndex regionIndex;
+    static size_t rowsStored;
+
     static std::vector<Activity> activities;
     static std::mutex activitiesMutex;
+    static std::unordered_map<unsigned long, std::vector<size_t> > activityIndex;
 
     static std::vector<TimeMemoryArea> timeMemoryAreas;
+
+    // reuse distance histograms, only recorded and saved when enabled
+    static ReuseAnalysis reuseAnalysis;
+
+    // simulated cache hierarchy, regions record misses per pixel when it is
+    // enabled. missOverlayLevel is the level drawn over the trace, 1 for L1,
+    // or 0 to draw no overlay.
+    static CacheSimulator cacheSimulator;
+    static int missOverlayLevel;
+
+    // access pattern of each region per activity occurrence, drawn as a
+    // band on the activity blocks when recorded.
+    static AccessPatterns accessPatterns;
+
+    // spawns zoomed child regions over the hottest spans of large regions
+    // as rows are stored, when enabled.
+    static RegionRefiner regionRefiner;
+
+    // every page touched by the process, clustered into regions when the
+    // capture ends, when capturing a whole process.
+    static PageMap pageMap;
+
+    // adds the regions found in the page map, spanning the whole trace
+    static void addDiscoveredRegions();
+
+    // Rows recorded when sampling, skippedRows holding 1 for every session
+    // row whose accesses were skipped, or nothing when every row was
+    // recorded. Coarsened rows are skipped if either half was.
+    static RowSampler rowSampler;
+    static std::vector<char> skippedRows;
+    static void markSkippedRow(size_t row, bool skipped);
+
+    // scales the access totals of each region and the traffic of each
+    // activity occurrence up by the fraction of instructions recorded,
+    // returning the scale.
+    static double scaleSampledCounts(unsigned long instructions, unsigned long sampledInstructions);
+
+    // rows per block of the summed-area index saved with each region, see
+    // WindowIndex, or 0 to save no index.
+    static unsigned int windowIndexRows;
+
     static float boxAlpha;
     static float boxOutlineAlpha;
     static bool showTrace;
+    static bool showTraffic;
+
+    // saves the bytes accessed in each row of each region and during each
+    // activity occurrence.
+    static bool saveTraffic(const std::string &filename);
+
+    // writes the activity occurrences as slices, one track per activity,
+    // and the bytes accessed per row of each region as counter tracks in
+    // the Chrome trace event format, for viewing in Perfetto.
+    static bool saveChromeTrace(const std::string &filename);
 
     static unsigned long instructionsPerRow;
     static unsigned long maxTraceRows;
-    //static std::vector<TensorBlock> tensors;
+
+    // Buffer lifetimes of the time-memory areas, from the first store to
+    // the last load recorded within each area's address range. Areas with
+    // no recorded accesses keep the span of their events.
+    static std::vector<TensorBlock> tensors;
+    static void extractTensors();
+
+    // plans each region's tensors into the smallest arena it can, reports
+    // the results against the observed layout and saves every offset.
+    static bool planMemory(const std::string &filename, unsigned long alignment = 64);
     static unsigned long traceStartInstruction;
 
     static bool readShutdown;
     static std::mutex shutdownMutex;
+
+    // In-band synchronisation with the payload. After sending a sync
+    // message the payload stores to the sync flag, when that store is seen
+    // in the access stream the access thread waits until the control thread
+    // has handled the matching sync message, so every registration sent
+    // before it is live. Returns false if the wait timed out.
+    static void syncReceived();
+    static bool waitForSync(unsigned long count, int timeoutMs = 10000);
+
+    static std::atomic<unsigned long> syncFlagAddr;
+    static unsigned long syncsReceived;
+    static std::mutex syncMutex;
+    static std::condition_variable syncSignal;
+
+private:
+    class RegionChange {
+    public:
+        unsigned long sync;
+        std::vector<MemoryRegion> added;
+        std::vector<unsigned long> retired;
+    };
+    static std::deque<RegionChange> regionChanges;
 };
 
 #endif // __TRACE_SESSION_H__
\ No newline at end of file
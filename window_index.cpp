@@ -0,0 +1,61 @@
+#include "window_index.h"
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+size_t WindowIndex::Table::blockStart(size_t block) const {
+    return std::min((size_t)rows, block * blockRows);
+}
+
+WindowIndex::Counts WindowIndex::Table::at(size_t block, unsigned int column) const {
+    Counts counts;
+    size_t pos = (block * (resolution + 1) + column) * 3 * sizeof (unsigned long);
+    std::memcpy(&counts.loads, data + pos, sizeof (unsigned long));
+    std::memcpy(&counts.stores, data + pos + sizeof (unsigned long), sizeof (unsigned long));
+    std::memcpy(&counts.mods, data + pos + 2 * sizeof (unsigned long), sizeof (unsigned long));
+    return counts;
+}
+
+WindowIndex::Counts WindowIndex::Table::sum(size_t firstBlock, size_t endBlock, unsigned int firstColumn, unsigned int endColumn) const {
+    Counts counts = at(endBlock, endColumn);
+    counts -= at(firstBlock, endColumn);
+    counts -= at(endBlock, firstColumn);
+    counts += at(firstBlock, firstColumn);
+    return counts;
+}
+
+size_t WindowIndex::tableSize(unsigned long rows, unsigned int resolution, unsigned int blockRows) {
+    size_t blocks = (rows + blockRows - 1) / blockRows;
+    return (blocks + 1) * (resolution + 1) * 3 * sizeof (unsigned long);
+}
+
+void WindowIndex::regionToStream(std::ostream &out, const MemoryRegion &region, unsigned int blockRows) {
+    unsigned long rows = region.trace.size();
+    unsigned int resolution = region.resolution;
+    out.write((char*)&rows, sizeof (rows));
+    out.write((char*)&resolution, sizeof (resolution));
+
+    // counts of each column summed over the rows above the current boundary
+    std::vector<Counts> above(resolution);
+
+    auto writeBoundary = [&]() {
+        Counts left;
+        for (unsigned int x=0; x<=resolution; ++x) {
+            out.write((char*)&left.loads, sizeof (unsigned long));
+            out.write((char*)&left.stores, sizeof (unsigned long));
+            out.write((char*)&left.mods, sizeof (unsigned long));
+            if (x < resolution)
+                left += above[x];
+        }
+    };
+
+    writeBoundary();
+    for (unsigned long row=0; row<rows; ++row) {
+        const std::vector<MemoryRegion::MemoryReading> &line = region.trace[row];
+        for (unsigned int x=0; x<resolution && x<line.size(); ++x)
+            above[x].add(line[x]);
+        if ((row + 1) % blockRows == 0 || row + 1 == rows)
+            writeBoundary();
+    }
+}
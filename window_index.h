@@ -0,0 +1,80 @@
+#ifndef __WINDOW_INDEX_H__
+#define __WINDOW_INDEX_H__
+
+#include <iostream>
+
+#include "memory_region.h"
+
+/*
+    Summed-area index of the load, store and modify counts of a region.
+
+    Rows are grouped in blocks of blockRows and the table holds, for every
+    block boundary and pixel column, the counts summed over all rows above
+    the boundary and all columns left of the column. The counts of any
+    rectangle of whole blocks are then four lookups. Queries whose rows
+    don't fall on block boundaries decode the remaining rows at either end
+    from the trace, at most two blocks' worth whatever the window size.
+
+    Tables are written in fixed width so they can be queried in place from
+    a memory mapped trace file without being decoded.
+*/
+class WindowIndex
+{
+public:
+    static const unsigned int defaultBlockRows = 64;
+
+    class Counts {
+    public:
+        Counts() : loads(0), stores(0), mods(0) {}
+        unsigned long loads, stores, mods;
+
+        Counts& operator+= (const Counts &other) {
+            loads += other.loads;
+            stores += other.stores;
+            mods += other.mods;
+            return *this;
+        }
+        Counts& operator-= (const Counts &other) {
+            loads -= other.loads;
+            stores -= other.stores;
+            mods -= other.mods;
+            return *this;
+        }
+        void add(const MemoryRegion::MemoryReading &reading) {
+            loads += reading.loadCount;
+            stores += reading.storeCount;
+            mods += reading.modCount;
+        }
+    };
+
+    // Table of one region, pointing into the data it was read from
+    class Table {
+    public:
+        Table() : blockRows(0), rows(0), resolution(0), data(nullptr) {}
+
+        bool empty() const { return data == nullptr; }
+        size_t blocks() const { return (rows + blockRows - 1) / blockRows; }
+
+        // first row of a block, the last block may be short
+        size_t blockStart(size_t block) const;
+
+        // counts of blocks [firstBlock, endBlock) and columns [firstColumn, endColumn)
+        Counts sum(size_t firstBlock, size_t endBlock, unsigned int firstColumn, unsigned int endColumn) const;
+
+        unsigned int blockRows;
+        unsigned long rows;
+        unsigned int resolution;
+        const unsigned char *data;
+
+    private:
+        Counts at(size_t block, unsigned int column) const;
+    };
+
+    // writes the table of a region, rows in blocks of blockRows
+    static void regionToStream(std::ostream &out, const MemoryRegion &region, unsigned int blockRows);
+
+    // size in bytes of a table written by regionToStream, without its header
+    static size_t tableSize(unsigned long rows, unsigned int resolution, unsigned int blockRows);
+};
+
+#endif  // __WINDOW_INDEX_H__